@@ -0,0 +1,181 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures the throughput of handlebars_string_htmlspecialchars_append over the string benchmark templates and over
+// 1 MB of text with 0%, 1% and 20% of characters to escape, against escaping one byte at a time
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <talloc.h>
+
+#include "handlebars.h"
+#include "handlebars_memory.h"
+#include "handlebars_string.h"
+
+#define TOTAL_SIZE (64 * 1024 * 1024)
+#define BLOB_SIZE (1024 * 1024)
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char * const escapes[256] = {
+    ['&'] = "&amp;",
+    ['"'] = "&quot;",
+    ['\''] = "&#x27;",
+    ['<'] = "&lt;",
+    ['>'] = "&gt;",
+    ['`'] = "&#x60;",
+};
+
+// The implementation of handlebars_string_htmlspecialchars_append before it was vectorized
+static struct handlebars_string * escape_bytewise(
+    struct handlebars_context * ctx,
+    struct handlebars_string * string,
+    const char * str,
+    size_t len
+) {
+    size_t new_len = len;
+    size_t i;
+    const char * escape;
+
+    for (i = 0; i < len; i++) {
+        if (NULL != (escape = escapes[(unsigned char) str[i]])) {
+            new_len += strlen(escape) - 1;
+        }
+    }
+
+    string = handlebars_string_reserve(ctx, string, hbs_str_len(string) + new_len);
+    for (i = 0; i < len; i++) {
+        if (NULL != (escape = escapes[(unsigned char) str[i]])) {
+            string = handlebars_string_append_unsafe(string, escape, strlen(escape));
+        } else {
+            string = handlebars_string_append_unsafe(string, &str[i], 1);
+        }
+    }
+
+    return string;
+}
+
+static double run(struct handlebars_context * ctx, const char * str, size_t len, bool bytewise)
+{
+    size_t i;
+    size_t count = TOTAL_SIZE / len;
+    struct handlebars_string * string = handlebars_string_init(ctx, 0);
+    double start = now();
+
+    for (i = 0; i < count; i++) {
+        string = handlebars_string_truncate(string, 0, 0);
+        if (bytewise) {
+            string = escape_bytewise(ctx, string, str, len);
+        } else {
+            string = handlebars_string_htmlspecialchars_append(ctx, string, str, len);
+        }
+    }
+
+    double elapsed = now() - start;
+    handlebars_talloc_free(string);
+
+    return (count * len) / elapsed / (1024 * 1024);
+}
+
+static void report(struct handlebars_context * ctx, const char * name, const char * str, size_t len)
+{
+    struct handlebars_string * expected = escape_bytewise(ctx, handlebars_string_init(ctx, 0), str, len);
+    struct handlebars_string * actual = handlebars_string_htmlspecialchars(ctx, str, len);
+
+    if (hbs_str_len(expected) != hbs_str_len(actual) || 0 != memcmp(hbs_str_val(expected), hbs_str_val(actual), hbs_str_len(actual))) {
+        fprintf(stderr, "Unexpected output for %s\n", name);
+        exit(1);
+    }
+    handlebars_talloc_free(expected);
+    handlebars_talloc_free(actual);
+
+    printf("%-24s %16.1f %16.1f\n", name, run(ctx, str, len, false), run(ctx, str, len, true));
+}
+
+static void report_file(struct handlebars_context * ctx, const char * srcdir, const char * file)
+{
+    char path[4096];
+    static char buf[64 * 1024];
+    size_t len;
+    FILE * fp;
+
+    snprintf(path, sizeof(path), "%s/templates/%s", srcdir, file);
+    if (NULL == (fp = fopen(path, "rb"))) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        exit(1);
+    }
+    len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+
+    if (len > 0) {
+        report(ctx, file, buf, len);
+    }
+}
+
+static void report_blob(struct handlebars_context * ctx, char * blob, unsigned percent)
+{
+    static const char text[] = "Lorem ipsum dolor sit amet, consectetur adipiscing elit. ";
+    static const char specials[] = "&\"'<>`";
+    char name[32];
+    size_t i;
+
+    srand(percent);
+    for (i = 0; i < BLOB_SIZE; i++) {
+        if ((unsigned) rand() % 100 < percent) {
+            blob[i] = specials[rand() % 6];
+        } else {
+            blob[i] = text[i % (sizeof(text) - 1)];
+        }
+    }
+
+    snprintf(name, sizeof(name), "1 MB, %u%% escaped", percent);
+    report(ctx, name, blob, BLOB_SIZE);
+}
+
+int main(void)
+{
+    struct handlebars_context * ctx = handlebars_context_ctor();
+    const char * srcdir = getenv("srcdir");
+    char * blob = malloc(BLOB_SIZE);
+
+    if (!srcdir) {
+        srcdir = ".";
+    }
+
+    printf("%-24s %16s %16s\n", "input", "escape MB/s", "bytewise MB/s");
+    report_file(ctx, srcdir, "string.handlebars");
+    report_file(ctx, srcdir, "string.expected");
+    report_blob(ctx, blob, 0);
+    report_blob(ctx, blob, 1);
+    report_blob(ctx, blob, 20);
+
+    free(blob);
+    handlebars_context_dtor(ctx);
+
+    return 0;
+}
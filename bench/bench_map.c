@@ -0,0 +1,200 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures the time per key of the workload of tests/test_map.c, scaled up to 1M keys: adding random keys of 4 to 127
+// printable characters while skipping duplicates, finding every key and as many missing keys, iterating in insertion
+// order, and removing every key while iterating. The same workload is then run with keys chosen to collide in the
+// hash table, like an attacker could choose the keys of a JSON object
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <talloc.h>
+
+#include "handlebars.h"
+#include "handlebars_map.h"
+#include "handlebars_memory.h"
+#include "handlebars_string.h"
+#include "handlebars_value.h"
+
+#define STRSIZE 128
+
+// The bits of the hash of a key that select the first group of slots to probe in tables of up to 1024 groups
+#define COLLIDING_MASK (((1u << 10) - 1) << 7)
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct handlebars_string * random_string(struct handlebars_context * ctx)
+{
+    char tmp[STRSIZE];
+    size_t len = (rand() % (STRSIZE - 4)) + 4;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        tmp[i] = (char) (32 + (rand() % (126 - 32)));
+    }
+
+    struct handlebars_string * string = handlebars_string_ctor(ctx, tmp, len);
+    (void) hbs_str_hash(string);
+    handlebars_string_addref(string);
+    return string;
+}
+
+static struct handlebars_string * colliding_string(struct handlebars_context * ctx)
+{
+    static unsigned long counter = 0;
+    char tmp[STRSIZE];
+    size_t len;
+
+    // The hash of strings does not depend on the process, so these can be found ahead of time
+    do {
+        len = (size_t) snprintf(tmp, sizeof(tmp), "key%lx", counter++);
+    } while (handlebars_string_hash(tmp, len) & COLLIDING_MASK);
+
+    struct handlebars_string * string = handlebars_string_ctor(ctx, tmp, len);
+    (void) hbs_str_hash(string);
+    handlebars_string_addref(string);
+    return string;
+}
+
+static void run(
+    struct handlebars_context * ctx,
+    const char * name,
+    struct handlebars_string * (*generate)(struct handlebars_context * ctx),
+    size_t count
+) {
+    struct handlebars_string ** keys = handlebars_talloc_array(ctx, struct handlebars_string *, count);
+    struct handlebars_string ** missing = handlebars_talloc_array(ctx, struct handlebars_string *, count);
+    struct handlebars_map * map = handlebars_map_ctor(ctx, 0);
+    size_t found = 0;
+    size_t false_hits = 0;
+    size_t pos = 0;
+    size_t i;
+    double start;
+    double add;
+    double find;
+    double miss;
+    double iterate;
+    double remove;
+    HANDLEBARS_VALUE_DECL(value);
+
+    srand(0x5d0);
+    for (i = 0; i < count; i++) {
+        keys[i] = generate(ctx);
+        missing[i] = generate(ctx);
+    }
+
+    start = now();
+    for (i = 0; i < count; i++) {
+        if (handlebars_map_find(map, keys[i])) {
+            continue;
+        }
+        handlebars_value_integer(value, pos++);
+        map = handlebars_map_add(map, keys[i], value);
+    }
+    add = now() - start;
+
+    start = now();
+    for (i = 0; i < count; i++) {
+        found += NULL != handlebars_map_find(map, keys[i]);
+    }
+    find = now() - start;
+
+    start = now();
+    for (i = 0; i < count; i++) {
+        false_hits += NULL != handlebars_map_find(map, missing[i]);
+    }
+    miss = now() - start;
+
+    start = now();
+    pos = 0;
+    handlebars_map_foreach(map, index, key, v) {
+        pos += handlebars_value_get_intval(v) == (long) index;
+    } handlebars_map_foreach_end(map);
+    iterate = now() - start;
+
+    if (found != count || pos != handlebars_map_count(map)) {
+        fprintf(stderr, "Unexpected map contents\n");
+        exit(1);
+    }
+
+    start = now();
+    handlebars_map_foreach(map, index, key, v) {
+        map = handlebars_map_remove(map, key);
+    } handlebars_map_foreach_end(map);
+    remove = now() - start;
+
+    if (handlebars_map_count(map) != 0) {
+        fprintf(stderr, "Unexpected map count %zu\n", handlebars_map_count(map));
+        exit(1);
+    }
+
+    // Keys are compared by length and 32-bit hash, so a few of the missing keys may be found at 1M keys
+    printf(
+        "%-10s %10zu %10.1f %10.1f %10.1f %10.1f %10.1f %12zu\n",
+        name,
+        count,
+        add * 1e9 / count,
+        find * 1e9 / count,
+        miss * 1e9 / count,
+        iterate * 1e9 / count,
+        remove * 1e9 / count,
+        false_hits
+    );
+
+    HANDLEBARS_VALUE_UNDECL(value);
+    handlebars_map_dtor(map);
+    for (i = 0; i < count; i++) {
+        handlebars_string_delref(keys[i]);
+        handlebars_string_delref(missing[i]);
+    }
+    handlebars_talloc_free(keys);
+    handlebars_talloc_free(missing);
+}
+
+int main(void)
+{
+    static const size_t counts[] = {1000, 10000, 100000, 1000000};
+    static const size_t colliding_counts[] = {1000, 10000};
+    struct handlebars_context * ctx = handlebars_context_ctor();
+    size_t i;
+
+    printf(
+        "%-10s %10s %10s %10s %10s %10s %10s %12s\n",
+        "keys", "count", "add ns", "find ns", "miss ns", "iterate ns", "remove ns", "false hits"
+    );
+    for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        run(ctx, "random", random_string, counts[i]);
+    }
+    for (i = 0; i < sizeof(colliding_counts) / sizeof(colliding_counts[0]); i++) {
+        run(ctx, "colliding", colliding_string, colliding_counts[i]);
+    }
+
+    handlebars_context_dtor(ctx);
+
+    return 0;
+}
@@ -0,0 +1,91 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures the throughput of building a string by repeated appends, for chunk sizes from 1 byte to 4 KB, with the
+// geometric growth of handlebars_string_append and with growing the buffer to the exact size on every append
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <talloc.h>
+
+#include "handlebars.h"
+#include "handlebars_memory.h"
+#include "handlebars_string.h"
+
+#define TOTAL_SIZE (16 * 1024 * 1024)
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(struct handlebars_context * ctx, const char * chunk, size_t chunk_size, bool exact)
+{
+    size_t i;
+    size_t count = TOTAL_SIZE / chunk_size;
+    struct handlebars_string * string = handlebars_string_init(ctx, 0);
+    double start = now();
+
+    for (i = 0; i < count; i++) {
+        if (exact) {
+            string = handlebars_string_extend(ctx, string, hbs_str_len(string) + chunk_size);
+            string = handlebars_string_append_unsafe(string, chunk, chunk_size);
+        } else {
+            string = handlebars_string_append(ctx, string, chunk, chunk_size);
+        }
+    }
+    string = handlebars_string_compact(string);
+
+    double elapsed = now() - start;
+    if (hbs_str_len(string) != count * chunk_size) {
+        fprintf(stderr, "Unexpected length %zu\n", hbs_str_len(string));
+        exit(1);
+    }
+    handlebars_talloc_free(string);
+
+    return (count * chunk_size) / elapsed / (1024 * 1024);
+}
+
+int main(void)
+{
+    static const size_t chunk_sizes[] = {1, 4, 16, 64, 256, 1024, 4096};
+    struct handlebars_context * ctx = handlebars_context_ctor();
+    char * chunk = malloc(4096);
+    size_t i;
+
+    memset(chunk, 'x', 4096);
+
+    printf("%10s %16s %16s\n", "chunk", "append MB/s", "exact MB/s");
+    for (i = 0; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); i++) {
+        double append = run(ctx, chunk, chunk_sizes[i], false);
+        double exact = run(ctx, chunk, chunk_sizes[i], true);
+        printf("%10zu %16.1f %16.1f\n", chunk_sizes[i], append, exact);
+    }
+
+    free(chunk);
+    handlebars_context_dtor(ctx);
+
+    return 0;
+}
@@ -35,6 +35,7 @@
 #include "handlebars.h"
 #include "handlebars_ast.h"
 #include "handlebars_ast_printer.h"
+#include "handlebars_bundle.h"
 #include "handlebars_cache.h"
 #include "handlebars_closure.h"
 #include "handlebars_compiler.h"
@@ -49,6 +50,7 @@
 #include "handlebars_opcode_serializer.h"
 #include "handlebars_parser.h"
 #include "handlebars_partial_loader.h"
+#include "handlebars_sink.h"
 #include "handlebars_stack.h"
 #include "handlebars_string.h"
 #include "handlebars_token.h"
@@ -73,11 +75,15 @@ static const char * partial_path = ".";
 static const char * partial_extension = ".hbs";
 static unsigned long compiler_flags = 0;
 static short enable_partial_loader = 0;
+static bool bundle_partials = false;
 static long run_count = 1;
+static bool reuse_vm = false;
 static bool convert_input = true;
 static bool newline_at_eof = true;
 static size_t pool_size = 2 * 1024 * 1024;
+static size_t arena_size = HANDLEBARS_VM_ARENA_SIZE;
 static bool pretty_print = true;
+static bool alloc_profile = false;
 
 enum handlebarsc_mode {
     handlebarsc_mode_usage = 0,
@@ -107,6 +113,10 @@ enum handlebarsc_flag {
     handlebarsc_flag_partial_loader = 505,
     handlebarsc_flag_flags = 506,
     handlebarsc_flag_pretty_print = 507,
+    handlebarsc_flag_bundle_partials = 508,
+    handlebarsc_flag_reuse_vm = 509,
+    handlebarsc_flag_arena_size = 510,
+    handlebarsc_flag_alloc_profile = 511,
 
     // modes
     handlebarsc_flag_lex = 600,
@@ -151,12 +161,16 @@ static void readOpts(int argc, char * argv[])
         HBSC_OPT(partial-loader, no_argument, handlebarsc_flag_partial_loader)
         HBSC_OPT(partial-path, required_argument, handlebarsc_flag_partial_path)
         HBSC_OPT(partial-ext, required_argument, handlebarsc_flag_partial_ext)
+        HBSC_OPT(bundle-partials, no_argument, handlebarsc_flag_bundle_partials)
         // misc
         HBSC_OPT(run-count, required_argument, handlebarsc_flag_run_count)
+        HBSC_OPT(reuse-vm, no_argument, handlebarsc_flag_reuse_vm)
         HBSC_OPT(no-convert-input, no_argument, handlebarsc_flag_no_convert_input)
         HBSC_OPT(no-newline, no_argument, handlebarsc_flag_no_newline)
         HBSC_OPT(pool-size, required_argument, handlebarsc_flag_pool_size)
+        HBSC_OPT(arena-size, required_argument, handlebarsc_flag_arena_size)
         HBSC_OPT(pretty-print, no_argument, handlebarsc_flag_pretty_print)
+        HBSC_OPT(alloc-profile, no_argument, handlebarsc_flag_alloc_profile)
         // end
         HBSC_OPT_END
     };
@@ -234,6 +248,9 @@ start:
             if (NULL != strstr(optarg, "mustache_style_lambdas")) {
                 compiler_flags |= handlebars_compiler_flag_mustache_style_lambdas;
             }
+            if (NULL != strstr(optarg, "superinstructions")) {
+                compiler_flags |= handlebars_compiler_flag_superinstructions;
+            }
             break;
 
         // partials
@@ -249,6 +266,14 @@ start:
             partial_extension = optarg;
             break;
 
+        case handlebarsc_flag_bundle_partials:
+            bundle_partials = true;
+            break;
+
+        case handlebarsc_flag_reuse_vm:
+            reuse_vm = true;
+            break;
+
         // input
         case handlebarsc_flag_template:
             input_name = optarg;
@@ -274,10 +299,18 @@ start:
             sscanf(optarg, "%zu", &pool_size);
             break;
 
+        case handlebarsc_flag_arena_size:
+            sscanf(optarg, "%zu", &arena_size);
+            break;
+
         case handlebarsc_flag_pretty_print:
             pretty_print = true;
             break;
 
+        case handlebarsc_flag_alloc_profile:
+            alloc_profile = true;
+            break;
+
         default: assert(0); break; // LCOV_EXCL_LINE
     }
 
@@ -366,13 +399,18 @@ static int do_usage(void)
         "  --flags=FLAGS         The flags to pass to the compiler separated by commas. One or more of:\n"
         "                        compat, known_helpers_only, string_params, track_ids, no_escape,\n"
         "                        ignore_standalone, alternate_decorators, strict, assume_objects,\n"
-        "                        mustache_style_lambdas\n"
+        "                        mustache_style_lambdas, superinstructions\n"
         "  --no-convert-input    Do not convert data to native types (use JSON wrapper)\n"
         "  --partial-loader      Specify to enable loading partials dynamically\n"
         "  --partial-path=DIR    The directory in which to look for partials\n"
         "  --partial-ext=EXT     The file extension of partials, including the '.'\n"
+        "  --bundle-partials     Compile the partials called by the template into the same module\n"
         "  --pool-size=SIZE      The size of the memory pool to use, 0 to disable (default 2 MB)\n"
+        "  --arena-size=SIZE     The size of the memory pool of each render, 0 to disable (default 64 KB)\n"
         "  --run-count=NUM       The number of times to execute (for benchmarking)\n"
+        "  --reuse-vm            Reset and reuse one VM for all runs instead of constructing one per run\n"
+        "  --alloc-profile       Print the calls, bytes, live bytes and peak bytes of the allocations per\n"
+        "                        talloc name to stderr (requires --enable-handlebars-memory)\n"
         "\n"
         "The partial loader will concat the partial-path, given partial name in the template,\n"
         "and the partial-extension to resolve the file from which to load the partial.\n"
@@ -713,29 +751,40 @@ static int do_execute(void)
     program = handlebars_compiler_compile_ex(compiler, ast);
 
     // Serialize
-    struct handlebars_module * module = handlebars_program_serialize(ctx, program);
+    struct handlebars_module * module;
+    if (bundle_partials) {
+        module = handlebars_program_bundle(ctx, program, partials);
+    } else {
+        module = handlebars_program_serialize(ctx, program);
+    }
 
-    // Execute
-    struct handlebars_string * buffer = NULL;
+    // Execute - only the last run is written, straight to stdout
+    struct handlebars_sink * sink = handlebars_sink_file_ctor(ctx, stdout);
+    struct handlebars_vm * vm = NULL;
     do {
-        if (buffer) {
-            handlebars_talloc_free(buffer);
-            buffer = NULL;
+        if (vm == NULL) {
+            vm = handlebars_vm_ctor(ctx);
+            handlebars_vm_set_flags(vm, compiler_flags);
+            handlebars_vm_set_partials(vm, partials);
+            handlebars_vm_set_arena_size(vm, arena_size);
+        } else {
+            handlebars_vm_reset(vm);
         }
 
-        struct handlebars_vm * vm;
-        vm = handlebars_vm_ctor(ctx);
-        handlebars_vm_set_flags(vm, compiler_flags);
-        handlebars_vm_set_partials(vm, partials);
-
-        buffer = handlebars_vm_execute(vm, module, input);
-        buffer = talloc_steal(ctx, buffer);
+        if (run_count > 1) {
+            handlebars_talloc_free(handlebars_vm_execute(vm, module, input));
+        } else {
+            handlebars_vm_execute_sink(vm, module, input, sink);
+        }
 
-        handlebars_vm_dtor(vm);
+        if (!reuse_vm) {
+            handlebars_vm_dtor(vm);
+            vm = NULL;
+        }
     } while(--run_count > 0);
 
-    if (buffer) {
-        fwrite(hbs_str_val(buffer), sizeof(char), hbs_str_len(buffer), stdout);
+    if (vm) {
+        handlebars_vm_dtor(vm);
     }
 
     if (newline_at_eof) {
@@ -748,6 +797,27 @@ static int do_execute(void)
     return 0;
 }
 
+static int do_mode(void)
+{
+    switch( mode ) {
+        case handlebarsc_mode_version: return do_version();
+        case handlebarsc_mode_lex: return do_lex();
+        case handlebarsc_mode_parse: return do_parse();
+        case handlebarsc_mode_compile: return do_compile();
+        case handlebarsc_mode_module: return do_module();
+        case handlebarsc_mode_execute: return do_execute();
+        case handlebarsc_mode_debuginfo: return do_debuginfo();
+        case handlebarsc_mode_usage: return do_usage();
+
+        // LCOV_EXCL_START
+        default:
+            assert(0);
+            do_usage();
+            return 1;
+        // LCOV_EXCL_STOP
+    }
+}
+
 int main(int argc, char * argv[])
 {
 #ifdef HANDLEBARS_HAVE_VALGRIND
@@ -778,21 +848,18 @@ int main(int argc, char * argv[])
         }
     }
 
-    switch( mode ) {
-        case handlebarsc_mode_version: return do_version();
-        case handlebarsc_mode_lex: return do_lex();
-        case handlebarsc_mode_parse: return do_parse();
-        case handlebarsc_mode_compile: return do_compile();
-        case handlebarsc_mode_module: return do_module();
-        case handlebarsc_mode_execute: return do_execute();
-        case handlebarsc_mode_debuginfo: return do_debuginfo();
-        case handlebarsc_mode_usage: return do_usage();
-
-        // LCOV_EXCL_START
-        default:
-            assert(0);
-            do_usage();
-            return 1;
-        // LCOV_EXCL_STOP
+    if (!alloc_profile) {
+        return do_mode();
     }
+
+#ifdef HANDLEBARS_MEMORY
+    handlebars_memory_profile_enable();
+    int ret = do_mode();
+    handlebars_memory_profile_disable();
+    handlebars_memory_profile_print(stderr, 0);
+    return ret;
+#else
+    fprintf(stderr, "Allocation profiling is disabled, configure with --enable-handlebars-memory\n");
+    return 1;
+#endif
 }
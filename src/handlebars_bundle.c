@@ -0,0 +1,166 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <assert.h>
+#include <setjmp.h>
+#include <string.h>
+
+#define HANDLEBARS_COMPILER_PRIVATE
+#define HANDLEBARS_OPCODES_PRIVATE
+
+#include "handlebars.h"
+#include "handlebars_memory.h"
+#include "handlebars_private.h"
+
+#include "handlebars_bundle.h"
+#include "handlebars_compiler.h"
+#include "handlebars_delimiters.h"
+#include "handlebars_opcodes.h"
+#include "handlebars_opcode_serializer.h"
+#include "handlebars_parser.h"
+#include "handlebars_string.h"
+#include "handlebars_value.h"
+
+struct handlebars_bundle {
+    size_t count;
+    //! The names of the partials called by the bundled programs, in the order they were found
+    struct handlebars_string ** names;
+    //! The compiled partials, NULL if the partial is left to the runtime
+    struct handlebars_program ** programs;
+};
+
+static void bundle_add(struct handlebars_context * context, struct handlebars_bundle * bundle, struct handlebars_string * name)
+{
+    size_t i;
+
+    // The partial block and other data variables are only known at runtime
+    if( hbs_str_len(name) > 0 && hbs_str_val(name)[0] == '@' ) {
+        return;
+    }
+
+    for( i = 0; i < bundle->count; i++ ) {
+        if( handlebars_string_eq(bundle->names[i], name) ) {
+            return;
+        }
+    }
+
+    bundle->names = MC(handlebars_talloc_realloc(context, bundle->names, struct handlebars_string *, bundle->count + 1));
+    bundle->programs = MC(handlebars_talloc_realloc(context, bundle->programs, struct handlebars_program *, bundle->count + 1));
+    bundle->names[bundle->count] = name;
+    bundle->programs[bundle->count] = NULL;
+    bundle->count++;
+}
+
+static void bundle_scan(struct handlebars_context * context, struct handlebars_bundle * bundle, struct handlebars_program * program)
+{
+    size_t i;
+
+    for( i = 0; i < program->opcodes_length; i++ ) {
+        struct handlebars_opcode * opcode = program->opcodes[i];
+        if( opcode->type == handlebars_opcode_type_invoke_partial && !opcode->op1.data.boolval &&
+                opcode->op2.type == handlebars_operand_type_string ) {
+            bundle_add(context, bundle, opcode->op2.data.string.string);
+        }
+    }
+
+    for( i = 0; i < program->children_length; i++ ) {
+        bundle_scan(context, bundle, program->children[i]);
+    }
+}
+
+static struct handlebars_program * bundle_compile(
+    struct handlebars_context * context,
+    struct handlebars_value * partials,
+    struct handlebars_string * name,
+    unsigned long flags,
+    struct handlebars_value * rv
+) {
+    struct handlebars_value * partial = handlebars_value_map_find(partials, name, rv);
+
+    if( !partial || handlebars_value_get_type(partial) != HANDLEBARS_VALUE_TYPE_STRING ) {
+        return NULL;
+    }
+
+    struct handlebars_string * tmpl = handlebars_value_get_string_ex(context, partial);
+
+    // Partials are preprocessed the same way as by the VM, without the delimiters of the caller. The preprocessor
+    // releases the reference it is given
+    if( flags & handlebars_compiler_flag_compat ) {
+        handlebars_string_addref(tmpl);
+        tmpl = handlebars_preprocess_delimiters(context, tmpl, NULL, NULL);
+    }
+
+    struct handlebars_parser * parser = handlebars_parser_ctor(context);
+    struct handlebars_ast_node * ast = handlebars_parse_ex(parser, tmpl, flags);
+
+    struct handlebars_compiler * compiler = handlebars_compiler_ctor(context);
+    handlebars_compiler_set_flags(compiler, flags);
+    return handlebars_compiler_compile_ex(compiler, ast);
+}
+
+struct handlebars_module * handlebars_program_bundle(
+    struct handlebars_context * context,
+    struct handlebars_program * program,
+    struct handlebars_value * partials
+) {
+    struct handlebars_context * ctx = handlebars_context_ctor_ex(context);
+    struct handlebars_bundle * const bundle = MC(handlebars_talloc_zero(ctx, struct handlebars_bundle));
+    struct handlebars_error prev_error = *HBSCTX(context)->e;
+    jmp_buf buf;
+    size_t volatile i;
+    size_t count = 0;
+    HANDLEBARS_VALUE_DECL(rv);
+
+    bundle_scan(ctx, bundle, program);
+
+    // Compile the partials, and the partials they call in turn. A partial that fails to load or compile is left to
+    // the runtime, which only reports it if it is actually called. The partials may throw on the parent context
+    for( i = 0; i < bundle->count; i++ ) {
+        if( handlebars_setjmp_ex(ctx, &buf) ) {
+            continue;
+        }
+        HBSCTX(context)->e->jmp = &buf;
+
+        bundle->programs[i] = bundle_compile(ctx, partials, bundle->names[i], program->flags, rv);
+        if( bundle->programs[i] ) {
+            bundle_scan(ctx, bundle, bundle->programs[i]);
+        }
+    }
+
+    // Forget the errors of the partials that were left out
+    *HBSCTX(context)->e = prev_error;
+    HANDLEBARS_VALUE_UNDECL(rv);
+
+    // Only keep the partials that were compiled
+    for( i = 0; i < bundle->count; i++ ) {
+        if( bundle->programs[i] ) {
+            bundle->names[count] = bundle->names[i];
+            bundle->programs[count] = bundle->programs[i];
+            count++;
+        }
+    }
+
+    struct handlebars_module * module = handlebars_program_serialize_bundle(context, program, count, bundle->names, bundle->programs);
+
+    handlebars_context_dtor(ctx);
+
+    return module;
+}
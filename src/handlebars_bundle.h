@@ -0,0 +1,52 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ * @brief Bundling of templates with their partials into a single module
+ */
+
+#ifndef HANDLEBARS_BUNDLE_H
+#define HANDLEBARS_BUNDLE_H
+
+#include "handlebars.h"
+
+HBS_EXTERN_C_START
+
+struct handlebars_context;
+struct handlebars_module;
+struct handlebars_program;
+struct handlebars_value;
+
+/**
+ * @brief Serialize a program into a module that also contains every partial it calls by a static name, recursively.
+ *        The partials are looked up in the given map (or partial loader) and compiled with the flags of the program.
+ *        Partials that cannot be found, or are not strings, are left to be looked up at runtime.
+ * @param[in] context The handlebars context
+ * @param[in] program The compiled root template
+ * @param[in] partials The partials
+ * @return The serialized program
+ */
+struct handlebars_module * handlebars_program_bundle(
+    struct handlebars_context * context,
+    struct handlebars_program * program,
+    struct handlebars_value * partials
+) HBS_ATTR_NONNULL_ALL HBS_ATTR_RETURNS_NONNULL HBS_ATTR_WARN_UNUSED_RESULT;
+
+HBS_EXTERN_C_END
+
+#endif /* HANDLEBARS_BUNDLE_H */
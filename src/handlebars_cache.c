@@ -24,6 +24,8 @@
 #include "handlebars_cache_private.h"
 #include "handlebars_memory.h"
 #include "handlebars_private.h"
+#include "handlebars_value.h"
+#include "handlebars_vm.h"
 
 
 
@@ -51,6 +53,8 @@ void handlebars_cache_add(
     struct handlebars_string * tmpl,
     struct handlebars_module * module
 ) {
+    // Link before adding, as the shared memory cache is read-only once the module has been copied into it
+    handlebars_vm_link(module);
     cache->hnd->add(cache, tmpl, module);
 }
 
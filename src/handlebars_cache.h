@@ -98,7 +98,8 @@ struct handlebars_module * handlebars_cache_find(
 ) HBS_ATTR_NONNULL_ALL HBS_ATTR_WARN_UNUSED_RESULT;
 
 /**
- * @brief Add a program to the cache. Adding the same key twice is an error.
+ * @brief Add a program to the cache. Adding the same key twice is an error. The module is linked with
+ *        #handlebars_vm_link first.
  * @param[in] cache The cache
  * @param[in] key The cache key. Can be a filename, actual template, or arbitrary string
  * @param[in] program The program
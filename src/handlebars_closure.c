@@ -82,7 +82,10 @@ struct handlebars_closure * handlebars_closure_ctor(
     int localc,
     struct handlebars_value * localv
 ) {
-    struct handlebars_closure * closure = handlebars_talloc_zero_size(vm, sizeof(struct handlebars_closure) + (sizeof(struct handlebars_value) * localc));
+    struct handlebars_closure * closure = handlebars_talloc_zero_size(
+        handlebars_vm_get_arena(vm),
+        sizeof(struct handlebars_closure) + (sizeof(struct handlebars_value) * localc)
+    );
     talloc_set_type(closure, struct handlebars_closure);
 #ifndef HANDLEBARS_NO_REFCOUNT
     handlebars_rc_init(&closure->rc);
@@ -1434,6 +1434,48 @@ static void handlebars_compiler_accept(
     compiler->sns->i--;
 }
 
+// {{{ Superinstructions
+
+/**
+ * @brief Replace getContext, lookupOnContext, resolvePossibleLambda, append(Escaped) with a single
+ *        lookupOnContextAppend(Escaped). The lookupOnContext opcode is reused, with the depth in its unused second
+ *        operand.
+ */
+static void handlebars_compiler_fuse_opcodes(struct handlebars_program * program)
+{
+    struct handlebars_opcode ** opcodes = program->opcodes;
+    size_t count = program->opcodes_length;
+    size_t i;
+    size_t j = 0;
+
+    for( i = 0; i < count; i++ ) {
+        struct handlebars_opcode ** cur = opcodes + i;
+
+        if( i + 3 < count &&
+                cur[0]->type == handlebars_opcode_type_get_context &&
+                cur[1]->type == handlebars_opcode_type_lookup_on_context &&
+                cur[2]->type == handlebars_opcode_type_resolve_possible_lambda &&
+                (cur[3]->type == handlebars_opcode_type_append || cur[3]->type == handlebars_opcode_type_append_escaped) ) {
+            struct handlebars_opcode * fused = cur[1];
+            fused->type = cur[3]->type == handlebars_opcode_type_append ?
+                handlebars_opcode_type_lookup_on_context_append :
+                handlebars_opcode_type_lookup_on_context_append_escaped;
+            handlebars_operand_set_longval(&fused->op2, cur[0]->op1.data.longval);
+            handlebars_talloc_free(cur[0]);
+            handlebars_talloc_free(cur[2]);
+            handlebars_talloc_free(cur[3]);
+            opcodes[j++] = fused;
+            i += 3;
+        } else {
+            opcodes[j++] = *cur;
+        }
+    }
+
+    program->opcodes_length = j;
+}
+
+// }}} Superinstructions
+
 struct handlebars_program * handlebars_compiler_compile_ex(
     struct handlebars_compiler * compiler,
     struct handlebars_ast_node * node
@@ -1471,6 +1513,10 @@ void handlebars_compiler_compile(
     compiler->program->flags = compiler->flags;
     handlebars_compiler_accept(compiler, node);
 
+    if (compiler->flags & handlebars_compiler_flag_superinstructions) {
+        handlebars_compiler_fuse_opcodes(compiler->program);
+    }
+
     // Reset stacks
     compiler->bps = NULL;
     compiler->sns = NULL;
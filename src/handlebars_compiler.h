@@ -91,6 +91,11 @@ enum handlebars_compiler_flag {
 
     handlebars_compiler_flag_mustache_style_lambdas = (1 << 12),
 
+    /**
+     * @brief Fuse common opcode sequences into superinstructions. The output will no longer match handlebars.js
+     */
+    handlebars_compiler_flag_superinstructions = (1 << 13),
+
     // Composite option flags
 
     /**
@@ -101,7 +106,7 @@ enum handlebars_compiler_flag {
     /**
      * @brief All flags
      */
-    handlebars_compiler_flag_all = ((1 << 13) - 1)
+    handlebars_compiler_flag_all = ((1 << 14) - 1)
 };
 
 enum handlebars_compiler_result_flag {
@@ -247,5 +247,5 @@ struct handlebars_string * handlebars_preprocess_delimiters(
     handlebars_string_delref(tmpl);
 
     HANDLEBARS_MEMCHECK(new_tmpl, ctx);
-    return new_tmpl;
+    return handlebars_string_compact(new_tmpl);
 }
@@ -30,6 +30,7 @@
 
 #include "handlebars_helpers.h"
 #include "handlebars_map.h"
+#include "handlebars_overlay.h"
 #include "handlebars_stack.h"
 #include "handlebars_string.h"
 #include "handlebars_value.h"
@@ -63,19 +64,19 @@ void handlebars_options_deinit(struct handlebars_options * options)
 struct handlebars_value * handlebars_builtin_each(HANDLEBARS_HELPER_ARGS)
 {
     struct handlebars_value * context;
-    struct handlebars_string * result_str = handlebars_string_ctor(CONTEXT, HBS_STRL(""));
+    size_t mark = options->direct_output ? 0 : handlebars_vm_buffer_mark(vm);
     short use_data;
-    struct handlebars_string * tmp;
     size_t i = 0;
     size_t len;
     HANDLEBARS_VALUE_DECL(rv2);
-    HANDLEBARS_VALUE_DECL(index);
     HANDLEBARS_VALUE_DECL(key);
-    HANDLEBARS_VALUE_DECL(first);
-    HANDLEBARS_VALUE_DECL(last);
     HANDLEBARS_VALUE_DECL(data);
     HANDLEBARS_VALUE_DECL(block_params);
     struct handlebars_map * data_map = NULL;
+    struct handlebars_value * frame_index = NULL;
+    struct handlebars_value * frame_key = NULL;
+    struct handlebars_value * frame_first = NULL;
+    struct handlebars_value * frame_last = NULL;
 
     use_data = (options->data != NULL);
 
@@ -99,17 +100,28 @@ struct handlebars_value * handlebars_builtin_each(HANDLEBARS_HELPER_ARGS)
     }
 
     if( use_data ) {
-        handlebars_value_array(block_params, handlebars_stack_ctor(CONTEXT, 2));
+        handlebars_value_array(block_params, handlebars_stack_ctor(handlebars_vm_get_arena(vm), 2));
 
-        if( handlebars_value_get_type(options->data) == HANDLEBARS_VALUE_TYPE_MAP ) {
-            data_map = handlebars_map_ctor(CONTEXT, handlebars_value_count(options->data) + 4);
-            HANDLEBARS_VALUE_FOREACH_KV(options->data, options_key, child) {
-                data_map = handlebars_map_update(data_map, options_key, child);
-            } HANDLEBARS_VALUE_FOREACH_END();
-        } else {
-            data_map = handlebars_map_ctor(CONTEXT, 4);
-        }
+        data_map = handlebars_map_ctor(handlebars_vm_get_arena(vm), 4);
         handlebars_map_addref(data_map);
+
+        // Reserve the loop metadata in the data, it is then updated in place so that iterating allocates nothing
+        data_map = handlebars_map_update(data_map, HBS_INTERNED_STR(INDEX), key);
+        data_map = handlebars_map_update(data_map, HBS_INTERNED_STR(KEY), key);
+        data_map = handlebars_map_update(data_map, HBS_INTERNED_STR(FIRST), key);
+        data_map = handlebars_map_update(data_map, HBS_INTERNED_STR(LAST), key);
+        // Only look the values up once all of them were added, adding may move the entries
+        frame_index = handlebars_map_find(data_map, HBS_INTERNED_STR(INDEX));
+        frame_key = handlebars_map_find(data_map, HBS_INTERNED_STR(KEY));
+        frame_first = handlebars_map_find(data_map, HBS_INTERNED_STR(FIRST));
+        frame_last = handlebars_map_find(data_map, HBS_INTERNED_STR(LAST));
+
+        handlebars_value_map(data, data_map);
+
+        // Layer the loop metadata over the data of the caller instead of copying it
+        if( handlebars_value_get_type(options->data) == HANDLEBARS_VALUE_TYPE_MAP && handlebars_value_count(options->data) > 0 ) {
+            handlebars_value_overlay_init(handlebars_vm_get_arena(vm), data, options->data, data);
+        }
     }
 
     len = handlebars_value_count(context);
@@ -131,51 +143,42 @@ struct handlebars_value * handlebars_builtin_each(HANDLEBARS_HELPER_ARGS)
 
         if( use_data && data_map ) {
             if( it_index ) {
-                handlebars_value_integer(index, it_index);
+                handlebars_value_integer(frame_index, it_index);
             } else {
-                handlebars_value_integer(index, i);
+                handlebars_value_integer(frame_index, i);
             }
-            handlebars_value_boolean(first, i == 0);
-            handlebars_value_boolean(last, i == len);
+            handlebars_value_value(frame_key, key);
+            handlebars_value_boolean(frame_first, i == 0);
+            handlebars_value_boolean(frame_last, i == len);
 
             handlebars_value_array_set(block_params, 0, it_child);
             handlebars_value_array_set(block_params, 1, key);
-
-            data_map = handlebars_map_str_update(data_map, HBS_STRL("index"), index);
-            data_map = handlebars_map_str_update(data_map, HBS_STRL("key"), key);
-            data_map = handlebars_map_str_update(data_map, HBS_STRL("first"), first);
-            data_map = handlebars_map_str_update(data_map, HBS_STRL("last"), last);
-            handlebars_value_map(data, data_map);
         }
 
-        tmp = handlebars_vm_execute_program_ex(vm, options->program, it_child, data, block_params);
-        result_str = handlebars_string_append(HBSCTX(vm), result_str, HBS_STR_STRL(tmp));
-
-        handlebars_value_null(data);
+        handlebars_vm_execute_program_append(vm, options->program, it_child, data, block_params);
 
         i++;
     } HANDLEBARS_VALUE_FOREACH_END();
 
 whoopsie:
     if( i == 0 ) {
-        tmp = handlebars_vm_execute_program(vm, options->inverse, options->scope);
-        assert(tmp != NULL);
-        result_str = handlebars_string_append(HBSCTX(vm), result_str, HBS_STR_STRL(tmp));
+        handlebars_vm_execute_program_append(vm, options->inverse, options->scope, NULL, NULL);
     }
 
-    handlebars_value_str(rv, result_str);
+    // Every iteration was appended to the output buffer, move it into the result unless the VM will use it in place
+    if( !options->direct_output ) {
+        handlebars_value_str(rv, handlebars_vm_buffer_capture(vm, mark));
+    }
 
     if( use_data && data_map ) {
+        handlebars_value_null(data);
         handlebars_map_delref(data_map);
     }
 
     HANDLEBARS_VALUE_UNDECL(rv2);
     HANDLEBARS_VALUE_UNDECL(block_params);
     HANDLEBARS_VALUE_UNDECL(data);
-    HANDLEBARS_VALUE_UNDECL(last);
-    HANDLEBARS_VALUE_UNDECL(first);
     HANDLEBARS_VALUE_UNDECL(key);
-    HANDLEBARS_VALUE_UNDECL(index);
 
     return rv;
 }
@@ -183,7 +186,7 @@ whoopsie:
 struct handlebars_value * handlebars_builtin_block_helper_missing(HANDLEBARS_HELPER_ARGS)
 {
     struct handlebars_value * context;
-    struct handlebars_string * result_str = NULL;
+    long program;
     bool is_zero;
 
     if( argc < 1 ) {
@@ -194,21 +197,25 @@ struct handlebars_value * handlebars_builtin_block_helper_missing(HANDLEBARS_HEL
     is_zero = handlebars_value_get_type(context) == HANDLEBARS_VALUE_TYPE_INTEGER && handlebars_value_get_intval(context) == 0;
 
     if( handlebars_value_get_type(context) == HANDLEBARS_VALUE_TYPE_TRUE ) {
-        result_str = handlebars_vm_execute_program(vm, options->program, options->scope);
+        program = options->program;
+        context = options->scope;
     } else if( handlebars_value_is_empty(context) && !is_zero ) {
 inverse:
-        result_str = handlebars_vm_execute_program(vm, options->inverse, options->scope);
+        program = options->inverse;
+        context = options->scope;
     } else if( handlebars_value_get_type(context) == HANDLEBARS_VALUE_TYPE_ARRAY ) {
-        rv = handlebars_vm_call_helper_str(HBS_STRL("each"), HANDLEBARS_HELPER_ARGS_PASSTHRU);
-        goto done;
+        return handlebars_vm_call_helper_str(HBS_STRL("each"), HANDLEBARS_HELPER_ARGS_PASSTHRU);
     } else {
         // For object, etc
-        result_str = handlebars_vm_execute_program(vm, options->program, context);
+        program = options->program;
     }
 
-    handlebars_value_str(rv, result_str);
+    if( options->direct_output ) {
+        handlebars_vm_execute_program_append(vm, program, context, NULL, NULL);
+    } else {
+        handlebars_value_str(rv, handlebars_vm_execute_program(vm, program, context));
+    }
 
-done:
     return rv;
 }
 
@@ -258,8 +265,10 @@ struct handlebars_value * handlebars_builtin_lookup(HANDLEBARS_HELPER_ARGS)
     struct handlebars_value * field = &argv[1];
     enum handlebars_value_type type = handlebars_value_get_type(context);
 
-    if( type == HANDLEBARS_VALUE_TYPE_MAP ) {
-        struct handlebars_string * key = handlebars_value_to_string(field, CONTEXT);
+    if( type == HANDLEBARS_VALUE_TYPE_MAP && field->type == HANDLEBARS_VALUE_TYPE_STRING ) {
+        (void) handlebars_value_map_str_find(context, handlebars_value_get_strval(field), handlebars_value_get_strlen(field), rv);
+    } else if( type == HANDLEBARS_VALUE_TYPE_MAP ) {
+        struct handlebars_string * key = handlebars_value_to_string(field, handlebars_vm_get_arena(vm));
         (void) handlebars_value_map_find(context, key, rv);
         handlebars_string_delref(key);
     } else if( type == HANDLEBARS_VALUE_TYPE_ARRAY ) {
@@ -276,7 +285,6 @@ struct handlebars_value * handlebars_builtin_if(HANDLEBARS_HELPER_ARGS)
 {
     struct handlebars_value * conditional = &argv[0];
     long program;
-    struct handlebars_string * result_str = NULL;
     HANDLEBARS_VALUE_DECL(rv2);
 
     if (argc != 1) {
@@ -301,8 +309,11 @@ struct handlebars_value * handlebars_builtin_if(HANDLEBARS_HELPER_ARGS)
         program = options->inverse;
     }
 
-    result_str = handlebars_vm_execute_program(vm, program, options->scope);
-    handlebars_value_str(rv, result_str);
+    if( options->direct_output ) {
+        handlebars_vm_execute_program_append(vm, program, options->scope, NULL, NULL);
+    } else {
+        handlebars_value_str(rv, handlebars_vm_execute_program(vm, program, options->scope));
+    }
 
     HANDLEBARS_VALUE_UNDECL(rv2);
 
@@ -327,8 +338,10 @@ struct handlebars_value * handlebars_builtin_unless(HANDLEBARS_HELPER_ARGS)
 
 struct handlebars_value * handlebars_builtin_with(HANDLEBARS_HELPER_ARGS)
 {
-    struct handlebars_string * result_str = NULL;
     struct handlebars_value * context = &argv[0];
+    struct handlebars_value * data = NULL;
+    struct handlebars_value * program_block_params = NULL;
+    long program;
     HANDLEBARS_VALUE_DECL(block_params);
     HANDLEBARS_VALUE_DECL(rv2);
 
@@ -347,15 +360,20 @@ struct handlebars_value * handlebars_builtin_with(HANDLEBARS_HELPER_ARGS)
     assert(context != NULL);
 
     if( handlebars_value_get_type(context) == HANDLEBARS_VALUE_TYPE_NULL ) {
-        result_str = handlebars_vm_execute_program(vm, options->inverse, context);
+        program = options->inverse;
     } else {
-        handlebars_value_array(block_params, handlebars_stack_ctor(CONTEXT, 2));
+        handlebars_value_array(block_params, handlebars_stack_ctor(handlebars_vm_get_arena(vm), 2));
         handlebars_value_array_set(block_params, 0, context);
-
-        result_str = handlebars_vm_execute_program_ex(vm, options->program, context, options->data, block_params);
+        program = options->program;
+        data = options->data;
+        program_block_params = block_params;
     }
 
-    handlebars_value_str(rv, result_str);
+    if( options->direct_output ) {
+        handlebars_vm_execute_program_append(vm, program, context, data, program_block_params);
+    } else {
+        handlebars_value_str(rv, handlebars_vm_execute_program_ex(vm, program, context, data, program_block_params));
+    }
 
     HANDLEBARS_VALUE_UNDECL(rv2);
     HANDLEBARS_VALUE_UNDECL(block_params);
@@ -367,9 +385,9 @@ struct handlebars_value * handlebars_builtin_hbsc_set_delimiters(HANDLEBARS_HELP
 {
     if (argc == 2 && argv[0].type == HANDLEBARS_VALUE_TYPE_STRING && argv[1].type == HANDLEBARS_VALUE_TYPE_STRING) {
         // @TODO we should delref the old ones
-        vm->delim_open = handlebars_value_get_string(&argv[0]);
+        vm->delim_open = handlebars_value_get_string_ex(CONTEXT, &argv[0]);
         handlebars_string_addref(vm->delim_open);
-        vm->delim_close = handlebars_value_get_string(&argv[1]);
+        vm->delim_close = handlebars_value_get_string_ex(CONTEXT, &argv[1]);
         handlebars_string_addref(vm->delim_close);
     }
     return rv;
@@ -190,7 +190,7 @@ static bool hbs_json_iterator_next_object(struct handlebars_value_iterator * it)
 
     it->usr = (void *) (entry = entry->next);
     tmp = (char *) entry->k;
-    it->key = handlebars_string_ctor(intern->user.ctx, tmp, strlen(tmp));
+    it->key = handlebars_string_intern(intern->user.ctx, tmp, strlen(tmp));
     handlebars_value_init_json_object(intern->user.ctx, it->cur, (struct json_object *) entry->v);
     handlebars_string_addref(it->key);
     return true;
@@ -231,7 +231,7 @@ static bool hbs_json_iterator_init(struct handlebars_value_iterator * it, struct
             } // LCOV_EXCL_STOP
             char * tmp = (char *) entry->k;
             it->usr = (void *) entry;
-            it->key = handlebars_string_ctor(intern->user.ctx, tmp, strlen(tmp));
+            it->key = handlebars_string_intern(intern->user.ctx, tmp, strlen(tmp));
             handlebars_value_init_json_object(intern->user.ctx, it->cur, (json_object *) entry->v);
             it->next = &hbs_json_iterator_next_object;
             handlebars_string_addref(it->key);
@@ -297,7 +297,7 @@ void handlebars_value_init_json_object(struct handlebars_context * ctx, struct h
             handlebars_value_integer(value, json_object_get_int64(json));
             break;
         case json_type_string:
-            handlebars_value_str(value, handlebars_string_ctor(ctx, json_object_get_string(json), json_object_get_string_len(json)));
+            handlebars_value_strl(ctx, value, json_object_get_string(json), json_object_get_string_len(json));
             break;
 
         case json_type_object:
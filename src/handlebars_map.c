@@ -22,8 +22,15 @@
 #include <assert.h>
 #include <limits.h>
 #include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <time.h>
+
+#if defined(HAVE_SYS_RANDOM_H) && defined(HAVE_GETRANDOM)
+#include <sys/random.h>
+#endif
 
 #ifdef HANDLEBARS_HAVE_VALGRIND
 #include <valgrind/memcheck.h>
@@ -32,6 +39,18 @@
 #define HT_BOUNDARY_SIZE 0
 #endif
 
+#if defined(__x86_64__) && ((__GNUC__ >= 5) || defined(__clang__))
+#define HANDLEBARS_MAP_SSE2 1
+#include <emmintrin.h>
+#endif
+
+//! The number of slots of which the control bytes are compared at once
+#ifdef HANDLEBARS_MAP_SSE2
+#define HT_GROUP_WIDTH 16
+#else
+#define HT_GROUP_WIDTH 8
+#endif
+
 #include "sort_r.h"
 
 #include "handlebars.h"
@@ -55,20 +74,28 @@ struct handlebars_map {
     struct handlebars_rc rc;
 #endif
 
+    //! The seed of the hash of the bytes of the keys that the table is probed by, or 0 if it is probed by the hash of
+    //! the keys themselves
+    uint64_t seed;
+
+    bool is_in_iteration;
+
     uint32_t i;
     uint32_t table_capacity;
     uint32_t vec_offset;
     uint32_t vec_capacity;
 
-    bool is_in_iteration;
-
-    char data[];
+    //! The layout is: [boundary] [vec] [boundary] [slots] [control bytes] [boundary]
+    uint64_t data[];
 };
 
 struct handlebars_map_entry {
     struct handlebars_string * key;
     struct handlebars_value value;
     uint32_t table_offset;
+    //! The length of the key, truncated. Fills the padding, and lets maps without a hash table skip most keys
+    //! without reading them
+    uint32_t key_len;
 };
 
 struct ht_find_result {
@@ -76,8 +103,10 @@ struct ht_find_result {
     bool entry_found;
     uint32_t empty_offset;
     uint32_t entry_offset;
+    uint32_t hash;
+    //! The number of full groups that were probed past
+    uint32_t probe_length;
     struct handlebars_map_entry * entry;
-    int tombstones;
 };
 
 struct map_sort_r_arg {
@@ -85,41 +114,11 @@ struct map_sort_r_arg {
     const void * arg;
 };
 
+static struct handlebars_map * map_rehash_ex(struct handlebars_map * map, bool force, uint64_t seed);
+
 static short HANDLEBARS_MAP_MIN_LOAD_FACTOR = 10;
-static short HANDLEBARS_MAP_MAX_LOAD_FACTOR = 60;
-static uint32_t HANDLEBARS_MAP_CAPACITY_TABLE[] = {
-    5ul,
-    11ul,
-    23ul,
-    53ul,
-    97ul,
-    193ul,
-    389ul,
-    769ul,
-    1543ul,
-    3079ul,
-    6151ul,
-    12289ul,
-    24593ul,
-    49157ul,
-    98317ul,
-    196613ul,
-    393241ul,
-    786433ul,
-    1572869ul,
-    3145739ul,
-    6291469ul,
-    12582917ul,
-    25165843ul,
-    50331653ul,
-    100663319ul,
-    201326611ul,
-    402653189ul,
-    805306457ul,
-    1610612741ul
-};
+static short HANDLEBARS_MAP_MAX_LOAD_FACTOR = 87;
 static struct handlebars_map_entry HANDLEBARS_MAP_TOMBSTONE_V = {0};
-static struct handlebars_map_entry * HANDLEBARS_MAP_TOMBSTONE = &HANDLEBARS_MAP_TOMBSTONE_V;
 
 
 
@@ -146,80 +145,317 @@ static inline uint8_t map_choose_vec_capacity_log2(size_t capacity) {
 
 HBS_ATTR_PURE
 static inline size_t ht_choose_table_capacity(size_t elements) {
-    size_t target_capacity = elements * 100 / HANDLEBARS_MAP_MAX_LOAD_FACTOR;
-    size_t i = 0;
-    for (i = 0; i < sizeof(HANDLEBARS_MAP_CAPACITY_TABLE) - 1; i++) {
-        if (HANDLEBARS_MAP_CAPACITY_TABLE[i] >= target_capacity) {
-            return HANDLEBARS_MAP_CAPACITY_TABLE[i];
-        }
+    size_t target_capacity = elements * 100 / HANDLEBARS_MAP_MAX_LOAD_FACTOR + 1;
+    size_t capacity = HT_GROUP_WIDTH;
+    while (capacity < target_capacity) {
+        capacity <<= 1;
+    }
+    return capacity;
+}
+
+//! Fill a buffer from the random number generator of the system
+static bool map_system_random(void * buf, size_t len)
+{
+#if defined(HAVE_SYS_RANDOM_H) && defined(HAVE_GETRANDOM)
+    if (getrandom(buf, len, 0) == (ssize_t) len) {
+        return true;
     }
-    // LCOV_EXCL_START
-    fprintf(stderr, "Failed to obtain hash table capacity for minimum elements %zu (target capacity %zu)\n", elements, target_capacity);
-    abort();
-    // LCOV_EXCL_STOP
+#elif defined(HAVE_ARC4RANDOM_BUF)
+    arc4random_buf(buf, len);
+    return true;
+#endif
+    FILE * fp = fopen("/dev/urandom", "rb");
+    bool ok = false;
+    if (fp) {
+        ok = fread(buf, 1, len, fp) == len;
+        fclose(fp);
+    }
+    return ok;
+}
+
+//! The seed of maps that are rehashed because their keys collide. It is taken from the random number generator of the
+//! system, or, where there is none, derived from the time and from addresses, which are randomized on most systems.
+//! Threads that race to create it agree on the first one stored.
+static uint64_t map_process_seed(void)
+{
+    static uint64_t process_seed = 0;
+    uint64_t seed = __atomic_load_n(&process_seed, __ATOMIC_ACQUIRE);
+    uint64_t expected = 0;
+
+    if (handlebars_likely(seed != 0)) {
+        return seed;
+    }
+
+    if (!map_system_random(&seed, sizeof(seed))) {
+        struct {
+            time_t time;
+            clock_t clock;
+            void * stack;
+            void * data;
+            void * heap;
+        } entropy;
+        memset(&entropy, 0, sizeof(entropy));
+        entropy.time = time(NULL);
+        entropy.clock = clock();
+        entropy.stack = &entropy;
+        entropy.data = &process_seed;
+        entropy.heap = malloc(1);
+        free(entropy.heap);
+        seed = handlebars_hash_xxh3((const char *) &entropy, sizeof(entropy));
+    }
+
+    // Zero means that a map is not seeded
+    seed |= 1;
+
+    if (!__atomic_compare_exchange_n(&process_seed, &expected, seed, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        seed = expected;
+    }
+
+    return seed;
 }
 
 HBS_ATTR_PURE
 static inline struct handlebars_map_entry * map_vec(struct handlebars_map * map)
 {
     // Is it worth doing this to save 8 bytes off the map structure?
-    return (struct handlebars_map_entry *) (void *) (map->data + HT_BOUNDARY_SIZE);
+    return (struct handlebars_map_entry *) (void *) ((char *) map->data + HT_BOUNDARY_SIZE);
 }
 
 HBS_ATTR_PURE
-static inline struct handlebars_map_entry ** map_table(struct handlebars_map * map)
+static inline uint32_t * map_slots(struct handlebars_map * map)
 {
-    // Is it worth doing this to save 8 bytes off the map structure?
     size_t vec_size = map->vec_capacity * sizeof(struct handlebars_map_entry);
-    return (struct handlebars_map_entry **) (void *) (map->data + HT_BOUNDARY_SIZE * 2 + vec_size);
+    return (uint32_t *) (void *) ((char *) map->data + HT_BOUNDARY_SIZE * 2 + vec_size);
 }
 
-static inline struct ht_find_result map_find_entry(
+HBS_ATTR_PURE
+static inline uint8_t * map_ctrl(struct handlebars_map * map)
+{
+    return (uint8_t *) (map_slots(map) + map->table_capacity);
+}
+
+// {{{ Control bytes
+
+// The table is split into groups of HT_GROUP_WIDTH slots. Each slot has a control byte, which is either empty,
+// deleted, or holds the low 7 bits of the hash of the key in the slot (h2). A key is looked up by comparing h2 with
+// the control bytes of a whole group at once, and only the slots that match are compared with the key. The rest of
+// the hash (h1) selects the first group to probe, and probing stops at the first group with an empty slot
+
+#define HT_CTRL_EMPTY ((uint8_t) 0x80)
+#define HT_CTRL_DELETED ((uint8_t) 0xFE)
+
+#define HT_H1(hash) ((hash) >> 7)
+#define HT_H2(hash) ((uint8_t) ((hash) & 0x7F))
+
+#ifdef HANDLEBARS_MAP_SSE2
+
+// One bit per slot
+typedef uint32_t ht_mask;
+#define HT_MASK_SHIFT 0
+
+static inline ht_mask ht_group_match(const uint8_t * ctrl, uint8_t h2)
+{
+    __m128i group = _mm_loadu_si128((const __m128i *) (const void *) ctrl);
+    return (ht_mask) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) h2)));
+}
+
+static inline ht_mask ht_group_match_empty(const uint8_t * ctrl)
+{
+    return ht_group_match(ctrl, HT_CTRL_EMPTY);
+}
+
+static inline ht_mask ht_group_match_empty_or_deleted(const uint8_t * ctrl)
+{
+    // Only empty and deleted have the high bit set
+    return (ht_mask) _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) (const void *) ctrl));
+}
+
+#else
+
+// The high bit of each byte
+typedef uint64_t ht_mask;
+#define HT_MASK_SHIFT 3
+
+#define SWAR_ONES UINT64_C(0x0101010101010101)
+#define SWAR_HIGHS UINT64_C(0x8080808080808080)
+
+static inline uint64_t ht_group_load(const uint8_t * ctrl)
+{
+    uint64_t group;
+    memcpy(&group, ctrl, sizeof(group));
+    return group;
+}
+
+static inline ht_mask ht_group_match(const uint8_t * ctrl, uint8_t h2)
+{
+    // May have false positives above a real match, which are weeded out by comparing the keys
+    uint64_t x = ht_group_load(ctrl) ^ (SWAR_ONES * h2);
+    return (x - SWAR_ONES) & ~x & SWAR_HIGHS;
+}
+
+static inline ht_mask ht_group_match_empty(const uint8_t * ctrl)
+{
+    // Empty and deleted both have the high bit set, but only deleted has bit 1 set
+    uint64_t group = ht_group_load(ctrl);
+    return group & ~(group << 6) & SWAR_HIGHS;
+}
+
+static inline ht_mask ht_group_match_empty_or_deleted(const uint8_t * ctrl)
+{
+    return ht_group_load(ctrl) & SWAR_HIGHS;
+}
+
+#endif
+
+static inline uint32_t ht_mask_first(ht_mask mask)
+{
+#ifdef HANDLEBARS_MAP_SSE2
+    return (uint32_t) __builtin_ctz(mask);
+#else
+    return (uint32_t) __builtin_ctzll(mask) >> HT_MASK_SHIFT;
+#endif
+}
+
+// }}} Control bytes
+
+//! Find an entry by its key. Keys are compared by their bytes once their length and, unless the table is probed by a
+//! seeded hash, their hash match, since different keys of the same length may have the same 32-bit hash
+HBS_ATTR_ALWAYS_INLINE
+static inline struct ht_find_result map_find_entry_ex(
     struct handlebars_map * map,
-    struct handlebars_string * key
+    struct handlebars_string * key,
+    const char * str,
+    size_t len,
+    uint32_t hash
 ) {
-    struct handlebars_map_entry ** table = map_table(map);
-    size_t table_capacity = map->table_capacity;
-    size_t start = (uint32_t) hbs_str_hash(key) % (uint32_t) table_capacity;
-    size_t i;
-    size_t pos;
+    struct handlebars_map_entry * vec = map_vec(map);
+    uint32_t * slots = map_slots(map);
+    uint8_t * ctrl = map_ctrl(map);
+    uint32_t group_mask = map->table_capacity / HT_GROUP_WIDTH - 1;
+    uint32_t group = HT_H1(hash) & group_mask;
+    uint8_t h2 = HT_H2(hash);
+    uint32_t i;
+    uint32_t pos;
+    ht_mask mask;
     struct ht_find_result ret = {0};
 
-    for (i = 0; i < table_capacity; i++) {
-        pos = (start + i) % table_capacity;
-        if (!table[pos]) {
+    ret.hash = hash;
+
+    // Triangular probing visits every group once when the number of groups is a power of two
+    for (i = 0; i <= group_mask; i++) {
+        const uint8_t * group_ctrl = ctrl + group * HT_GROUP_WIDTH;
+
+        for (mask = ht_group_match(group_ctrl, h2); mask; mask &= mask - 1) {
+            pos = group * HT_GROUP_WIDTH + ht_mask_first(mask);
+            struct handlebars_map_entry * entry = &vec[slots[pos]];
+            if(
+                entry->key == key || (
+                    hbs_str_len(entry->key) == len &&
+                    (map->seed || hbs_str_hash(entry->key) == hash) &&
+                    0 == memcmp(hbs_str_val(entry->key), str, len)
+                )
+            ) {
+                ret.entry_found = true;
+                ret.entry_offset = pos;
+                ret.entry = entry;
+                return ret;
+            }
+        }
+
+        if (!ret.empty_found && (mask = ht_group_match_empty_or_deleted(group_ctrl))) {
             ret.empty_found = true;
-            ret.empty_offset = pos;
+            ret.empty_offset = group * HT_GROUP_WIDTH + ht_mask_first(mask);
+        }
+
+        if (ht_group_match_empty(group_ctrl)) {
             break;
-        } else if (table[pos] == HANDLEBARS_MAP_TOMBSTONE) {
-            ret.tombstones++;
-            if (!ret.empty_found) {
-                ret.empty_offset = true;
-                ret.empty_offset = pos;
-            }
-        } else if( handlebars_string_eq(table[pos]->key, key) ) {
+        }
+
+        group = (group + i + 1) & group_mask;
+    }
+
+    ret.probe_length = i;
+
+    return ret;
+}
+
+static inline uint32_t map_hash_bytes(struct handlebars_map * map, const char * str, size_t len)
+{
+    return (uint32_t) handlebars_hash_xxh3_seeded(str, len, map->seed);
+}
+
+//! Find an entry in a map without a hash table by scanning its entry vector. Most keys are skipped by their length,
+//! and the others are compared by their bytes, so the key never has to be hashed
+static inline struct ht_find_result map_small_find_entry(
+    struct handlebars_map * map,
+    struct handlebars_string * key,
+    const char * str,
+    size_t len
+) {
+    struct handlebars_map_entry * vec = map_vec(map);
+    uint32_t i;
+    struct ht_find_result ret = {0};
+
+    for (i = 0; i < map->vec_offset; i++) {
+        struct handlebars_map_entry * entry = &vec[i];
+        if (entry->key_len != (uint32_t) len || !entry->key) {
+            continue;
+        }
+        if( entry->key == key || 0 == memcmp(hbs_str_val(entry->key), str, len) ) {
             ret.entry_found = true;
-            ret.entry_offset = pos;
-            ret.entry = table[pos];
-            break;
+            ret.entry_offset = i;
+            ret.entry = entry;
+            return ret;
         }
     }
 
+    ret.empty_found = map->vec_offset < map->vec_capacity;
+
     return ret;
 }
 
+HBS_ATTR_ALWAYS_INLINE
+static inline struct ht_find_result map_find_entry(
+    struct handlebars_map * map,
+    struct handlebars_string * key
+) {
+    const char * str = hbs_str_val(key);
+    size_t len = hbs_str_len(key);
+    uint32_t hash;
+    if (!map->table_capacity) {
+        return map_small_find_entry(map, key, str, len);
+    }
+    if (map->seed) {
+        hash = map_hash_bytes(map, str, len);
+    } else {
+        hash = hbs_str_hash(key);
+    }
+    return map_find_entry_ex(map, key, str, len, hash);
+}
+
+HBS_ATTR_ALWAYS_INLINE
+static inline struct ht_find_result map_str_find_entry(
+    struct handlebars_map * map,
+    const char * key,
+    size_t len
+) {
+    if (!map->table_capacity) {
+        return map_small_find_entry(map, NULL, key, len);
+    }
+    return map_find_entry_ex(map, NULL, key, len, map->seed ? map_hash_bytes(map, key, len) : handlebars_string_hash(key, len));
+}
+
 static inline void map_add_at_table_offset(
     struct handlebars_map * map,
     struct handlebars_string * key,
     struct handlebars_value * value,
-    size_t offset
+    size_t offset,
+    uint32_t hash
 ) {
     struct handlebars_map_entry * vec = map_vec(map);
-    struct handlebars_map_entry ** table = map_table(map);
     struct handlebars_map_entry * entry = &vec[map->vec_offset];
 
     assert(map->vec_offset < map->vec_capacity);
-    assert(table[offset] == NULL || table[offset] == HANDLEBARS_MAP_TOMBSTONE);
 
 #ifndef HANDLEBARS_NO_REFCOUNT
     entry->key = key;
@@ -233,9 +469,15 @@ static inline void map_add_at_table_offset(
     handlebars_value_value(&entry->value, value);
 
     entry->table_offset = offset;
+    entry->key_len = (uint32_t) hbs_str_len(entry->key);
 
     // Add to table
-    table[offset] = entry;
+    if (map->table_capacity) {
+        uint8_t * ctrl = map_ctrl(map);
+        assert(ctrl[offset] == HT_CTRL_EMPTY || ctrl[offset] == HT_CTRL_DELETED);
+        ctrl[offset] = HT_H2(hash);
+        map_slots(map)[offset] = map->vec_offset;
+    }
     map->i++;
     map->vec_offset++;
 }
@@ -244,13 +486,33 @@ static void map_rebuild_references(struct handlebars_map * map)
 {
     size_t i;
     struct handlebars_map_entry * vec = map_vec(map);
-    struct handlebars_map_entry ** table = map_table(map);
+    uint32_t * slots = map_slots(map);
 
     assert(map->vec_offset == map->i);
 
+    if (!map->table_capacity) {
+        return;
+    }
+
     for (i = 0; i < map->vec_offset; i++ ) {
-        table[vec[i].table_offset] = &vec[i];
+        slots[vec[i].table_offset] = i;
+    }
+}
+
+//! Whether removing from the map should shrink it first. Small maps are not worth reallocating.
+static inline bool map_should_shrink(struct handlebars_map * map)
+{
+    return map->table_capacity && handlebars_map_load_factor(map) < HANDLEBARS_MAP_MIN_LOAD_FACTOR;
+}
+
+//! Rehash the map with a seeded hash of the bytes of its keys if an insert had to probe past too many groups, which
+//! should only happen if the keys were chosen to collide in the hash of the keys, which is the same in every process
+static inline struct handlebars_map * map_check_probe_length(struct handlebars_map * map, struct ht_find_result o)
+{
+    if (o.probe_length > HANDLEBARS_MAP_MAX_PROBE && !map->seed) {
+        return map_rehash_ex(map, true, map_process_seed());
     }
+    return map;
 }
 
 
@@ -322,10 +584,10 @@ const size_t HANDLEBARS_MAP_SIZE = sizeof(struct handlebars_map);
 
 #define HT_SIZES(capacity) \
     size_t vec_capacity = capacity; \
-    size_t table_capacity = ht_choose_table_capacity(vec_capacity); \
+    size_t table_capacity = vec_capacity <= HANDLEBARS_MAP_SMALL_SIZE ? 0 : ht_choose_table_capacity(vec_capacity); \
     size_t size = sizeof(struct handlebars_map); \
     size_t vec_size = vec_capacity * sizeof(struct handlebars_map_entry); \
-    size_t table_size = table_capacity * sizeof(struct handlebars_map_entry *); \
+    size_t table_size = table_capacity * (sizeof(uint32_t) + sizeof(uint8_t)); \
     size += HT_BOUNDARY_SIZE * 3 + vec_size + table_size
 
 size_t handlebars_map_size_of(size_t capacity) {
@@ -344,7 +606,7 @@ struct handlebars_map * handlebars_map_ctor(struct handlebars_context * ctx, siz
     memset(map, 0, sizeof(struct handlebars_map));
     map->ctx = ctx;
 
-    // The layout for the memory is: [map] [boundary] [vec] [boundary] [table] [boundary]
+    // The layout for the memory is: [map] [boundary] [vec] [boundary] [slots] [control bytes] [boundary]
     // bounary size is 0 when compiled without valgrind
 
     // Allocate vector
@@ -352,12 +614,13 @@ struct handlebars_map * handlebars_map_ctor(struct handlebars_context * ctx, siz
 
     // Allocate table
     map->table_capacity = table_capacity;
-    memset(map_table(map), 0, table_size);
+    memset(map_ctrl(map), HT_CTRL_EMPTY, table_capacity);
 
 #ifdef HANDLEBARS_HAVE_VALGRIND
-   VALGRIND_MAKE_MEM_NOACCESS(map->data, HT_BOUNDARY_SIZE);
-   VALGRIND_MAKE_MEM_NOACCESS(map->data + HT_BOUNDARY_SIZE + vec_size, HT_BOUNDARY_SIZE);
-   VALGRIND_MAKE_MEM_NOACCESS(map->data + HT_BOUNDARY_SIZE + vec_size + HT_BOUNDARY_SIZE + table_size, HT_BOUNDARY_SIZE);
+   char * data = (char *) map->data;
+   VALGRIND_MAKE_MEM_NOACCESS(data, HT_BOUNDARY_SIZE);
+   VALGRIND_MAKE_MEM_NOACCESS(data + HT_BOUNDARY_SIZE + vec_size, HT_BOUNDARY_SIZE);
+   VALGRIND_MAKE_MEM_NOACCESS(data + HT_BOUNDARY_SIZE + vec_size + HT_BOUNDARY_SIZE + table_size, HT_BOUNDARY_SIZE);
 #endif
 
 #ifndef HANDLEBARS_NO_REFCOUNT
@@ -367,13 +630,14 @@ struct handlebars_map * handlebars_map_ctor(struct handlebars_context * ctx, siz
     return map;
 }
 
-struct handlebars_map * handlebars_map_copy_ctor(struct handlebars_map * prev_map, size_t new_capacity)
+static struct handlebars_map * map_copy_ctor_ex(struct handlebars_map * prev_map, size_t new_capacity, uint64_t seed)
 {
     if (new_capacity < prev_map->vec_capacity) {
         new_capacity = prev_map->vec_capacity;
     }
 
     struct handlebars_map * map = handlebars_map_ctor(prev_map->ctx, new_capacity);
+    map->seed = seed;
 
     handlebars_map_foreach(prev_map, index, key, value) {
         map = handlebars_map_add(map, key, value);
@@ -382,6 +646,11 @@ struct handlebars_map * handlebars_map_copy_ctor(struct handlebars_map * prev_ma
     return map;
 }
 
+struct handlebars_map * handlebars_map_copy_ctor(struct handlebars_map * prev_map, size_t new_capacity)
+{
+    return map_copy_ctor_ex(prev_map, new_capacity, prev_map->seed);
+}
+
 
 
 #undef CONTEXT
@@ -409,35 +678,43 @@ struct handlebars_map * handlebars_map_add(struct handlebars_map * map, struct h
         handlebars_throw(map->ctx, HANDLEBARS_ERROR, "Failed to add to hash table");
     }
 
-    map_add_at_table_offset(map, key, value, o.empty_offset);
+    map_add_at_table_offset(map, key, value, o.empty_offset, o.hash);
 
-    return map;
+    return map_check_probe_length(map, o);
 }
 
-struct handlebars_map * handlebars_map_remove(struct handlebars_map * map, struct handlebars_string * key)
+static inline void map_remove_entry(struct handlebars_map * map, struct ht_find_result o)
 {
-    // Rehash
-    map = handlebars_map_rehash(map, handlebars_map_load_factor(map) < HANDLEBARS_MAP_MIN_LOAD_FACTOR);
-
-    // Remove
-    struct ht_find_result o = map_find_entry(map, key);
     struct handlebars_map_entry * entry = o.entry;
-    if (!entry) {
-        return map;
-    }
 
     handlebars_string_delref(entry->key);
     handlebars_value_null(&entry->value);
 
-    // Remove from hash table
-    struct handlebars_map_entry ** table = map_table(map);
-    table[o.entry_offset] = HANDLEBARS_MAP_TOMBSTONE;
+    // Remove from hash table. Probing only continues past a group without empty slots, so if this group has one
+    // no other key can depend on the slot being occupied and it does not need a tombstone
+    if (map->table_capacity) {
+        uint8_t * ctrl = map_ctrl(map);
+        uint32_t group = o.entry_offset & ~(uint32_t) (HT_GROUP_WIDTH - 1);
+        ctrl[o.entry_offset] = ht_group_match_empty(ctrl + group) ? HT_CTRL_EMPTY : HT_CTRL_DELETED;
+    }
 
     // Remove from vector
     *entry = HANDLEBARS_MAP_TOMBSTONE_V;
 
     // Free
     map->i--;
+}
+
+struct handlebars_map * handlebars_map_remove(struct handlebars_map * map, struct handlebars_string * key)
+{
+    // Rehash
+    map = handlebars_map_rehash(map, map_should_shrink(map));
+
+    // Remove
+    struct ht_find_result o = map_find_entry(map, key);
+    if (o.entry) {
+        map_remove_entry(map, o);
+    }
 
     return map;
 }
@@ -446,6 +723,7 @@ struct handlebars_value * handlebars_map_find(struct handlebars_map * map, struc
 {
     struct ht_find_result o = map_find_entry(map, key);
     if (o.entry) {
+        HANDLEBARS_VALUE_PROMOTE_CHILD(CONTEXT, &o.entry->value);
         return &o.entry->value;
     } else {
         return NULL;
@@ -470,9 +748,9 @@ struct handlebars_map * handlebars_map_update(struct handlebars_map * map, struc
         handlebars_throw(map->ctx, HANDLEBARS_ERROR, "Failed to update to hash table");
     }
 
-    map_add_at_table_offset(map, key, value, o.empty_offset);
+    map_add_at_table_offset(map, key, value, o.empty_offset, o.hash);
 
-    return map;
+    return map_check_probe_length(map, o);
 }
 
 extern inline size_t handlebars_map_count(struct handlebars_map * map) {
@@ -480,6 +758,9 @@ extern inline size_t handlebars_map_count(struct handlebars_map * map) {
 }
 
 extern inline short handlebars_map_load_factor(struct handlebars_map * map) {
+    if (!map->table_capacity) {
+        return map->vec_capacity ? (map->i * 100) / map->vec_capacity : 100;
+    }
     return (map->i * 100) / map->table_capacity;
 }
 
@@ -502,6 +783,7 @@ void handlebars_map_get_kv_at_index(struct handlebars_map * map, size_t index, s
     struct handlebars_map_entry * vec = map_vec(map);
     *key = vec[index].key;
     *value = &vec[index].value;
+    HANDLEBARS_VALUE_PROMOTE_CHILD(CONTEXT, *value);
 }
 
 bool handlebars_map_is_sparse(struct handlebars_map * map)
@@ -509,7 +791,12 @@ bool handlebars_map_is_sparse(struct handlebars_map * map)
     return map->vec_offset != map->i;
 }
 
-struct handlebars_map * handlebars_map_rehash(struct handlebars_map * map, bool force)
+bool handlebars_map_is_seeded(struct handlebars_map * map)
+{
+    return map->seed != 0;
+}
+
+static struct handlebars_map * map_rehash_ex(struct handlebars_map * map, bool force, uint64_t seed)
 {
     if (map->is_in_iteration) { // this go go really wrong
         return map;
@@ -521,10 +808,14 @@ struct handlebars_map * handlebars_map_rehash(struct handlebars_map * map, bool
     }
 #endif
 
-    if (force || map->vec_offset == map->vec_capacity || handlebars_map_load_factor(map) > HANDLEBARS_MAP_MAX_LOAD_FACTOR) {
+    if (
+        force ||
+        map->vec_offset == map->vec_capacity ||
+        (map->table_capacity && handlebars_map_load_factor(map) > HANDLEBARS_MAP_MAX_LOAD_FACTOR)
+    ) {
         size_t vec_capacity = 1 << map_choose_vec_capacity_log2(map->i + 1);
         struct handlebars_map * prev_map = map;
-        map = handlebars_map_copy_ctor(prev_map, vec_capacity);
+        map = map_copy_ctor_ex(prev_map, vec_capacity, seed);
 #ifndef HANDLEBARS_NO_REFCOUNT
         if (handlebars_rc_refcount(&prev_map->rc) >= 1) { // ugh
             handlebars_map_addref(map);
@@ -536,6 +827,11 @@ struct handlebars_map * handlebars_map_rehash(struct handlebars_map * map, bool
     return map;
 }
 
+struct handlebars_map * handlebars_map_rehash(struct handlebars_map * map, bool force)
+{
+    return map_rehash_ex(map, force, map->seed);
+}
+
 void handlebars_map_sparse_array_compact(struct handlebars_map * map)
 {
     // nothing to do
@@ -546,13 +842,12 @@ void handlebars_map_sparse_array_compact(struct handlebars_map * map)
     uint32_t i = 0;
     uint32_t vec_offset = 0;
     struct handlebars_map_entry * vec = map_vec(map);
-    struct handlebars_map_entry ** table = map_table(map);
+    uint32_t * slots = map_slots(map);
 
     // Scan until the first tombstone
     for (; i < map->vec_offset; i++) {
         if (0 == memcmp(&vec[i], &HANDLEBARS_MAP_TOMBSTONE_V, sizeof(HANDLEBARS_MAP_TOMBSTONE_V))) {
-            i++;
-            vec_offset++;
+            vec_offset = i++;
             break;
         }
     }
@@ -561,7 +856,9 @@ void handlebars_map_sparse_array_compact(struct handlebars_map * map)
     for (; i < map->vec_offset; i++) {
         if (0 != memcmp(&vec[i], &HANDLEBARS_MAP_TOMBSTONE_V, sizeof(HANDLEBARS_MAP_TOMBSTONE_V))) {
             vec[vec_offset] = vec[i];
-            table[vec[vec_offset].table_offset] = &vec[vec_offset];
+            if (map->table_capacity) {
+                slots[vec[vec_offset].table_offset] = vec_offset;
+            }
             vec_offset++;
         }
     }
@@ -581,6 +878,17 @@ bool handlebars_map_set_is_in_iteration(struct handlebars_map * map, bool is_in_
     return old;
 }
 
+//! Move the inline strings of the children into allocated strings, since the comparison functions are handed them
+static void map_promote_children(struct handlebars_map * map)
+{
+    struct handlebars_map_entry * vec = map_vec(map);
+    uint32_t i;
+
+    for (i = 0; i < map->vec_offset; i++) {
+        HANDLEBARS_VALUE_PROMOTE_CHILD(CONTEXT, &vec[i].value);
+    }
+}
+
 static int map_entry_compare(const void * ptr1, const void * ptr2, void * arg)
 {
     assert(ptr1 != NULL);
@@ -604,6 +912,7 @@ static int map_entry_compare(const void * ptr1, const void * ptr2, void * arg)
 struct handlebars_map * handlebars_map_sort(struct handlebars_map * map, handlebars_map_kv_compare_func compare)
 {
     map = handlebars_map_rehash(map, handlebars_map_is_sparse(map));
+    map_promote_children(map);
 
     struct handlebars_map_entry * vec = map_vec(map);
 
@@ -641,6 +950,7 @@ struct handlebars_map * handlebars_map_sort_r(
     const void * arg
 ) {
     map = handlebars_map_rehash(map, handlebars_map_is_sparse(map));
+    map_promote_children(map);
 
     struct map_sort_r_arg sort_r_arg = {compare, arg};
 
@@ -658,16 +968,21 @@ struct handlebars_map * handlebars_map_sort_r(
 
 struct handlebars_map * handlebars_map_str_remove(struct handlebars_map * map, const char * key, size_t len)
 {
-    struct handlebars_string * string = handlebars_string_ctor(CONTEXT, key, len);
-    handlebars_string_addref(string);
-    map = handlebars_map_remove(map, string);
-    handlebars_string_delref(string);
+    // Rehash
+    map = handlebars_map_rehash(map, map_should_shrink(map));
+
+    // Remove
+    struct ht_find_result o = map_str_find_entry(map, key, len);
+    if (o.entry) {
+        map_remove_entry(map, o);
+    }
+
     return map;
 }
 
 struct handlebars_map * handlebars_map_str_add(struct handlebars_map * map, const char * key, size_t len, struct handlebars_value * value)
 {
-    struct handlebars_string * string = handlebars_string_ctor(CONTEXT, key, len);
+    struct handlebars_string * string = handlebars_string_intern(CONTEXT, key, len);
     handlebars_string_addref(string);
     map = handlebars_map_add(map, string, value);
     handlebars_string_delref(string);
@@ -676,16 +991,18 @@ struct handlebars_map * handlebars_map_str_add(struct handlebars_map * map, cons
 
 struct handlebars_value * handlebars_map_str_find(struct handlebars_map * map, const char * key, size_t len)
 {
-    struct handlebars_string * string = handlebars_string_ctor(CONTEXT, key, len);
-    handlebars_string_addref(string);
-    struct handlebars_value * value = handlebars_map_find(map, string);
-    handlebars_string_delref(string);
-    return value;
+    struct ht_find_result o = map_str_find_entry(map, key, len);
+    if (o.entry) {
+        HANDLEBARS_VALUE_PROMOTE_CHILD(CONTEXT, &o.entry->value);
+        return &o.entry->value;
+    } else {
+        return NULL;
+    }
 }
 
 struct handlebars_map * handlebars_map_str_update(struct handlebars_map * map, const char * key, size_t len, struct handlebars_value * value)
 {
-    struct handlebars_string * string = handlebars_string_ctor(CONTEXT, key, len);
+    struct handlebars_string * string = handlebars_string_intern(CONTEXT, key, len);
     handlebars_string_addref(string);
     map = handlebars_map_update(map, string, value);
     handlebars_string_delref(string);
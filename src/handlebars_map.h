@@ -27,6 +27,17 @@ struct handlebars_map;
 struct handlebars_string;
 struct handlebars_value;
 
+//! Maps with a capacity of at most this many entries have no hash table, and are searched linearly
+#ifndef HANDLEBARS_MAP_SMALL_SIZE
+#define HANDLEBARS_MAP_SMALL_SIZE 8
+#endif
+
+//! Number of full groups of slots an insert may probe past before the map is rehashed with a seeded hash of the bytes
+//! of its keys
+#ifndef HANDLEBARS_MAP_MAX_PROBE
+#define HANDLEBARS_MAP_MAX_PROBE 8
+#endif
+
 struct handlebars_map_kv_pair {
     struct handlebars_string * key;
     struct handlebars_value * value;
@@ -227,7 +238,8 @@ void handlebars_map_get_kv_at_index(
 ) HBS_ATTR_NONNULL_ALL;
 
 /**
- * @brief Returns the load factor in percent of the map
+ * @brief Returns the load factor in percent of the map, or of its entry vector if it is small enough to have no
+ *        hash table
  * @param[in] map
  * @return The load factor
  */
@@ -264,6 +276,16 @@ bool handlebars_map_is_sparse(
     struct handlebars_map * map
 ) HBS_ATTR_NONNULL_ALL;
 
+/**
+ * @brief Checks if the map's hash table is probed by a seeded hash of the bytes of its keys, which it switches to
+ *        when an insert probes past more than #HANDLEBARS_MAP_MAX_PROBE groups
+ * @param[in] map
+ * @return true if the hash table is seeded
+ */
+bool handlebars_map_is_seeded(
+    struct handlebars_map * map
+) HBS_ATTR_NONNULL_ALL;
+
 bool handlebars_map_set_is_in_iteration(
     struct handlebars_map * map,
     bool is_in_iteration
@@ -20,7 +20,10 @@
 #endif
 
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <talloc.h>
 
 #include "handlebars_memory.h"
@@ -32,6 +35,7 @@ static int _handlebars_memory_fail_counter = -1;
 static int _handlebars_memory_fail_flags = handlebars_memory_fail_flag_all;
 static int _handlebars_memory_last_exit_code = -1;
 static int _handlebars_memory_call_counter = 0;
+static int _handlebars_memory_profile_enabled = 0;
 
 static void _handlebars_exit(int exit_code) HBS_ATTR_NORETURN;
 
@@ -369,6 +373,7 @@ void handlebars_memory_fail_disable(void)
     //}
 
     _handlebars_memory_fail_enabled = 0;
+    _handlebars_memory_profile_enabled = 0;
     _handlebars_memory_fail_flags = handlebars_memory_fail_flag_all;
     //_handlebars_memory_fail_counter = -1;
     //_handlebars_memory_last_exit_code = 0;
@@ -432,5 +437,556 @@ int handlebars_memory_get_call_counter(void)
     return _handlebars_memory_call_counter;
 }
 
+// {{{ Profiler
+
+//! Minimum number of slots of the tables of the profiler, must be a power of two
+#define PROFILE_TABLE_MIN_SIZE 64
+
+//! Number of entries per chunk of the profiler. Entries are allocated in chunks that are never moved, so that the
+//! pointers returned by #handlebars_memory_profile_get and #handlebars_memory_profile_find stay valid
+#define PROFILE_CHUNK_SIZE 64
+
+struct profile_allocation {
+    const void * ptr;
+    size_t size;
+    size_t entry;
+};
+
+static struct handlebars_memory_profile_entry ** _handlebars_memory_profile_chunks = NULL;
+static size_t _handlebars_memory_profile_entry_count = 0;
+//! Open addressing table of the indexes of the entries plus one, keyed by name
+static size_t * _handlebars_memory_profile_names = NULL;
+static size_t _handlebars_memory_profile_names_size = 0;
+//! Open addressing table of the allocations that were not freed yet, keyed by pointer
+static struct profile_allocation * _handlebars_memory_profile_live = NULL;
+static size_t _handlebars_memory_profile_live_count = 0;
+static size_t _handlebars_memory_profile_live_size = 0;
+//! The allocations in the trees being freed, as a stack for destructors that free in turn
+static const void ** _handlebars_memory_profile_tree = NULL;
+static size_t _handlebars_memory_profile_tree_count = 0;
+static size_t _handlebars_memory_profile_tree_size = 0;
+static size_t _handlebars_memory_profile_live_bytes = 0;
+static size_t _handlebars_memory_profile_peak_bytes = 0;
+
+static void * profile_xrealloc(void * ptr, size_t size)
+{
+    void * retval = realloc(ptr, size);
+    if (retval == NULL) {
+        fprintf(stderr, "Out of memory in the allocation profiler\n");
+        abort();
+    }
+    return retval;
+}
+
+static size_t profile_hash_name(const char * name)
+{
+    size_t hash = 2166136261u;
+    for (; *name; name++) {
+        hash = (hash ^ (unsigned char) *name) * 16777619u;
+    }
+    return hash;
+}
+
+static size_t profile_hash_ptr(const void * ptr)
+{
+    uint64_t x = (uint64_t) (uintptr_t) ptr;
+    x ^= x >> 33;
+    x *= UINT64_C(0xff51afd7ed558ccd);
+    x ^= x >> 33;
+    return (size_t) x;
+}
+
+static inline struct handlebars_memory_profile_entry * profile_entry_at(size_t index)
+{
+    return &_handlebars_memory_profile_chunks[index / PROFILE_CHUNK_SIZE][index % PROFILE_CHUNK_SIZE];
+}
+
+static void profile_names_insert(size_t index)
+{
+    size_t mask = _handlebars_memory_profile_names_size - 1;
+    size_t i = profile_hash_name(profile_entry_at(index)->name) & mask;
+    while (_handlebars_memory_profile_names[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    _handlebars_memory_profile_names[i] = index + 1;
+}
+
+static size_t profile_entry(const char * name)
+{
+    size_t mask;
+    size_t i;
+
+    if (name == NULL) {
+        name = "(unnamed)";
+    }
+
+    // Keep the table at most half full
+    if (_handlebars_memory_profile_entry_count * 2 >= _handlebars_memory_profile_names_size) {
+        size_t size = _handlebars_memory_profile_names_size ? _handlebars_memory_profile_names_size * 2 : PROFILE_TABLE_MIN_SIZE;
+        free(_handlebars_memory_profile_names);
+        _handlebars_memory_profile_names = profile_xrealloc(NULL, size * sizeof(size_t));
+        memset(_handlebars_memory_profile_names, 0, size * sizeof(size_t));
+        _handlebars_memory_profile_names_size = size;
+        for (i = 0; i < _handlebars_memory_profile_entry_count; i++) {
+            profile_names_insert(i);
+        }
+    }
+
+    mask = _handlebars_memory_profile_names_size - 1;
+    for (i = profile_hash_name(name) & mask; _handlebars_memory_profile_names[i] != 0; i = (i + 1) & mask) {
+        size_t index = _handlebars_memory_profile_names[i] - 1;
+        if (0 == strcmp(profile_entry_at(index)->name, name)) {
+            return index;
+        }
+    }
+
+    if (_handlebars_memory_profile_entry_count % PROFILE_CHUNK_SIZE == 0) {
+        size_t chunk = _handlebars_memory_profile_entry_count / PROFILE_CHUNK_SIZE;
+        _handlebars_memory_profile_chunks = profile_xrealloc(_handlebars_memory_profile_chunks, (chunk + 1) * sizeof(*_handlebars_memory_profile_chunks));
+        _handlebars_memory_profile_chunks[chunk] = profile_xrealloc(NULL, PROFILE_CHUNK_SIZE * sizeof(struct handlebars_memory_profile_entry));
+    }
+
+    // Names are usually string literals, but are copied in case they are not
+    struct handlebars_memory_profile_entry * entry = profile_entry_at(_handlebars_memory_profile_entry_count);
+    memset(entry, 0, sizeof(*entry));
+    entry->name = strcpy(profile_xrealloc(NULL, strlen(name) + 1), name);
+    _handlebars_memory_profile_names[i] = ++_handlebars_memory_profile_entry_count;
+    return _handlebars_memory_profile_entry_count - 1;
+}
+
+static size_t profile_live_find(const void * ptr)
+{
+    size_t mask = _handlebars_memory_profile_live_size - 1;
+    size_t i = profile_hash_ptr(ptr) & mask;
+    while (_handlebars_memory_profile_live[i].ptr != NULL && _handlebars_memory_profile_live[i].ptr != ptr) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static void profile_untrack(const void * ptr)
+{
+    struct profile_allocation * live = _handlebars_memory_profile_live;
+    size_t mask = _handlebars_memory_profile_live_size - 1;
+    size_t i;
+    size_t j;
+
+    if (ptr == NULL || _handlebars_memory_profile_live_count == 0) {
+        return;
+    }
+
+    i = profile_live_find(ptr);
+    if (live[i].ptr == NULL) {
+        return;
+    }
+
+    profile_entry_at(live[i].entry)->live_bytes -= live[i].size;
+    _handlebars_memory_profile_live_bytes -= live[i].size;
+    _handlebars_memory_profile_live_count--;
+
+    // Shift back the allocations after it that would no longer be found past the empty slot
+    for (j = (i + 1) & mask; live[j].ptr != NULL; j = (j + 1) & mask) {
+        size_t home = profile_hash_ptr(live[j].ptr) & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            live[i] = live[j];
+            i = j;
+        }
+    }
+    live[i].ptr = NULL;
+}
+
+static void profile_track(const void * ptr, size_t size, size_t index)
+{
+    struct handlebars_memory_profile_entry * entry = profile_entry_at(index);
+    size_t i;
+
+    // The pointer may have been freed without going through the hooks, and reused
+    profile_untrack(ptr);
+
+    if (_handlebars_memory_profile_live_count * 2 >= _handlebars_memory_profile_live_size) {
+        struct profile_allocation * prev = _handlebars_memory_profile_live;
+        size_t prev_size = _handlebars_memory_profile_live_size;
+        size_t size = prev_size ? prev_size * 2 : PROFILE_TABLE_MIN_SIZE;
+        _handlebars_memory_profile_live = profile_xrealloc(NULL, size * sizeof(struct profile_allocation));
+        memset(_handlebars_memory_profile_live, 0, size * sizeof(struct profile_allocation));
+        _handlebars_memory_profile_live_size = size;
+        for (i = 0; i < prev_size; i++) {
+            if (prev[i].ptr != NULL) {
+                _handlebars_memory_profile_live[profile_live_find(prev[i].ptr)] = prev[i];
+            }
+        }
+        free(prev);
+    }
+
+    i = profile_live_find(ptr);
+    _handlebars_memory_profile_live[i].ptr = ptr;
+    _handlebars_memory_profile_live[i].size = size;
+    _handlebars_memory_profile_live[i].entry = index;
+    _handlebars_memory_profile_live_count++;
+
+    entry->live_bytes += size;
+    if (entry->live_bytes > entry->peak_bytes) {
+        entry->peak_bytes = entry->live_bytes;
+    }
+    _handlebars_memory_profile_live_bytes += size;
+    if (_handlebars_memory_profile_live_bytes > _handlebars_memory_profile_peak_bytes) {
+        _handlebars_memory_profile_peak_bytes = _handlebars_memory_profile_live_bytes;
+    }
+}
+
+static void profile_alloc(const void * ptr, size_t size, const char * name)
+{
+    size_t index;
+
+    if (ptr == NULL) {
+        return;
+    }
+
+    index = profile_entry(name);
+    profile_entry_at(index)->calls++;
+    profile_entry_at(index)->bytes += size;
+    profile_track(ptr, size, index);
+}
+
+static void profile_realloc(const void * prev, const void * ptr, size_t size, const char * name)
+{
+    if (ptr != NULL) {
+        profile_untrack(prev);
+        profile_alloc(ptr, size, name);
+    }
+}
+
+static void profile_collect_cb(const void * ptr, int depth, int max_depth, int is_ref, void * private_data)
+{
+    if (is_ref) {
+        return;
+    }
+
+    if (_handlebars_memory_profile_tree_count >= _handlebars_memory_profile_tree_size) {
+        _handlebars_memory_profile_tree_size = _handlebars_memory_profile_tree_size ? _handlebars_memory_profile_tree_size * 2 : PROFILE_TABLE_MIN_SIZE;
+        _handlebars_memory_profile_tree = profile_xrealloc(_handlebars_memory_profile_tree, _handlebars_memory_profile_tree_size * sizeof(void *));
+    }
+    _handlebars_memory_profile_tree[_handlebars_memory_profile_tree_count++] = ptr;
+}
+
+/**
+ * @brief Remember the allocations in the tree of ptr, which talloc frees along with it
+ * @return The mark to pass to #profile_release
+ */
+static size_t profile_collect(const void * ptr)
+{
+    size_t mark = _handlebars_memory_profile_tree_count;
+    if (ptr != NULL && _handlebars_memory_profile_live_count > 0) {
+        talloc_report_depth_cb(ptr, 0, -1, profile_collect_cb, NULL);
+    }
+    return mark;
+}
+
+static void profile_release(size_t mark, bool freed)
+{
+    size_t i;
+    if (freed) {
+        for (i = mark; i < _handlebars_memory_profile_tree_count; i++) {
+            profile_untrack(_handlebars_memory_profile_tree[i]);
+        }
+    }
+    _handlebars_memory_profile_tree_count = mark;
+}
+
+// Overrides for memory functions
+static void * _handlebars_memprof_talloc_array(const void * ctx, size_t el_size, unsigned count, const char * name)
+{
+    void * ptr = _talloc_array(ctx, el_size, count, name);
+    profile_alloc(ptr, el_size * count, name);
+    return ptr;
+}
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic warning "-Wformat-nonliteral"
+#endif
+
+HBS_ATTR_PRINTF(2,3)
+static char * _handlebars_memprof_talloc_asprintf(const void * t, const char * fmt, ...)
+{
+    va_list ap;
+    char * str;
+    va_start(ap, fmt);
+    str = talloc_vasprintf(t, fmt, ap);
+    va_end(ap);
+    profile_alloc(str, str ? talloc_get_size(str) : 0, "talloc_asprintf");
+    return str;
+}
+
+HBS_ATTR_PRINTF(2,3)
+static char * _handlebars_memprof_talloc_asprintf_append(char * s, const char * fmt, ...)
+{
+    va_list ap;
+    char * str;
+    va_start(ap, fmt);
+    str = talloc_vasprintf_append(s, fmt, ap);
+    va_end(ap);
+    profile_realloc(s, str, str ? talloc_get_size(str) : 0, "talloc_asprintf_append");
+    return str;
+}
+
+HBS_ATTR_PRINTF(2,3)
+static char * _handlebars_memprof_talloc_asprintf_append_buffer(char * s, const char * fmt, ...)
+{
+    va_list ap;
+    char * str;
+    va_start(ap, fmt);
+    str = talloc_vasprintf_append_buffer(s, fmt, ap);
+    va_end(ap);
+    profile_realloc(s, str, str ? talloc_get_size(str) : 0, "talloc_asprintf_append_buffer");
+    return str;
+}
+
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+static int _handlebars_memprof_talloc_free(void * ptr, const char * location)
+{
+    size_t mark = profile_collect(ptr);
+    int retval = _talloc_free(ptr, location);
+    profile_release(mark, retval == 0);
+    return retval;
+}
+
+static void * _handlebars_memprof_talloc_named_const(const void * context, size_t size, const char * name)
+{
+    void * ptr = talloc_named_const(context, size, name);
+    profile_alloc(ptr, size, name);
+    return ptr;
+}
+
+static void * _handlebars_memprof_talloc_realloc_array(const void * ctx, void * ptr, size_t el_size, unsigned count, const char * name)
+{
+    void * retval;
+
+    // Reallocating to nothing frees the tree of the pointer
+    if (ptr != NULL && el_size * count == 0) {
+        size_t mark = profile_collect(ptr);
+        retval = _talloc_realloc_array(ctx, ptr, el_size, count, name);
+        profile_release(mark, retval == NULL);
+        return retval;
+    }
+
+    retval = _talloc_realloc_array(ctx, ptr, el_size, count, name);
+    profile_realloc(ptr, retval, el_size * count, name);
+    return retval;
+}
+
+static char * _handlebars_memprof_talloc_strdup(const void * t, const char * p)
+{
+    char * str = talloc_strdup(t, p);
+    profile_alloc(str, str ? talloc_get_size(str) : 0, "talloc_strdup");
+    return str;
+}
+
+static char * _handlebars_memprof_talloc_strdup_append(char * s, const char * a)
+{
+    char * str = talloc_strdup_append(s, a);
+    profile_realloc(s, str, str ? talloc_get_size(str) : 0, "talloc_strdup_append");
+    return str;
+}
+
+static char * _handlebars_memprof_talloc_strdup_append_buffer(char * s, const char * a)
+{
+    char * str = talloc_strdup_append_buffer(s, a);
+    profile_realloc(s, str, str ? talloc_get_size(str) : 0, "talloc_strdup_append_buffer");
+    return str;
+}
+
+static char * _handlebars_memprof_talloc_strndup(const void * t, const char * p, size_t n)
+{
+    char * str = talloc_strndup(t, p, n);
+    profile_alloc(str, str ? talloc_get_size(str) : 0, "talloc_strndup");
+    return str;
+}
+
+static char * _handlebars_memprof_talloc_strndup_append_buffer(char * s, const char * a, size_t n)
+{
+    char * str = talloc_strndup_append_buffer(s, a, n);
+    profile_realloc(s, str, str ? talloc_get_size(str) : 0, "talloc_strndup_append_buffer");
+    return str;
+}
+
+static void * _handlebars_memprof_talloc_zero(const void * ctx, size_t size, const char * name)
+{
+    void * ptr = _talloc_zero(ctx, size, name);
+    profile_alloc(ptr, size, name);
+    return ptr;
+}
+
+static void profile_clear(void)
+{
+    size_t i;
+    for (i = 0; i < _handlebars_memory_profile_entry_count; i++) {
+        free((char *) profile_entry_at(i)->name);
+    }
+    for (i = 0; i * PROFILE_CHUNK_SIZE < _handlebars_memory_profile_entry_count; i++) {
+        free(_handlebars_memory_profile_chunks[i]);
+    }
+    free(_handlebars_memory_profile_chunks);
+    free(_handlebars_memory_profile_names);
+    free(_handlebars_memory_profile_live);
+    free(_handlebars_memory_profile_tree);
+    _handlebars_memory_profile_chunks = NULL;
+    _handlebars_memory_profile_entry_count = 0;
+    _handlebars_memory_profile_names = NULL;
+    _handlebars_memory_profile_names_size = 0;
+    _handlebars_memory_profile_live = NULL;
+    _handlebars_memory_profile_live_count = 0;
+    _handlebars_memory_profile_live_size = 0;
+    _handlebars_memory_profile_tree = NULL;
+    _handlebars_memory_profile_tree_count = 0;
+    _handlebars_memory_profile_tree_size = 0;
+    _handlebars_memory_profile_live_bytes = 0;
+    _handlebars_memory_profile_peak_bytes = 0;
+}
+
+void handlebars_memory_profile_enable(void)
+{
+    handlebars_memory_fail_disable();
+    profile_clear();
+
+    _handlebars_memory_profile_enabled = 1;
+    _handlebars_talloc_array = &_handlebars_memprof_talloc_array;
+    _handlebars_talloc_asprintf = &_handlebars_memprof_talloc_asprintf;
+    _handlebars_talloc_asprintf_append = &_handlebars_memprof_talloc_asprintf_append;
+    _handlebars_talloc_asprintf_append_buffer = &_handlebars_memprof_talloc_asprintf_append_buffer;
+    _handlebars_talloc_free = &_handlebars_memprof_talloc_free;
+    _handlebars_talloc_named_const = &_handlebars_memprof_talloc_named_const;
+    _handlebars_talloc_realloc_array = &_handlebars_memprof_talloc_realloc_array;
+    _handlebars_talloc_strdup = &_handlebars_memprof_talloc_strdup;
+    _handlebars_talloc_strdup_append = &_handlebars_memprof_talloc_strdup_append;
+    _handlebars_talloc_strdup_append_buffer = &_handlebars_memprof_talloc_strdup_append_buffer;
+    _handlebars_talloc_strndup = &_handlebars_memprof_talloc_strndup;
+    _handlebars_talloc_strndup_append_buffer = &_handlebars_memprof_talloc_strndup_append_buffer;
+    _handlebars_talloc_zero = &_handlebars_memprof_talloc_zero;
+    _handlebars_yy_alloc = &_handlebars_memprof_talloc_named_const;
+    _handlebars_yy_realloc = &_handlebars_memprof_talloc_realloc_array;
+    _handlebars_yy_free = &_handlebars_memprof_talloc_free;
+}
+
+void handlebars_memory_profile_disable(void)
+{
+    if (_handlebars_memory_profile_enabled) {
+        handlebars_memory_fail_disable();
+    }
+}
+
+int handlebars_memory_profile_get_state(void)
+{
+    return _handlebars_memory_profile_enabled;
+}
+
+void handlebars_memory_profile_reset(void)
+{
+    size_t i;
+    for (i = 0; i < _handlebars_memory_profile_entry_count; i++) {
+        struct handlebars_memory_profile_entry * entry = profile_entry_at(i);
+        entry->calls = 0;
+        entry->bytes = 0;
+        entry->peak_bytes = entry->live_bytes;
+    }
+    _handlebars_memory_profile_peak_bytes = _handlebars_memory_profile_live_bytes;
+}
+
+size_t handlebars_memory_profile_count(void)
+{
+    return _handlebars_memory_profile_entry_count;
+}
+
+const struct handlebars_memory_profile_entry * handlebars_memory_profile_get(size_t index)
+{
+    if (index >= _handlebars_memory_profile_entry_count) {
+        return NULL;
+    }
+    return profile_entry_at(index);
+}
+
+const struct handlebars_memory_profile_entry * handlebars_memory_profile_find(const char * name)
+{
+    size_t i;
+    for (i = 0; i < _handlebars_memory_profile_entry_count; i++) {
+        if (0 == strcmp(profile_entry_at(i)->name, name)) {
+            return profile_entry_at(i);
+        }
+    }
+    return NULL;
+}
+
+size_t handlebars_memory_profile_get_live_bytes(void)
+{
+    return _handlebars_memory_profile_live_bytes;
+}
+
+size_t handlebars_memory_profile_get_peak_bytes(void)
+{
+    return _handlebars_memory_profile_peak_bytes;
+}
+
+static int profile_compare(const void * a, const void * b)
+{
+    const struct handlebars_memory_profile_entry * entry1 = *(const struct handlebars_memory_profile_entry * const *) a;
+    const struct handlebars_memory_profile_entry * entry2 = *(const struct handlebars_memory_profile_entry * const *) b;
+    if (entry1->bytes != entry2->bytes) {
+        return entry1->bytes < entry2->bytes ? 1 : -1;
+    }
+    if (entry1->calls != entry2->calls) {
+        return entry1->calls < entry2->calls ? 1 : -1;
+    }
+    return strcmp(entry1->name, entry2->name);
+}
+
+void handlebars_memory_profile_print(FILE * fp, size_t limit)
+{
+    const struct handlebars_memory_profile_entry ** sorted;
+    size_t count = _handlebars_memory_profile_entry_count;
+    size_t calls = 0;
+    size_t bytes = 0;
+    size_t i;
+
+    sorted = profile_xrealloc(NULL, (count ? count : 1) * sizeof(*sorted));
+    for (i = 0; i < count; i++) {
+        sorted[i] = profile_entry_at(i);
+        calls += sorted[i]->calls;
+        bytes += sorted[i]->bytes;
+    }
+    qsort(sorted, count, sizeof(*sorted), profile_compare);
+
+    fprintf(fp, "%12s %14s %14s %14s  %s\n", "calls", "bytes", "live bytes", "peak bytes", "name");
+    for (i = 0; i < count && (limit == 0 || i < limit); i++) {
+        if (sorted[i]->calls == 0 && sorted[i]->live_bytes == 0) {
+            continue;
+        }
+        fprintf(
+            fp,
+            "%12zu %14zu %14zu %14zu  %s\n",
+            sorted[i]->calls,
+            sorted[i]->bytes,
+            sorted[i]->live_bytes,
+            sorted[i]->peak_bytes,
+            sorted[i]->name
+        );
+    }
+    fprintf(
+        fp,
+        "%12zu %14zu %14zu %14zu  %s\n",
+        calls,
+        bytes,
+        _handlebars_memory_profile_live_bytes,
+        _handlebars_memory_profile_peak_bytes,
+        "(total)"
+    );
+
+    free(sorted);
+}
+
+// }}} Profiler
+
 
 // LCOV_EXCL_STOP
@@ -23,6 +23,7 @@
 #ifndef HANDLEBARS_MEMORY_H
 #define HANDLEBARS_MEMORY_H
 
+#include <stdio.h>
 #include <talloc.h>
 #include "handlebars.h"
 
@@ -191,6 +192,94 @@ int handlebars_memory_get_last_exit_code(void);
  */
 int handlebars_memory_get_call_counter(void);
 
+// Functions to profile memory allocations
+
+/**
+ * @brief The allocations made through the memory function pointers under one talloc name. The name is the type for
+ *        typed allocations, the location for untyped ones, and the function for string functions.
+ */
+struct handlebars_memory_profile_entry {
+    //! The talloc name
+    const char * name;
+    //! The number of allocations and reallocations
+    size_t calls;
+    //! The number of bytes requested by allocations and reallocations
+    size_t bytes;
+    //! The number of bytes allocated and not freed yet
+    size_t live_bytes;
+    //! The highest number of live bytes
+    size_t peak_bytes;
+};
+
+/**
+ * @brief Enable allocation profiling. Clears the data of the previous profile, and disables memory failure
+ *        behaviour. Memory allocated before does not count towards live bytes when freed.
+ */
+void handlebars_memory_profile_enable(void);
+
+/**
+ * @brief Disable allocation profiling. The data of the profile is kept until it is enabled again.
+ */
+void handlebars_memory_profile_disable(void);
+
+/**
+ * @brief Get whether allocation profiling is enabled
+ */
+int handlebars_memory_profile_get_state(void);
+
+/**
+ * @brief Reset the calls and bytes of the profile, and its peaks to the current live bytes
+ */
+void handlebars_memory_profile_reset(void);
+
+/**
+ * @brief Get the number of entries in the profile
+ *
+ * @return The number of entries
+ */
+size_t handlebars_memory_profile_count(void);
+
+/**
+ * @brief Get an entry of the profile, in the order the names were first seen
+ *
+ * @param[in] index The index of the entry
+ * @return The entry, or NULL if the index is out of range. It stays valid until profiling is enabled again.
+ */
+const struct handlebars_memory_profile_entry * handlebars_memory_profile_get(size_t index);
+
+/**
+ * @brief Find the entry of the profile for a talloc name
+ *
+ * @param[in] name The talloc name
+ * @return The entry, or NULL if nothing was allocated under the name. It stays valid until profiling is enabled
+ *         again.
+ */
+const struct handlebars_memory_profile_entry * handlebars_memory_profile_find(const char * name)
+    HBS_ATTR_NONNULL_ALL;
+
+/**
+ * @brief Get the number of bytes allocated and not freed yet while profiling
+ *
+ * @return The number of bytes
+ */
+size_t handlebars_memory_profile_get_live_bytes(void);
+
+/**
+ * @brief Get the highest number of live bytes while profiling
+ *
+ * @return The number of bytes
+ */
+size_t handlebars_memory_profile_get_peak_bytes(void);
+
+/**
+ * @brief Print the entries of the profile by descending bytes, followed by the totals
+ *
+ * @param[in] fp The stream to print to
+ * @param[in] limit The maximum number of entries to print, or 0 for all of them
+ */
+void handlebars_memory_profile_print(FILE * fp, size_t limit)
+    HBS_ATTR_NONNULL_ALL;
+
 #endif /* HANDLEBARS_MEMORY */
 
 HBS_EXTERN_C_END
@@ -20,6 +20,7 @@
 #endif
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 
 #ifdef HAVE_ALLOCA_H
@@ -134,6 +135,13 @@ static size_t calculate_size_program(struct handlebars_module * module, struct h
     return size;
 }
 
+static long decode_index(struct handlebars_string * string)
+{
+    char * end;
+    long index = strtol(hbs_str_val(string), &end, 10);
+    return end == hbs_str_val(string) || index < 0 ? -1 : index;
+}
+
 static void serialize_operand(struct handlebars_module * module, struct handlebars_operand * operand)
 {
     size_t i;
@@ -142,8 +150,10 @@ static void serialize_operand(struct handlebars_module * module, struct handleba
     // Increment for children
     switch( operand->type ) {
         case handlebars_operand_type_string:
-            // Make sure hash is computed
+            // Make sure hash, escaping and index are computed
             hbs_str_hash(operand->data.string.string);
+            hbs_str_needs_escape(operand->data.string.string);
+            operand->data.string.index = decode_index(operand->data.string.string);
 
             size = HBS_STR_SIZE(hbs_str_len(operand->data.string.string));
             operand->data.string.string = append(module, operand->data.string.string, size);
@@ -152,8 +162,10 @@ static void serialize_operand(struct handlebars_module * module, struct handleba
         case handlebars_operand_type_array:
             operand->data.array.array = append(module, operand->data.array.array, sizeof(struct handlebars_operand_string) * operand->data.array.count);
             for( i = 0; i < operand->data.array.count; i++ ) {
-                // Make sure hash is computed
+                // Make sure hash, escaping and index are computed
                 hbs_str_hash(operand->data.array.array[i].string);
+                hbs_str_needs_escape(operand->data.array.array[i].string);
+                operand->data.array.array[i].index = decode_index(operand->data.array.array[i].string);
 
                 size = HBS_STR_SIZE(hbs_str_len(operand->data.array.array[i].string));
                 operand->data.array.array[i].string = append(module, operand->data.array.array[i].string, size);
@@ -229,16 +241,62 @@ static void serialize_program2(struct handlebars_module * module, struct handleb
     }
 }
 
-static void serialize_program(struct handlebars_module * module, struct handlebars_program * program)
+static size_t serialize_program(struct handlebars_module * module, struct handlebars_program * program)
 {
     struct handlebars_module_table_entry * entry = serialize_program_shallow(module, program);
     serialize_program2(module, program, entry);
+    return entry->guid;
+}
+
+static void link_partials(
+    struct handlebars_module * module,
+    size_t partial_count,
+    struct handlebars_string ** partial_names,
+    size_t * partial_guids
+) {
+    size_t i;
+    size_t j;
+
+    for( i = 0; i < module->opcode_count; i++ ) {
+        struct handlebars_opcode * opcode = &module->opcodes[i];
+
+        // Only static partials with a string name can be resolved ahead of time
+        if( opcode->type != handlebars_opcode_type_invoke_partial || opcode->op1.data.boolval ||
+                opcode->op2.type != handlebars_operand_type_string ) {
+            continue;
+        }
+
+        // In compat mode the indentation is applied to the template text, so the program depends on the call site
+        if( (module->flags & handlebars_compiler_flag_compat) && hbs_str_len(opcode->op3.data.string.string) > 0 ) {
+            continue;
+        }
+
+        for( j = 0; j < partial_count; j++ ) {
+            if( handlebars_string_eq(opcode->op2.data.string.string, partial_names[j]) ) {
+                handlebars_operand_set_longval(&opcode->op4, (long) partial_guids[j]);
+                break;
+            }
+        }
+    }
 }
 
 struct handlebars_module * handlebars_program_serialize(
     struct handlebars_context * context,
     struct handlebars_program * program
 ) {
+    return handlebars_program_serialize_bundle(context, program, 0, NULL, NULL);
+}
+
+struct handlebars_module * handlebars_program_serialize_bundle(
+    struct handlebars_context * context,
+    struct handlebars_program * program,
+    size_t partial_count,
+    struct handlebars_string ** partial_names,
+    struct handlebars_program ** partial_programs
+) {
+    size_t i;
+    size_t size;
+
     // Allocate initial buffer
     struct handlebars_module * module = handlebars_talloc_zero(context, struct handlebars_module);
     memcpy(&module->header, "HBSCM", sizeof("HBSCM"));
@@ -247,7 +305,11 @@ struct handlebars_module * handlebars_program_serialize(
     time(&module->ts);
 
     // Calculate size
-    module->size = sizeof(struct handlebars_module) + calculate_size_program(module, program);
+    size = calculate_size_program(module, program);
+    for( i = 0; i < partial_count; i++ ) {
+        size += calculate_size_program(module, partial_programs[i]);
+    }
+    module->size = sizeof(struct handlebars_module) + size;
 
     // Reallocate buffer
     module = handlebars_talloc_realloc_size(context, module, module->size);
@@ -273,6 +335,15 @@ struct handlebars_module * handlebars_program_serialize(
     // Copy data
     serialize_program(module, program);
 
+    // Append the partials, and resolve the calls to them
+    if( partial_count > 0 ) {
+        size_t * partial_guids = alloca(sizeof(size_t) * partial_count);
+        for( i = 0; i < partial_count; i++ ) {
+            partial_guids[i] = serialize_program(module, partial_programs[i]);
+        }
+        link_partials(module, partial_count, partial_names, partial_guids);
+    }
+
 #ifndef NDEBUG
     assert(module->program_count == program_count);
     assert(module->opcode_count == opcode_count);
@@ -313,7 +384,9 @@ void handlebars_module_normalize_pointers(struct handlebars_module * module, voi
         return;
     }
 
+    // Handler addresses are only valid in this process, the module has to be linked again
     for( i = 0; i < module->opcode_count; i++ ) {
+        module->opcodes[i].handler = NULL;
         normalize_operand(module, &module->opcodes[i].op1, baseaddr);
         normalize_operand(module, &module->opcodes[i].op2, baseaddr);
         normalize_operand(module, &module->opcodes[i].op3, baseaddr);
@@ -323,6 +396,7 @@ void handlebars_module_normalize_pointers(struct handlebars_module * module, voi
     PATCH(module->programs, baseaddr);
     PATCH(module->opcodes, baseaddr);
 
+    module->linked = NULL;
     module->addr = baseaddr;
 }
 
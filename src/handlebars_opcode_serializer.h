@@ -27,6 +27,7 @@ HBS_EXTERN_C_START
 struct handlebars_context;
 struct handlebars_program;
 struct handlebars_opcode;
+struct handlebars_string;
 struct handlebars_module;
 
 extern const size_t HANDLEBARS_MODULE_SIZE;
@@ -43,6 +44,25 @@ struct handlebars_module * handlebars_program_serialize(
     struct handlebars_program * program
 ) HBS_ATTR_NONNULL_ALL HBS_ATTR_RETURNS_NONNULL HBS_ATTR_WARN_UNUSED_RESULT;
 
+/**
+ * @brief Serialize a program together with a set of partials into a single module. The partials are appended as
+ *        additional programs, and static calls to them are resolved to their program number, so that the VM does
+ *        not have to look them up by name. Calls to any other partial are still looked up at runtime.
+ * @param[in] context
+ * @param[in] program
+ * @param[in] partial_count The number of partials
+ * @param[in] partial_names The names of the partials
+ * @param[in] partial_programs The compiled partials, in the same order as partial_names
+ * @return The serialized program
+ */
+struct handlebars_module * handlebars_program_serialize_bundle(
+    struct handlebars_context * context,
+    struct handlebars_program * program,
+    size_t partial_count,
+    struct handlebars_string ** partial_names,
+    struct handlebars_program ** partial_programs
+) HBS_ATTR_NONNULL(1, 2) HBS_ATTR_RETURNS_NONNULL HBS_ATTR_WARN_UNUSED_RESULT;
+
 /**
  * @brief Adjust pointers by the offset between the specified base address and handlebars_module#addr
  * @param[in] module
@@ -140,6 +160,9 @@ struct handlebars_module
     //! Array of opcodes
     struct handlebars_opcode * opcodes;
 
+    //! The VM dispatch table handlebars_opcode#handler was set from, or NULL if the module has not been linked
+    const void * linked;
+
     //! Current offfset of data segment
     size_t data_offset;
 
@@ -189,6 +189,10 @@ const char * handlebars_opcode_readable_type(enum handlebars_opcode_type type)
         // Special
         _RTYPE_CASE(return, return);
 
+        // Superinstructions
+        _RTYPE_CASE(lookup_on_context_append, lookupOnContextAppend);
+        _RTYPE_CASE(lookup_on_context_append_escaped, lookupOnContextAppendEscaped);
+
         default: return "invalid";
     }
 }
@@ -230,6 +234,8 @@ enum handlebars_opcode_type handlebars_opcode_reverse_readable_type(const char *
             _RTYPE_REV_CMP(lookup_block_param, lookupBlockParam);
             _RTYPE_REV_CMP(lookup_on_context, lookupOnContext);
             _RTYPE_REV_CMP(lookup_data, lookupData);
+            _RTYPE_REV_CMP(lookup_on_context_append, lookupOnContextAppend);
+            _RTYPE_REV_CMP(lookup_on_context_append_escaped, lookupOnContextAppendEscaped);
             break;
         case 'n':
             _RTYPE_REV_CMP(nil, nil);
@@ -306,6 +312,8 @@ short handlebars_opcode_num_operands(enum handlebars_opcode_type type)
 
         // In v4 lookup_on_context was changed from 3 to 4 operands
         case handlebars_opcode_type_lookup_on_context:
+        case handlebars_opcode_type_lookup_on_context_append:
+        case handlebars_opcode_type_lookup_on_context_append_escaped:
             return 4;
     }
 }
@@ -88,7 +88,12 @@ enum handlebars_opcode_type {
     handlebars_opcode_type_register_decorator = 26,
 
     // Special opcode
-    handlebars_opcode_type_return = 27
+    handlebars_opcode_type_return = 27,
+
+    // Superinstructions, only emitted with handlebars_compiler_flag_superinstructions. Take the operands of
+    // lookup_on_context, with the depth of the fused get_context in the second
+    handlebars_opcode_type_lookup_on_context_append = 28,
+    handlebars_opcode_type_lookup_on_context_append_escaped = 29
 };
 
 /**
@@ -231,6 +236,8 @@ void handlebars_opcode_set_loc(
 
 struct handlebars_operand_string {
     struct handlebars_string * string;
+    //! The string decoded as an array index, or -1 if it is not one. Set by #handlebars_program_serialize
+    long index;
 };
 
 struct handlebars_operand_array {
@@ -252,6 +259,9 @@ struct handlebars_operand {
 
 struct handlebars_opcode {
     enum handlebars_opcode_type type;
+    //! The address of the VM handler for this opcode, or NULL. Set when the module is linked by the VM and only
+    //! valid in the process that linked it
+    const void * handler;
     struct handlebars_operand op1;
     struct handlebars_operand op2;
     struct handlebars_operand op3;
@@ -0,0 +1,252 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <talloc.h>
+
+#include "handlebars.h"
+#include "handlebars_memory.h"
+#include "handlebars_private.h"
+#include "handlebars_value_private.h"
+
+#include "handlebars_map.h"
+#include "handlebars_overlay.h"
+#include "handlebars_value.h"
+#include "handlebars_value_handlers.h"
+
+#ifndef HANDLEBARS_NO_REFCOUNT
+#include "handlebars_rc.h"
+#endif
+
+#define GET_INTERN_V(value) GET_INTERN(handlebars_value_get_user(value))
+#define GET_INTERN(user) ((struct handlebars_overlay *) talloc_get_type_abort(user, struct handlebars_overlay))
+
+
+
+struct handlebars_overlay {
+    struct handlebars_user user;
+    struct handlebars_value top;
+    struct handlebars_value parent;
+    //! The keys of both layers in iteration order, kept until one of the layer maps changes
+    struct handlebars_value merged;
+    //! The top map #merged was built from, or NULL if the top layer is not a map
+    struct handlebars_map * merged_top;
+    //! The parent map #merged was built from, or NULL if the parent layer is not a map
+    struct handlebars_map * merged_parent;
+    //! The count of #merged_top when #merged was built
+    size_t merged_top_count;
+    //! The count of #merged_parent when #merged was built
+    size_t merged_parent_count;
+};
+
+static struct handlebars_map * overlay_merge(struct handlebars_overlay * intern, bool recurse)
+{
+    struct handlebars_map * map = handlebars_map_ctor(
+        intern->user.ctx,
+        handlebars_value_count(&intern->parent) + handlebars_value_count(&intern->top)
+    );
+
+    HANDLEBARS_VALUE_FOREACH_KV(&intern->parent, key, child) {
+        if (recurse) {
+            handlebars_value_convert_ex(child, recurse);
+        }
+        map = handlebars_map_update(map, key, child);
+    } HANDLEBARS_VALUE_FOREACH_END();
+
+    HANDLEBARS_VALUE_FOREACH_KV(&intern->top, key, child) {
+        if (recurse) {
+            handlebars_value_convert_ex(child, recurse);
+        }
+        map = handlebars_map_update(map, key, child);
+    } HANDLEBARS_VALUE_FOREACH_END();
+
+    return map;
+}
+
+static struct handlebars_map * overlay_layer_map(struct handlebars_value * layer)
+{
+    if (handlebars_value_get_real_type(layer) == HANDLEBARS_VALUE_TYPE_MAP) {
+        return handlebars_value_get_map(layer);
+    }
+    return NULL;
+}
+
+static bool overlay_layer_unchanged(struct handlebars_value * layer, struct handlebars_map * map, size_t count)
+{
+    switch (handlebars_value_get_real_type(layer)) {
+        case HANDLEBARS_VALUE_TYPE_MAP:
+            // Shared maps are copied on write, so the same map with the same count has the same keys
+            return handlebars_value_get_map(layer) == map && handlebars_map_count(map) == count;
+        case HANDLEBARS_VALUE_TYPE_USER:
+            // User types may change behind our back
+            return false;
+        default:
+            return map == NULL;
+    }
+}
+
+static bool overlay_merged_is_valid(struct handlebars_overlay * intern)
+{
+    return handlebars_value_get_real_type(&intern->merged) == HANDLEBARS_VALUE_TYPE_MAP &&
+        overlay_layer_unchanged(&intern->top, intern->merged_top, intern->merged_top_count) &&
+        overlay_layer_unchanged(&intern->parent, intern->merged_parent, intern->merged_parent_count);
+}
+
+static struct handlebars_value * hbs_overlay_copy(struct handlebars_value * value)
+{
+    struct handlebars_overlay * intern = GET_INTERN_V(value);
+    struct handlebars_context * context = intern->user.ctx;
+    struct handlebars_value * rv = MC(handlebars_talloc_zero(context, struct handlebars_value));
+    return handlebars_value_overlay_init(context, &intern->top, &intern->parent, rv);
+}
+
+static void hbs_overlay_dtor(struct handlebars_user * user)
+{
+    struct handlebars_overlay * intern = GET_INTERN(user);
+    handlebars_value_dtor(&intern->top);
+    handlebars_value_dtor(&intern->parent);
+    handlebars_value_dtor(&intern->merged);
+}
+
+static void hbs_overlay_convert(struct handlebars_value * value, bool recurse)
+{
+    // Replacing the value may release the overlay
+    handlebars_value_map(value, overlay_merge(GET_INTERN_V(value), recurse));
+}
+
+static enum handlebars_value_type hbs_overlay_type(struct handlebars_value * value)
+{
+    return HANDLEBARS_VALUE_TYPE_MAP;
+}
+
+static struct handlebars_value * hbs_overlay_map_find(struct handlebars_value * value, struct handlebars_string * key, struct handlebars_value * rv)
+{
+    struct handlebars_overlay * intern = GET_INTERN_V(value);
+    struct handlebars_value * retval = handlebars_value_map_find(&intern->top, key, rv);
+
+    if (!retval) {
+        retval = handlebars_value_map_find(&intern->parent, key, rv);
+    }
+
+    return retval;
+}
+
+static bool hbs_overlay_iterator_next(struct handlebars_value_iterator * it)
+{
+    struct handlebars_overlay * intern = GET_INTERN_V(it->value);
+    struct handlebars_map * map = handlebars_value_get_map(&intern->merged);
+    struct handlebars_value * tmp;
+
+    if (it->index + 1 >= handlebars_map_count(map)) {
+        handlebars_value_dtor(it->cur);
+        handlebars_map_set_is_in_iteration(map, false);
+        return false;
+    }
+
+    it->index++;
+    handlebars_map_get_kv_at_index(map, it->index, &it->key, &tmp);
+
+    // Read through to the layers, since their values may be updated in place between iterations
+    if (!hbs_overlay_map_find(it->value, it->key, it->cur)) {
+        handlebars_value_value(it->cur, tmp);
+    }
+
+    return true;
+}
+
+static bool hbs_overlay_iterator_init(struct handlebars_value_iterator * it, struct handlebars_value * value)
+{
+    struct handlebars_overlay * intern = GET_INTERN_V(value);
+    struct handlebars_map * map;
+
+    if (!overlay_merged_is_valid(intern)) {
+        // Rebuilding the merged map would free it from under the outer iteration
+        if (handlebars_value_get_real_type(&intern->merged) == HANDLEBARS_VALUE_TYPE_MAP &&
+                handlebars_map_set_is_in_iteration(handlebars_value_get_map(&intern->merged), false)) {
+            fprintf(stderr, "Nested map iteration is not currently supported [%s:%d]", __FILE__, __LINE__);
+            abort();
+        }
+
+        handlebars_value_map(&intern->merged, overlay_merge(intern, false));
+        intern->merged_top = overlay_layer_map(&intern->top);
+        intern->merged_parent = overlay_layer_map(&intern->parent);
+        intern->merged_top_count = intern->merged_top ? handlebars_map_count(intern->merged_top) : 0;
+        intern->merged_parent_count = intern->merged_parent ? handlebars_map_count(intern->merged_parent) : 0;
+    }
+
+    map = handlebars_value_get_map(&intern->merged);
+
+    if (handlebars_map_set_is_in_iteration(map, true)) {
+        fprintf(stderr, "Nested map iteration is not currently supported [%s:%d]", __FILE__, __LINE__);
+        abort();
+    }
+
+    it->value = value;
+    it->index = (size_t) -1; // Wraps to the first entry
+    it->next = &hbs_overlay_iterator_next;
+    return hbs_overlay_iterator_next(it);
+}
+
+static long hbs_overlay_count(struct handlebars_value * value)
+{
+    struct handlebars_overlay * intern = GET_INTERN_V(value);
+    long count = handlebars_value_count(&intern->parent);
+    HANDLEBARS_VALUE_DECL(tmp);
+
+    HANDLEBARS_VALUE_FOREACH_KV(&intern->top, key, child) {
+        (void) child;
+        if (!handlebars_value_map_find(&intern->parent, key, tmp)) {
+            count++;
+        }
+    } HANDLEBARS_VALUE_FOREACH_END();
+
+    HANDLEBARS_VALUE_UNDECL(tmp);
+
+    return count;
+}
+
+static const struct handlebars_value_handlers handlebars_value_hbs_overlay_handlers = {
+    "overlay",
+    &hbs_overlay_copy,
+    &hbs_overlay_dtor,
+    &hbs_overlay_convert,
+    &hbs_overlay_type,
+    &hbs_overlay_map_find,
+    NULL, // array_find
+    &hbs_overlay_iterator_init,
+    NULL, // call
+    &hbs_overlay_count
+};
+
+struct handlebars_value * handlebars_value_overlay_init(
+    struct handlebars_context * context,
+    struct handlebars_value * top,
+    struct handlebars_value * parent,
+    struct handlebars_value * rv
+) {
+    struct handlebars_overlay * obj = MC(handlebars_talloc_zero(context, struct handlebars_overlay));
+    handlebars_user_init((struct handlebars_user *) obj, context, &handlebars_value_hbs_overlay_handlers);
+    handlebars_value_value(&obj->top, top);
+    handlebars_value_value(&obj->parent, parent);
+    handlebars_value_user(rv, (struct handlebars_user *) obj);
+    return rv;
+}
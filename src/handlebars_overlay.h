@@ -0,0 +1,53 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ * @brief Overlay maps
+ */
+
+#ifndef HANDLEBARS_OVERLAY_H
+#define HANDLEBARS_OVERLAY_H
+
+#include "handlebars.h"
+
+HBS_EXTERN_C_START
+
+struct handlebars_context;
+struct handlebars_value;
+
+/**
+ * @brief Construct a map that is the union of two maps, without copying either of them. A key is looked up in the
+ *        top map first, then in the parent map. Iterating over it yields the keys of the parent followed by the keys
+ *        only in the top map, in the same order as merging the top map into a copy of the parent, which iteration
+ *        does on demand. Both maps are referenced, not copied, so later changes to them are visible through it.
+ * @param[in] context The handlebars context
+ * @param[in] top The map whose keys take precedence
+ * @param[in] parent The map whose keys are used unless they are in the top map
+ * @param[out] rv The value to store the overlay in, may be the same as top or parent
+ * @return The overlay value
+ */
+struct handlebars_value * handlebars_value_overlay_init(
+    struct handlebars_context * context,
+    struct handlebars_value * top,
+    struct handlebars_value * parent,
+    struct handlebars_value * rv
+) HBS_ATTR_NONNULL_ALL HBS_ATTR_RETURNS_NONNULL;
+
+HBS_EXTERN_C_END
+
+#endif /* HANDLEBARS_OVERLAY_H */
@@ -0,0 +1,169 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "handlebars.h"
+#include "handlebars_memory.h"
+#include "handlebars_sink.h"
+
+
+
+struct handlebars_sink {
+    handlebars_sink_write_func write;
+    void * write_ctx;
+    size_t chunk_size;
+    size_t written;
+    union {
+        FILE * fp;
+        int fd;
+        struct {
+            char * buf;
+            size_t size;
+            size_t len;
+        } buffer;
+    } u;
+};
+
+// {{{ Stock write callbacks
+
+static bool sink_file_write(void * write_ctx, const char * str, size_t len)
+{
+    struct handlebars_sink * sink = write_ctx;
+    return fwrite(str, 1, len, sink->u.fp) == len;
+}
+
+static bool sink_fd_write(void * write_ctx, const char * str, size_t len)
+{
+    struct handlebars_sink * sink = write_ctx;
+    while (len > 0) {
+        ssize_t n = write(sink->u.fd, str, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        str += n;
+        len -= (size_t) n;
+    }
+    return true;
+}
+
+static bool sink_buffer_write(void * write_ctx, const char * str, size_t len)
+{
+    struct handlebars_sink * sink = write_ctx;
+    if (len > sink->u.buffer.size - sink->u.buffer.len) {
+        return false;
+    }
+    memcpy(sink->u.buffer.buf + sink->u.buffer.len, str, len);
+    sink->u.buffer.len += len;
+    if (sink->u.buffer.len < sink->u.buffer.size) {
+        sink->u.buffer.buf[sink->u.buffer.len] = '\0';
+    }
+    return true;
+}
+
+// }}} Stock write callbacks
+
+// {{{ Constructors & Destructors
+
+struct handlebars_sink * handlebars_sink_ctor(
+    struct handlebars_context * ctx,
+    handlebars_sink_write_func write,
+    void * write_ctx
+) {
+    struct handlebars_sink * sink = handlebars_talloc_zero(ctx, struct handlebars_sink);
+    HANDLEBARS_MEMCHECK(sink, ctx);
+    sink->write = write;
+    sink->write_ctx = write_ctx;
+    sink->chunk_size = HANDLEBARS_SINK_CHUNK_SIZE;
+    return sink;
+}
+
+struct handlebars_sink * handlebars_sink_file_ctor(struct handlebars_context * ctx, FILE * fp)
+{
+    struct handlebars_sink * sink = handlebars_sink_ctor(ctx, sink_file_write, NULL);
+    sink->write_ctx = sink;
+    sink->u.fp = fp;
+    return sink;
+}
+
+struct handlebars_sink * handlebars_sink_fd_ctor(struct handlebars_context * ctx, int fd)
+{
+    struct handlebars_sink * sink = handlebars_sink_ctor(ctx, sink_fd_write, NULL);
+    sink->write_ctx = sink;
+    sink->u.fd = fd;
+    return sink;
+}
+
+struct handlebars_sink * handlebars_sink_buffer_ctor(struct handlebars_context * ctx, char * buf, size_t size)
+{
+    struct handlebars_sink * sink = handlebars_sink_ctor(ctx, sink_buffer_write, NULL);
+    sink->write_ctx = sink;
+    sink->u.buffer.buf = buf;
+    sink->u.buffer.size = size;
+    if (size > 0) {
+        buf[0] = '\0';
+    }
+    return sink;
+}
+
+void handlebars_sink_dtor(struct handlebars_sink * sink)
+{
+    handlebars_talloc_free(sink);
+}
+
+// }}} Constructors & Destructors
+
+// {{{ Getters & Setters
+
+void handlebars_sink_set_chunk_size(struct handlebars_sink * sink, size_t chunk_size)
+{
+    sink->chunk_size = chunk_size;
+}
+
+size_t handlebars_sink_get_chunk_size(struct handlebars_sink * sink)
+{
+    return sink->chunk_size;
+}
+
+size_t handlebars_sink_get_written(struct handlebars_sink * sink)
+{
+    return sink->written;
+}
+
+// }}} Getters & Setters
+
+bool handlebars_sink_write(struct handlebars_sink * sink, const char * str, size_t len)
+{
+    if (len == 0) {
+        return true;
+    }
+    if (!sink->write(sink->write_ctx, str, len)) {
+        return false;
+    }
+    sink->written += len;
+    return true;
+}
@@ -0,0 +1,145 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HANDLEBARS_SINK_H
+#define HANDLEBARS_SINK_H
+
+#include <stdio.h>
+
+#include "handlebars.h"
+
+HBS_EXTERN_C_START
+
+struct handlebars_context;
+struct handlebars_sink;
+
+#ifndef HANDLEBARS_SINK_CHUNK_SIZE
+#define HANDLEBARS_SINK_CHUNK_SIZE 8192
+#endif
+
+/**
+ * @brief Write callback for a sink. Must write all of the given bytes.
+ * @param[in] write_ctx The user data given to #handlebars_sink_ctor
+ * @param[in] str The bytes to write
+ * @param[in] len The number of bytes to write
+ * @return false on failure
+ */
+typedef bool (*handlebars_sink_write_func)(void * write_ctx, const char * str, size_t len);
+
+/**
+ * @brief Construct a sink that passes output to a write callback
+ * @param[in] ctx The parent handlebars context
+ * @param[in] write The write callback
+ * @param[in] write_ctx User data passed to the write callback
+ * @return The sink
+ */
+struct handlebars_sink * handlebars_sink_ctor(
+    struct handlebars_context * ctx,
+    handlebars_sink_write_func write,
+    void * write_ctx
+) HBS_ATTR_NONNULL(1, 2) HBS_ATTR_RETURNS_NONNULL HBS_ATTR_WARN_UNUSED_RESULT;
+
+/**
+ * @brief Construct a sink that writes to a stdio stream. The stream is not flushed or closed.
+ * @param[in] ctx The parent handlebars context
+ * @param[in] fp The stream
+ * @return The sink
+ */
+struct handlebars_sink * handlebars_sink_file_ctor(
+    struct handlebars_context * ctx,
+    FILE * fp
+) HBS_ATTR_NONNULL_ALL HBS_ATTR_RETURNS_NONNULL HBS_ATTR_WARN_UNUSED_RESULT;
+
+/**
+ * @brief Construct a sink that writes to a file descriptor. The descriptor is not closed.
+ * @param[in] ctx The parent handlebars context
+ * @param[in] fd The file descriptor
+ * @return The sink
+ */
+struct handlebars_sink * handlebars_sink_fd_ctor(
+    struct handlebars_context * ctx,
+    int fd
+) HBS_ATTR_NONNULL_ALL HBS_ATTR_RETURNS_NONNULL HBS_ATTR_WARN_UNUSED_RESULT;
+
+/**
+ * @brief Construct a sink that writes into a caller-supplied fixed size buffer. Writes that do not fit fail.
+ *        The output is NUL-terminated if there is room left in the buffer.
+ * @param[in] ctx The parent handlebars context
+ * @param[in] buf The buffer
+ * @param[in] size The size of the buffer
+ * @return The sink
+ */
+struct handlebars_sink * handlebars_sink_buffer_ctor(
+    struct handlebars_context * ctx,
+    char * buf,
+    size_t size
+) HBS_ATTR_NONNULL_ALL HBS_ATTR_RETURNS_NONNULL HBS_ATTR_WARN_UNUSED_RESULT;
+
+/**
+ * @brief Destruct a sink
+ * @param[in] sink The sink
+ * @return void
+ */
+void handlebars_sink_dtor(
+    struct handlebars_sink * sink
+) HBS_ATTR_NONNULL_ALL;
+
+/**
+ * @brief Set the number of bytes the VM will buffer before passing them to the sink
+ * @param[in] sink The sink
+ * @param[in] chunk_size The chunk size, zero to write as soon as possible
+ * @return void
+ */
+void handlebars_sink_set_chunk_size(
+    struct handlebars_sink * sink,
+    size_t chunk_size
+) HBS_ATTR_NONNULL_ALL;
+
+/**
+ * @brief Get the number of bytes the VM will buffer before passing them to the sink
+ * @param[in] sink The sink
+ * @return The chunk size
+ */
+size_t handlebars_sink_get_chunk_size(
+    struct handlebars_sink * sink
+) HBS_ATTR_NONNULL_ALL HBS_ATTR_WARN_UNUSED_RESULT;
+
+/**
+ * @brief Get the total number of bytes written to the sink
+ * @param[in] sink The sink
+ * @return The number of bytes
+ */
+size_t handlebars_sink_get_written(
+    struct handlebars_sink * sink
+) HBS_ATTR_NONNULL_ALL HBS_ATTR_WARN_UNUSED_RESULT;
+
+/**
+ * @brief Write bytes to the sink
+ * @param[in] sink The sink
+ * @param[in] str The bytes to write
+ * @param[in] len The number of bytes to write
+ * @return false on failure
+ */
+bool handlebars_sink_write(
+    struct handlebars_sink * sink,
+    const char * str,
+    size_t len
+) HBS_ATTR_NONNULL_ALL HBS_ATTR_WARN_UNUSED_RESULT;
+
+HBS_EXTERN_C_END
+
+#endif /* HANDLEBARS_SINK_H */
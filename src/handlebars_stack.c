@@ -228,6 +228,7 @@ struct handlebars_value * handlebars_stack_pop(struct handlebars_stack * stack,
 
     --stack->i;
     struct handlebars_value * value = &stack->v[stack->i];
+    HANDLEBARS_VALUE_PROMOTE_CHILD(stack->ctx, value);
     handlebars_value_value(rv, value);
     handlebars_value_null(value);
     return rv;
@@ -239,6 +240,7 @@ struct handlebars_value * handlebars_stack_top(struct handlebars_stack * stack)
         return NULL;
     }
 
+    HANDLEBARS_VALUE_PROMOTE_CHILD(stack->ctx, &stack->v[stack->i - 1]);
     return &stack->v[stack->i - 1];
 }
 
@@ -248,6 +250,7 @@ struct handlebars_value * handlebars_stack_get(struct handlebars_stack * stack,
         return NULL;
     }
 
+    HANDLEBARS_VALUE_PROMOTE_CHILD(stack->ctx, &stack->v[offset]);
     return &stack->v[offset];
 }
 
@@ -21,12 +21,19 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <locale.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <memory.h>
 #include <talloc.h>
 
+#if defined(__x86_64__) && ((__GNUC__ >= 5) || defined(__clang__))
+#define HANDLEBARS_ESCAPE_X86 1
+#include <immintrin.h>
+#endif
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wswitch-default"
 
@@ -53,9 +60,19 @@ struct handlebars_string {
 #endif
     size_t len;
     uint32_t hash;
+    //! Properties of the content cached like the hash, cleared along with it when the content changes
+    uint8_t flags;
     char val[];
 };
 
+//! Whether the content has been scanned for characters to escape by #handlebars_string_htmlspecialchars
+#define HBS_STR_FLAG_ESCAPE_SCANNED (1 << 0)
+//! Whether the content contains any characters to escape, only valid if HBS_STR_FLAG_ESCAPE_SCANNED is set
+#define HBS_STR_FLAG_NEEDS_ESCAPE (1 << 1)
+//! Whether the string is an interned string. They are static, so they must not be passed to talloc, and shared by all
+//! threads, so their hash and flags are set in their initializer and never written
+#define HBS_STR_FLAG_INTERNED (1 << 2)
+
 struct htmlspecialchars_pair {
     const char * str;
     size_t len;
@@ -118,6 +135,11 @@ uint64_t handlebars_hash_xxh3(const char * str, size_t len)
     return XXH3_64bits_digest(&state);
 }
 
+uint64_t handlebars_hash_xxh3_seeded(const char * str, size_t len, uint64_t seed)
+{
+    return XXH3_64bits_withSeed(str, len, seed);
+}
+
 uint32_t handlebars_hash_xxh3low(const char * str, size_t len)
 {
     return (uint32_t) handlebars_hash_xxh3(str, len);
@@ -193,8 +215,39 @@ void handlebars_string_delref_ex(struct handlebars_string * string, const char *
 #define handlebars_string_delref(string) handlebars_string_delref_ex(string, #string, HBS_LOC)
 #endif
 
-static inline struct handlebars_string * separate_string(struct handlebars_string * string)
+static struct handlebars_string * copy_string(const void * parent, const struct handlebars_string * string);
+
+static inline bool is_interned(struct handlebars_string * string)
+{
+    return (string->flags & HBS_STR_FLAG_INTERNED) != 0;
+}
+
+static inline size_t string_capacity(struct handlebars_string * string)
+{
+    return is_interned(string) ? HBS_STR_SIZE(string->len) : talloc_get_size(string);
+}
+
+/**
+ * @brief Get a string that can be modified in place: the string itself, or a copy of it if it is shared
+ * @param[in] context The context to copy an interned string into, as they have no parent. May be NULL for functions
+ *                    that do not take one, in which case the copy is owned by its references only
+ * @param[in] string The string
+ * @return The string or its copy
+ */
+static inline struct handlebars_string * separate_string(struct handlebars_context * context, struct handlebars_string * string)
 {
+    if (handlebars_unlikely(is_interned(string))) {
+        if (context) {
+            return handlebars_string_copy_ctor(context, string);
+        }
+        string = copy_string(NULL, string);
+        if (handlebars_unlikely(string == NULL)) {
+            fprintf(stderr, "Out of memory while copying an interned string\n");
+            abort();
+        }
+        return string;
+    }
+
 #ifndef HANDLEBARS_NO_REFCOUNT
     if (handlebars_rc_refcount(&string->rc) > 1) {
         struct handlebars_string * prev_string = string;
@@ -219,6 +272,83 @@ void handlebars_string_immortalize(struct handlebars_string * string)
 }
 // }}} Reference Counting
 
+// {{{ Interning
+
+// Interned strings are not allocated, they are immortal so that they are never freed or modified in place. Their hash
+// is that of #handlebars_string_hash, and none of them needs escaping
+#define INTERNED_STRING_FLAGS (HBS_STR_FLAG_INTERNED | HBS_STR_FLAG_ESCAPE_SCANNED)
+#ifndef HANDLEBARS_NO_REFCOUNT
+#define INTERNED_STRING(name, str, hash_) \
+    static struct handlebars_string name = {.rc = {UINT8_MAX}, .len = sizeof(str) - 1, .hash = hash_, .flags = INTERNED_STRING_FLAGS, .val = str}
+#else
+#define INTERNED_STRING(name, str, hash_) \
+    static struct handlebars_string name = {.len = sizeof(str) - 1, .hash = hash_, .flags = INTERNED_STRING_FLAGS, .val = str}
+#endif
+
+INTERNED_STRING(interned_parent, "_parent", 0xd93feb3fU);
+INTERNED_STRING(interned_block_helper_missing, "blockHelperMissing", 0x2e4b3f81U);
+INTERNED_STRING(interned_each, "each", 0xf148d47eU);
+INTERNED_STRING(interned_first, "first", 0x16b0aa53U);
+INTERNED_STRING(interned_helper_missing, "helperMissing", 0xf36a99b2U);
+INTERNED_STRING(interned_if, "if", 0xf0620a15U);
+INTERNED_STRING(interned_include_zero, "includeZero", 0xc9b0b964U);
+INTERNED_STRING(interned_index, "index", 0x199f81e8U);
+INTERNED_STRING(interned_key, "key", 0x6b94ff6dU);
+INTERNED_STRING(interned_lambda, "lambda", 0x96d15e35U);
+INTERNED_STRING(interned_last, "last", 0x9ffc866fU);
+INTERNED_STRING(interned_log, "log", 0xf789a0fbU);
+INTERNED_STRING(interned_lookup, "lookup", 0xf162049dU);
+INTERNED_STRING(interned_partial_block, "partial-block", 0xaebfd996U);
+INTERNED_STRING(interned_root, "root", 0x9ae76577U);
+INTERNED_STRING(interned_unless, "unless", 0xfa088014U);
+INTERNED_STRING(interned_with, "with", 0xb1c9dfccU);
+
+struct handlebars_string * const HANDLEBARS_INTERNED_STRINGS[HANDLEBARS_INTERNED_COUNT] = {
+    [HANDLEBARS_INTERNED_PARENT] = &interned_parent,
+    [HANDLEBARS_INTERNED_BLOCK_HELPER_MISSING] = &interned_block_helper_missing,
+    [HANDLEBARS_INTERNED_EACH] = &interned_each,
+    [HANDLEBARS_INTERNED_FIRST] = &interned_first,
+    [HANDLEBARS_INTERNED_HELPER_MISSING] = &interned_helper_missing,
+    [HANDLEBARS_INTERNED_IF] = &interned_if,
+    [HANDLEBARS_INTERNED_INCLUDE_ZERO] = &interned_include_zero,
+    [HANDLEBARS_INTERNED_INDEX] = &interned_index,
+    [HANDLEBARS_INTERNED_KEY] = &interned_key,
+    [HANDLEBARS_INTERNED_LAMBDA] = &interned_lambda,
+    [HANDLEBARS_INTERNED_LAST] = &interned_last,
+    [HANDLEBARS_INTERNED_LOG] = &interned_log,
+    [HANDLEBARS_INTERNED_LOOKUP] = &interned_lookup,
+    [HANDLEBARS_INTERNED_PARTIAL_BLOCK] = &interned_partial_block,
+    [HANDLEBARS_INTERNED_ROOT] = &interned_root,
+    [HANDLEBARS_INTERNED_UNLESS] = &interned_unless,
+    [HANDLEBARS_INTERNED_WITH] = &interned_with,
+};
+
+struct handlebars_string * handlebars_string_intern_find(const char * str, size_t len)
+{
+    size_t i;
+    for (i = 0; i < HANDLEBARS_INTERNED_COUNT; i++) {
+        struct handlebars_string * string = HANDLEBARS_INTERNED_STRINGS[i];
+        if (string->len == len && string->val[0] == str[0] && 0 == memcmp(string->val, str, len)) {
+            return string;
+        }
+    }
+    return NULL;
+}
+
+struct handlebars_string * handlebars_string_intern(
+    struct handlebars_context * context,
+    const char * str,
+    size_t len
+) {
+    struct handlebars_string * string = handlebars_string_intern_find(str, len);
+    if (string) {
+        return string;
+    }
+    return handlebars_string_ctor(context, str, len);
+}
+
+// }}} Interning
+
 
 
 struct handlebars_string * handlebars_string_init(
@@ -258,29 +388,58 @@ struct handlebars_string * handlebars_string_ctor(
     return handlebars_string_ctor_ex(context, str, len, 0);
 }
 
-struct handlebars_string * handlebars_string_copy_ctor(
-    struct handlebars_context * context,
-    const struct handlebars_string * string
-) {
+static struct handlebars_string * copy_string(const void * parent, const struct handlebars_string * string)
+{
     size_t size = HBS_STR_SIZE(string->len);
-    struct handlebars_string * st = handlebars_talloc_size(context, size);
-    HANDLEBARS_MEMCHECK(st, context);
+    struct handlebars_string * st = handlebars_talloc_size(parent, size);
+    if (handlebars_unlikely(st == NULL)) {
+        return NULL;
+    }
     talloc_set_type(st, struct handlebars_string);
     memcpy(st, string, size);
+    st->flags &= ~HBS_STR_FLAG_INTERNED;
 #ifndef HANDLEBARS_NO_REFCOUNT
     handlebars_rc_init(&st->rc);
 #endif
     return st;
 }
 
+struct handlebars_string * handlebars_string_copy_ctor(
+    struct handlebars_context * context,
+    const struct handlebars_string * string
+) {
+    struct handlebars_string * st = copy_string(context, string);
+    HANDLEBARS_MEMCHECK(st, context);
+    return st;
+}
+
 struct handlebars_string * handlebars_string_extend(
     struct handlebars_context * context,
     struct handlebars_string * string,
     size_t len
 ) {
     size_t size = HBS_STR_SIZE(len);
-    if( size > talloc_get_size(string) ) {
-        string = separate_string(string);
+    if( size > string_capacity(string) ) {
+        string = separate_string(context, string);
+        string = (struct handlebars_string *) handlebars_talloc_realloc_size(context, string, size);
+        HANDLEBARS_MEMCHECK(string, context);
+        talloc_set_type(string, struct handlebars_string);
+    }
+    return string;
+}
+
+struct handlebars_string * handlebars_string_reserve(
+    struct handlebars_context * context,
+    struct handlebars_string * string,
+    size_t len
+) {
+    size_t size = HBS_STR_SIZE(len);
+    size_t capacity = string_capacity(string);
+    if( size > capacity ) {
+        if( size < capacity * 2 ) {
+            size = capacity * 2;
+        }
+        string = separate_string(context, string);
         string = (struct handlebars_string *) handlebars_talloc_realloc_size(context, string, size);
         HANDLEBARS_MEMCHECK(string, context);
         talloc_set_type(string, struct handlebars_string);
@@ -296,6 +455,7 @@ struct handlebars_string * handlebars_string_append_unsafe(
     string->len += len;
     string->val[string->len] = 0;
     string->hash = 0;
+    string->flags = 0;
     return string;
 }
 
@@ -304,8 +464,8 @@ struct handlebars_string * handlebars_string_append(
     struct handlebars_string * string,
     const char * str, size_t len
 ) {
-    string = separate_string(string);
-    string = handlebars_string_extend(context, string, string->len + len);
+    string = separate_string(context, string);
+    string = handlebars_string_reserve(context, string, string->len + len);
     string = handlebars_string_append_unsafe(string, str, len);
     return string;
 }
@@ -318,11 +478,200 @@ struct handlebars_string * handlebars_string_append_str(
     return handlebars_string_append(context, string, string2->val, string2->len);
 }
 
+// {{{ Numbers
+
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// Powers of ten used to scale a double to six significant digits, all exactly representable
+static const double scale_powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10};
+
+// The decades of the values printed by %g in fixed notation, from 1e-5 to 1e5
+static const double decades[] = {1e-5, 1e-4, 1e-3, 1e-2, 1e-1, 1e0, 1e1, 1e2, 1e3, 1e4, 1e5};
+
+/**
+ * @brief Write the decimal digits of an integer backwards, two at a time
+ * @param[in] end The address after the last digit
+ * @param[in] value The integer
+ * @return The address of the first digit
+ */
+static char * format_ulong(char * end, unsigned long value)
+{
+    while( value >= 100 ) {
+        end -= 2;
+        memcpy(end, &digit_pairs[(value % 100) * 2], 2);
+        value /= 100;
+    }
+
+    if( value >= 10 ) {
+        end -= 2;
+        memcpy(end, &digit_pairs[value * 2], 2);
+    } else {
+        *--end = (char) ('0' + value);
+    }
+
+    return end;
+}
+
+/**
+ * @brief Format a double like `%g` does, for the values printed in fixed notation. Six significant digits are
+ *        rounded to nearest by scaling with an exact power of ten. Values that need the exponent notation, are not
+ *        finite, or lie too close to a rounding tie for the scaled double to decide it, are left to snprintf.
+ * @param[in] buf The buffer, at least 16 bytes
+ * @param[in] value The double
+ * @return The length of the output, or 0 if the value was left to snprintf
+ */
+static size_t format_double(char * buf, double value)
+{
+    char digits[8];
+    char * p = buf;
+    double x = value < 0 ? -value : value;
+    double scaled;
+    double frac;
+    uint64_t bits;
+    unsigned long r;
+    int exponent;
+    int i;
+
+    // Zero, keeping the sign of negative zero
+    memcpy(&bits, &value, sizeof(bits));
+    if( bits >> 63 ) {
+        *p++ = '-';
+    }
+    if( x == 0 ) {
+        *p++ = '0';
+        return p - buf;
+    }
+
+    // Exponent notation, infinity and NaN
+    if( !(x >= 1e-5 && x < 1e6) ) {
+        return 0;
+    }
+
+    // Estimate the decimal exponent, it is corrected below if rounding carries into another digit
+    for( exponent = 5; exponent > -5 && x < decades[exponent + 5]; exponent-- );
+
+    scaled = x * scale_powers[5 - exponent];
+    r = (unsigned long) scaled;
+    frac = scaled - r;
+    if( frac > 0.5 - 1e-7 && frac < 0.5 + 1e-7 ) {
+        return 0;
+    }
+    if( frac > 0.5 ) {
+        r++;
+    }
+
+    if( r >= 1000000 ) {
+        r /= 10;
+        exponent++;
+    }
+    if( r < 100000 || r >= 1000000 || exponent < -4 || exponent >= 6 ) {
+        return 0;
+    }
+
+    format_ulong(digits + 6, r);
+
+    if( exponent >= 0 ) {
+        memcpy(p, digits, exponent + 1);
+        p += exponent + 1;
+        *p++ = '.';
+        memcpy(p, digits + exponent + 1, 5 - exponent);
+        p += 5 - exponent;
+    } else {
+        *p++ = '0';
+        *p++ = '.';
+        for( i = -1; i > exponent; i-- ) {
+            *p++ = '0';
+        }
+        memcpy(p, digits, 6);
+        p += 6;
+    }
+
+    // Strip trailing zeros and the decimal point
+    while( p[-1] == '0' ) {
+        p--;
+    }
+    if( p[-1] == '.' ) {
+        p--;
+    }
+
+    return p - buf;
+}
+
+static size_t normalize_decimal_point(char * buf, size_t len)
+{
+    // snprintf() uses the decimal separator of the locale, which may be longer than one byte
+    const char * point = localeconv()->decimal_point;
+    size_t point_len = strlen(point);
+    char * p;
+
+    if( point_len <= 0 || (point_len == 1 && *point == '.') ) {
+        return len;
+    }
+
+    p = strstr(buf, point);
+    if( p != NULL ) {
+        *p = '.';
+        memmove(p + 1, p + point_len, len - (p - buf) - point_len + 1);
+        len -= point_len - 1;
+    }
+
+    return len;
+}
+
+struct handlebars_string * handlebars_string_append_long(
+    struct handlebars_context * context,
+    struct handlebars_string * string,
+    long value
+) {
+    char buf[24];
+    char * end = buf + sizeof(buf);
+    char * p = format_ulong(end, value < 0 ? 0UL - (unsigned long) value : (unsigned long) value);
+
+    if( value < 0 ) {
+        *--p = '-';
+    }
+
+    return handlebars_string_append(context, string, p, end - p);
+}
+
+struct handlebars_string * handlebars_string_append_double(
+    struct handlebars_context * context,
+    struct handlebars_string * string,
+    double value
+) {
+    char buf[32];
+    size_t len = format_double(buf, value);
+
+    if( len <= 0 ) {
+        len = normalize_decimal_point(buf, snprintf(buf, sizeof(buf), "%g", value));
+    }
+
+    return handlebars_string_append(context, string, buf, len);
+}
+
+// }}} Numbers
+
 struct handlebars_string * handlebars_string_compact(struct handlebars_string * string) {
     size_t size = HBS_STR_SIZE(string->len);
-    if( talloc_get_size(string) > size ) {
-        string = separate_string(string);
-        string = (struct handlebars_string *) handlebars_talloc_realloc_size(NULL, string, size);
+    if( string_capacity(string) > size ) {
+        struct handlebars_string * compacted;
+        string = separate_string(NULL, string);
+        compacted = (struct handlebars_string *) handlebars_talloc_realloc_size(NULL, string, size);
+        // Shrinking is only an optimization, so if it fails the string is kept as is
+        if( likely(compacted != NULL) ) {
+            string = compacted;
+            talloc_set_type(string, struct handlebars_string);
+        }
     }
     return string;
 }
@@ -331,7 +680,9 @@ bool handlebars_string_eq(
     /*const*/ struct handlebars_string * string1,
     /*const*/ struct handlebars_string * string2
 ) {
-    if( string1->len != string2->len ) {
+    if( string1 == string2 ) {
+        return true;
+    } else if( string1->len != string2->len ) {
         return false;
     } else {
         return hbs_str_hash(string1) == hbs_str_hash(string2);
@@ -343,7 +694,7 @@ struct handlebars_string * handlebars_string_truncate(
     size_t start,
     size_t end
 ) {
-    string = separate_string(string);
+    string = separate_string(NULL, string);
 
     // Truncate right
     if (end < string->len) {
@@ -358,6 +709,7 @@ struct handlebars_string * handlebars_string_truncate(
 
     string->val[string->len] = 0;
     string->hash = 0;
+    string->flags = 0;
 
     return string;
 }
@@ -401,7 +753,7 @@ struct handlebars_string * handlebars_str_reduce(
         return string;
     }
 
-    string = separate_string(string);
+    string = separate_string(NULL, string);
 
     while( NULL != (tok = (char *) handlebars_strnstr(tok, string->len - (tok - string->val), search, search_len)) ) {
         memmove(tok, replacement, replacement_len);
@@ -417,6 +769,7 @@ struct handlebars_string * handlebars_str_reduce(
 
     assert(string->val[string->len] == 0);
     string->hash = 0;
+    string->flags = 0;
 
     return string;
 }
@@ -451,6 +804,7 @@ struct handlebars_string * handlebars_str_replace(
 
     assert(new_string->val[new_string->len] == 0);
     new_string->hash = 0;
+    new_string->flags = 0;
 
     new_string = handlebars_string_compact(new_string);
     return new_string;
@@ -504,6 +858,7 @@ struct handlebars_string * handlebars_string_addcslashes(struct handlebars_conte
 
     new_string->len = target - new_string->val;
     new_string->hash = 0;
+    new_string->flags = 0;
 
     return handlebars_string_compact(new_string);
 }
@@ -517,7 +872,7 @@ struct handlebars_string * handlebars_string_stripcslashes(struct handlebars_str
     size_t i;
     char numtmp[4];
 
-    string = separate_string(string);
+    string = separate_string(NULL, string);
 
     for( ; source < end; source++ ) {
         if( *source == '\\' && source + 1 < end ) {
@@ -572,6 +927,7 @@ struct handlebars_string * handlebars_string_stripcslashes(struct handlebars_str
 
     string->len = nlen;
     string->hash = 0;
+    string->flags = 0;
 
     return handlebars_string_compact(string);
 }
@@ -630,7 +986,7 @@ struct handlebars_string * handlebars_string_vasprintf_append(
     size_t len;
     size_t slen = string->len;
 
-    string = separate_string(string);
+    string = separate_string(context, string);
 
     // Calculate size
     va_copy(ap2, ap);
@@ -643,7 +999,7 @@ struct handlebars_string * handlebars_string_vasprintf_append(
     }
 
     // Resize
-    string = handlebars_string_extend(context, string, slen + len);
+    string = handlebars_string_reserve(context, string, slen + len);
 
     // Print
     va_copy(ap2, ap);
@@ -652,6 +1008,7 @@ struct handlebars_string * handlebars_string_vasprintf_append(
 
     string->len += len;
     string->hash = 0;
+    string->flags = 0;
 
     return string;
 }
@@ -660,6 +1017,131 @@ struct handlebars_string * handlebars_string_vasprintf_append(
 #pragma clang diagnostic pop
 #endif
 
+// {{{ Escaping
+
+// The characters escaped by htmlspecialchars are & " ' < > `. The scanners below find the next one of them 8, 16 or
+// 32 bytes at a time. & and ' as well as < and > only differ in one bit, so (c | 1) == '\'' and (c | 2) == '>' match
+// both of a pair with a single comparison
+
+#define SWAR_ONES UINT64_C(0x0101010101010101)
+#define SWAR_HIGHS UINT64_C(0x8080808080808080)
+
+static inline uint64_t swar_eq(uint64_t v, unsigned char c)
+{
+    uint64_t x = v ^ (SWAR_ONES * c);
+    return (x - SWAR_ONES) & ~x & SWAR_HIGHS;
+}
+
+static const char * escape_scan_swar(const char * p, const char * end)
+{
+    uint64_t v;
+
+    while (end - p >= 8) {
+        memcpy(&v, p, sizeof(v));
+        if (swar_eq(v | SWAR_ONES, '\'') | swar_eq(v | (SWAR_ONES * 2), '>') | swar_eq(v, '"') | swar_eq(v, '`')) {
+            break;
+        }
+        p += 8;
+    }
+
+    while (p < end && !htmlspecialchars[(unsigned char) *p].len) {
+        p++;
+    }
+
+    return p;
+}
+
+#ifdef HANDLEBARS_ESCAPE_X86
+static const char * escape_scan_sse2(const char * p, const char * end)
+{
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i two = _mm_set1_epi8(2);
+    const __m128i apos = _mm_set1_epi8('\'');
+    const __m128i gt = _mm_set1_epi8('>');
+    const __m128i quot = _mm_set1_epi8('"');
+    const __m128i grave = _mm_set1_epi8('`');
+    __m128i v;
+    __m128i m;
+    int mask;
+
+    while (end - p >= 16) {
+        v = _mm_loadu_si128((const __m128i *) p);
+        m = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(_mm_or_si128(v, one), apos), _mm_cmpeq_epi8(_mm_or_si128(v, two), gt)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, quot), _mm_cmpeq_epi8(v, grave))
+        );
+        mask = _mm_movemask_epi8(m);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+
+    return escape_scan_swar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char * escape_scan_avx2(const char * p, const char * end)
+{
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i two = _mm256_set1_epi8(2);
+    const __m256i apos = _mm256_set1_epi8('\'');
+    const __m256i gt = _mm256_set1_epi8('>');
+    const __m256i quot = _mm256_set1_epi8('"');
+    const __m256i grave = _mm256_set1_epi8('`');
+    __m256i v;
+    __m256i m;
+    unsigned int mask;
+
+    while (end - p >= 32) {
+        v = _mm256_loadu_si256((const __m256i *) p);
+        m = _mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_cmpeq_epi8(_mm256_or_si256(v, one), apos),
+                _mm256_cmpeq_epi8(_mm256_or_si256(v, two), gt)
+            ),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, quot), _mm256_cmpeq_epi8(v, grave))
+        );
+        mask = (unsigned int) _mm256_movemask_epi8(m);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+
+    return escape_scan_sse2(p, end);
+}
+#endif
+
+/**
+ * @brief Find the next character that has to be escaped by htmlspecialchars
+ * @param[in] p The start of the input
+ * @param[in] end The end of the input
+ * @return The address of the character, or end if there is none
+ */
+static inline const char * escape_scan(const char * p, const char * end)
+{
+#ifdef HANDLEBARS_ESCAPE_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return escape_scan_avx2(p, end);
+    }
+    return escape_scan_sse2(p, end);
+#else
+    return escape_scan_swar(p, end);
+#endif
+}
+
+bool hbs_str_needs_escape(struct handlebars_string * str)
+{
+    if (!(str->flags & HBS_STR_FLAG_ESCAPE_SCANNED)) {
+        str->flags |= HBS_STR_FLAG_ESCAPE_SCANNED;
+        if (escape_scan(str->val, str->val + str->len) != str->val + str->len) {
+            str->flags |= HBS_STR_FLAG_NEEDS_ESCAPE;
+        }
+    }
+    return (str->flags & HBS_STR_FLAG_NEEDS_ESCAPE) != 0;
+}
+
 struct handlebars_string * handlebars_string_htmlspecialchars(
     struct handlebars_context * context,
     const char * str, size_t len
@@ -675,45 +1157,55 @@ struct handlebars_string * handlebars_string_htmlspecialchars_append(
     const char * str, size_t len
 ) {
     size_t new_len = len;
+    const char * end = str + len;
     const char * p;
-    const char * end;
+    const char * run;
     const struct htmlspecialchars_pair * pair;
+    char * out;
 
     if( len <= 0 ) {
         return string;
     }
 
-    string = separate_string(string);
-
-    // Calculate new size
-    for( p = str + len - 1; p >= str; p-- ) {
-        pair = &htmlspecialchars[(unsigned char) *p];
-        if( pair->len ) {
-            new_len += pair->len - 1;
-        }
+    // If there is nothing to escape, just append
+    p = escape_scan(str, end);
+    if( p == end ) {
+        return handlebars_string_append(context, string, str, len);
     }
 
-    // If new len is equal to len, nothing to escape, just append
-    if( new_len == len ) {
-        return handlebars_string_append(context, string, str, len);
+    // Calculate new size
+    for( run = p; run < end; run = escape_scan(run + 1, end) ) {
+        new_len += htmlspecialchars[(unsigned char) *run].len - 1;
     }
 
     // Realloc original buffer
-    string = handlebars_string_extend(context, string, string->len + new_len);
-
-    // Copy
-    for( p = str, end = str + len; p < end; p++ ) {
+    string = separate_string(context, string);
+    string = handlebars_string_reserve(context, string, string->len + new_len);
+
+    // Copy the runs between the characters to escape in bulk
+    out = string->val + string->len;
+    memcpy(out, str, p - str);
+    out += p - str;
+    while( p < end ) {
         pair = &htmlspecialchars[(unsigned char) *p];
-        if( pair->len ) {
-            string = handlebars_string_append_unsafe(string, pair->str, pair->len);
-        } else {
-            string = handlebars_string_append_unsafe(string, p, 1);
-        }
+        memcpy(out, pair->str, pair->len);
+        out += pair->len;
+        run = p + 1;
+        p = escape_scan(run, end);
+        memcpy(out, run, p - run);
+        out += p - run;
     }
 
+    string->len += new_len;
+    string->val[string->len] = 0;
+    string->hash = 0;
+    string->flags = 0;
+
     return string;
 }
 
+// }}} Escaping
+
 struct handlebars_string * handlebars_string_implode(
     struct handlebars_context * context,
     const char * sep,
@@ -762,6 +1254,31 @@ struct handlebars_string * handlebars_string_indent(
     return handlebars_string_indent_append(context, new_string, string, indent_str);
 }
 
+/**
+ * @brief Count the lines of text to indent. A trailing newline does not start another line, and empty text has none.
+ * @param[in] str The text
+ * @param[in] len The length of the text
+ * @return The number of lines
+ */
+static size_t indent_count_lines(const char * str, size_t len)
+{
+    const char * end;
+    const char * eol;
+    size_t lines = 1;
+
+    if( len <= 0 ) {
+        return 0;
+    }
+
+    end = str + len - (str[len - 1] == '\n');
+    while( str < end && NULL != (eol = memchr(str, '\n', end - str)) ) {
+        lines++;
+        str = eol + 1;
+    }
+
+    return lines;
+}
+
 struct handlebars_string * handlebars_string_indent_append(
     struct handlebars_context * context,
     struct handlebars_string * append_to_string,
@@ -769,34 +1286,85 @@ struct handlebars_string * handlebars_string_indent_append(
     const struct handlebars_string * indent_str
 ) {
     const char * str = input_string->val;
-    size_t str_len = input_string->len;
-    bool endsInLine = (str[str_len - 1] == '\n');
-    size_t i;
-    char tmp[2] = "\0";
+    const char * end = str + input_string->len;
+    const char * eol;
+    size_t lines = indent_count_lines(str, input_string->len);
+    char * out;
+
+    if( lines > 0 ) {
+        append_to_string = separate_string(context, append_to_string);
+        append_to_string = handlebars_string_reserve(context, append_to_string, append_to_string->len + input_string->len + lines * indent_str->len);
+
+        // Copy whole lines, each preceded by the indent
+        out = append_to_string->val + append_to_string->len;
+        while( lines-- > 0 ) {
+            memcpy(out, indent_str->val, indent_str->len);
+            out += indent_str->len;
+            eol = lines > 0 ? (const char *) memchr(str, '\n', end - str) + 1 : end;
+            memcpy(out, str, eol - str);
+            out += eol - str;
+            str = eol;
+        }
 
-    if( endsInLine ) {
-        str_len--;
+        append_to_string->len = out - append_to_string->val;
+        append_to_string->val[append_to_string->len] = 0;
+        append_to_string->hash = 0;
+        append_to_string->flags = 0;
     }
 
-    append_to_string = handlebars_string_append_str(context, append_to_string, indent_str);
+    handlebars_string_delref(input_string);
 
-    for( i = 0; i < str_len; i++ ) {
-        if( str[i] == '\n' ) {
-            append_to_string = handlebars_string_append(context, append_to_string, HBS_STRL("\n"));
-            append_to_string = handlebars_string_append_str(context, append_to_string, indent_str);
-        } else {
-            tmp[0] = str[i];
-            append_to_string = handlebars_string_append(context, append_to_string, tmp, 1);
-        }
+    return append_to_string;
+}
+
+struct handlebars_string * handlebars_string_indent_from(
+    struct handlebars_context * context,
+    struct handlebars_string * string,
+    size_t offset,
+    const struct handlebars_string * indent_str
+) {
+    size_t lines;
+    size_t grow;
+    const char * start;
+    const char * src;
+    char * dst;
+    const char * line;
+
+    if( offset >= string->len ) {
+        return string;
     }
 
-    if( endsInLine ) {
-        append_to_string = handlebars_string_append(context, append_to_string, HBS_STRL("\n"));
+    lines = indent_count_lines(string->val + offset, string->len - offset);
+    grow = lines * indent_str->len;
+    string = separate_string(context, string);
+    string = handlebars_string_reserve(context, string, string->len + grow);
+
+    // Move the lines into place starting from the last one, so that none is overwritten before it has been moved. The
+    // last line keeps its trailing newline, if any
+    start = string->val + offset;
+    src = string->val + string->len;
+    dst = (char *) src + grow;
+    *dst = 0;
+    line = src - (src[-1] == '\n');
+    while( lines-- > 0 ) {
+        while( line > start && line[-1] != '\n' ) {
+            line--;
+        }
+        dst -= src - line;
+        memmove(dst, line, src - line);
+        dst -= indent_str->len;
+        memcpy(dst, indent_str->val, indent_str->len);
+        src = line;
+        // The previous line ends with the newline before this one
+        line = src - 1;
     }
+    assert(dst == start);
 
-    handlebars_string_delref(input_string);
+    string->len += grow;
+    string->hash = 0;
+    string->flags = 0;
 
-    return append_to_string;
+    return string;
 }
 
 struct handlebars_string * handlebars_string_ltrim(struct handlebars_string * string, const char * what, size_t what_length)
@@ -811,7 +1379,7 @@ struct handlebars_string * handlebars_string_ltrim(struct handlebars_string * st
         return string;
     }
 
-    string = separate_string(string);
+    string = separate_string(NULL, string);
 
     // Make char mask
     memset(flags, 0, sizeof(flags));
@@ -827,6 +1395,8 @@ struct handlebars_string * handlebars_string_ltrim(struct handlebars_string * st
 
     if( ptr > string->val ) {
         memmove(string->val, ptr, string->len + 1);
+        string->hash = 0;
+        string->flags = 0;
     }
 
     return string;
@@ -844,7 +1414,7 @@ struct handlebars_string * handlebars_string_rtrim(struct handlebars_string * st
         return string;
     }
 
-    string = separate_string(string);
+    string = separate_string(NULL, string);
 
     // Make char mask
     memset(flags, 0, sizeof(flags));
@@ -856,6 +1426,8 @@ struct handlebars_string * handlebars_string_rtrim(struct handlebars_string * st
     while( original > string->val && flags[(unsigned char) *--original] ) {
         --string->len;
         *original = '\0';
+        string->hash = 0;
+        string->flags = 0;
     }
 
     return string;
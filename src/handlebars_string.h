@@ -41,6 +41,15 @@ size_t hbs_str_len(struct handlebars_string * str)
 
 uint32_t hbs_str_hash(struct handlebars_string * str)
     HBS_ATTR_NONNULL_ALL;
+
+/**
+ * @brief Check whether a string contains any characters escaped by #handlebars_string_htmlspecialchars. The result
+ *        is cached in the string like its hash, until the string is modified.
+ * @param[in] str The string
+ * @return Whether the string needs escaping
+ */
+bool hbs_str_needs_escape(struct handlebars_string * str)
+    HBS_ATTR_NONNULL_ALL;
 // }}} Accessors
 
 // {{{ Hash functions
@@ -53,6 +62,17 @@ uint32_t handlebars_hash_djbx33a(const char * str, size_t len)
 uint64_t handlebars_hash_xxh3(const char * str, size_t len)
     HBS_ATTR_NONNULL_ALL;
 
+/**
+ * @brief Hash a buffer with XXH3 and a seed. Unlike #handlebars_string_hash, the result is not stable across
+ *        processes unless the seed is.
+ * @param[in] str The buffer
+ * @param[in] len The length of the buffer
+ * @param[in] seed The seed
+ * @return The hash
+ */
+uint64_t handlebars_hash_xxh3_seeded(const char * str, size_t len, uint64_t seed)
+    HBS_ATTR_NONNULL_ALL;
+
 uint32_t handlebars_hash_xxh3low(const char * str, size_t len)
     HBS_ATTR_NONNULL_ALL;
 
@@ -78,6 +98,64 @@ void handlebars_string_immortalize(struct handlebars_string * string)
 #endif
 // }}} Reference Counting
 
+// {{{ Interning
+/**
+ * @brief Well-known names, which have a canonical, immortal string that is shared by all contexts. Interned strings
+ *        are never modified, and compare equal by pointer. Their hash is precomputed, so they can be shared by
+ *        threads, and the functions that modify a string return a copy of them.
+ */
+enum handlebars_interned_string {
+    HANDLEBARS_INTERNED_PARENT = 0,
+    HANDLEBARS_INTERNED_BLOCK_HELPER_MISSING,
+    HANDLEBARS_INTERNED_EACH,
+    HANDLEBARS_INTERNED_FIRST,
+    HANDLEBARS_INTERNED_HELPER_MISSING,
+    HANDLEBARS_INTERNED_IF,
+    HANDLEBARS_INTERNED_INCLUDE_ZERO,
+    HANDLEBARS_INTERNED_INDEX,
+    HANDLEBARS_INTERNED_KEY,
+    HANDLEBARS_INTERNED_LAMBDA,
+    HANDLEBARS_INTERNED_LAST,
+    HANDLEBARS_INTERNED_LOG,
+    HANDLEBARS_INTERNED_LOOKUP,
+    HANDLEBARS_INTERNED_PARTIAL_BLOCK,
+    HANDLEBARS_INTERNED_ROOT,
+    HANDLEBARS_INTERNED_UNLESS,
+    HANDLEBARS_INTERNED_WITH,
+    HANDLEBARS_INTERNED_COUNT
+};
+
+extern struct handlebars_string * const HANDLEBARS_INTERNED_STRINGS[HANDLEBARS_INTERNED_COUNT];
+
+//! The interned string of a well-known name, e.g. `HBS_INTERNED_STR(HELPER_MISSING)`
+#define HBS_INTERNED_STR(name) (HANDLEBARS_INTERNED_STRINGS[HANDLEBARS_INTERNED_ ## name])
+
+/**
+ * @brief Find the interned string for a name
+ * @param[in] str
+ * @param[in] len
+ * @return The interned string, or NULL if the name is not well-known
+ */
+struct handlebars_string * handlebars_string_intern_find(
+    const char * str,
+    size_t len
+) HBS_ATTR_NONNULL_ALL;
+
+/**
+ * @brief Get the interned string for a name if it is well-known, otherwise construct a new string. Use for names
+ *        that are looked up or used as keys, and never modified.
+ * @param[in] context
+ * @param[in] str
+ * @param[in] len
+ * @return The interned or newly constructed string
+ */
+struct handlebars_string * handlebars_string_intern(
+    struct handlebars_context * context,
+    const char * str,
+    size_t len
+) HBS_ATTR_NONNULL_ALL HBS_ATTR_RETURNS_NONNULL HBS_ATTR_WARN_UNUSED_RESULT;
+// }}} Interning
+
 /**
  * @brief Implements `strnstr`
  * @param[in] haystack
@@ -269,6 +347,22 @@ struct handlebars_string * handlebars_string_indent_append(
     const struct handlebars_string * indent_str
 ) HBS_ATTR_NONNULL_ALL HBS_ATTR_RETURNS_NONNULL HBS_ATTR_WARN_UNUSED_RESULT;
 
+/**
+ * @brief Indent all text of a string after the given offset, in place. Like #handlebars_string_indent, empty text and
+ *        the end of a trailing newline are not indented.
+ * @param[in] context The handlebars context
+ * @param[in] string The string
+ * @param[in] offset The offset of the text to indent
+ * @param[in] indent_str The indent
+ * @return The original string, unless moved by reallocation
+ */
+struct handlebars_string * handlebars_string_indent_from(
+    struct handlebars_context * context,
+    struct handlebars_string * string,
+    size_t offset,
+    const struct handlebars_string * indent_str
+) HBS_ATTR_NONNULL_ALL HBS_ATTR_RETURNS_NONNULL HBS_ATTR_WARN_UNUSED_RESULT;
+
 /**
  * @brief Trims a set of characters off the left end of string. Trims in
  *        place by setting a null terminator and moving the contents
@@ -357,6 +451,22 @@ struct handlebars_string * handlebars_string_extend(
     size_t len
 ) HBS_ATTR_NONNULL_ALL HBS_ATTR_RETURNS_NONNULL HBS_ATTR_WARN_UNUSED_RESULT;
 
+/**
+ * @brief Reserve room for the specified length in a string that is built by appending to it. Unlike
+ *        #handlebars_string_extend, the buffer grows geometrically, so building a string by repeated appends takes
+ *        amortized linear time. The appending functions reserve with this, and the capacity is the size of the
+ *        allocation. A string that is kept once built should be shrunk to fit with #handlebars_string_compact.
+ * @param[in] context
+ * @param[in] string
+ * @param[in] len The desired total length of the string, no less than the current length
+ * @return The original string, unless moved by reallocation
+ */
+struct handlebars_string * handlebars_string_reserve(
+    struct handlebars_context * context,
+    struct handlebars_string * string,
+    size_t len
+) HBS_ATTR_NONNULL_ALL HBS_ATTR_RETURNS_NONNULL HBS_ATTR_WARN_UNUSED_RESULT;
+
 /**
  * @brief Append to a string without checking length or reallocating
  * @param[in] string
@@ -396,6 +506,33 @@ struct handlebars_string * handlebars_string_append_str(
     const struct handlebars_string * string2
 ) HBS_ATTR_NONNULL_ALL HBS_ATTR_RETURNS_NONNULL HBS_ATTR_WARN_UNUSED_RESULT;
 
+/**
+ * @brief Append the decimal representation of an integer, as printed by `%ld`
+ * @param[in] context
+ * @param[in] string
+ * @param[in] value
+ * @return The original string, unless moved by reallocation
+ */
+struct handlebars_string * handlebars_string_append_long(
+    struct handlebars_context * context,
+    struct handlebars_string * string,
+    long value
+) HBS_ATTR_NONNULL_ALL HBS_ATTR_RETURNS_NONNULL HBS_ATTR_WARN_UNUSED_RESULT;
+
+/**
+ * @brief Append the representation of a double as printed by `%g`. Unlike `%g`, the decimal separator is always a
+ *        period, regardless of the locale.
+ * @param[in] context
+ * @param[in] string
+ * @param[in] value
+ * @return The original string, unless moved by reallocation
+ */
+struct handlebars_string * handlebars_string_append_double(
+    struct handlebars_context * context,
+    struct handlebars_string * string,
+    double value
+) HBS_ATTR_NONNULL_ALL HBS_ATTR_RETURNS_NONNULL HBS_ATTR_WARN_UNUSED_RESULT;
+
 /**
  * @brief Resize a string buffer to match the size of it's contents
  * @param[in] string
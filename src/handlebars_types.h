@@ -106,6 +106,9 @@ struct handlebars_options {
     struct handlebars_value * scope;
     struct handlebars_value * data;
     struct handlebars_value * hash;
+    //! Set by the VM when a builtin block helper is called in an append position. The helper may then write the
+    //! output of its programs directly into the VM's output buffer and leave the return value empty.
+    bool direct_output;
 };
 
 // }}} options
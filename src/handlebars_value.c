@@ -81,7 +81,9 @@ void handlebars_value_dtor(struct handlebars_value * value)
             handlebars_map_delref(value->v.map);
             break;
         case HANDLEBARS_VALUE_TYPE_STRING:
-            handlebars_string_delref(value->v.string);
+            if (!value->inline_len) {
+                handlebars_string_delref(value->v.string);
+            }
             break;
         case HANDLEBARS_VALUE_TYPE_USER:
             handlebars_user_delref(value->v.user);
@@ -99,6 +101,7 @@ void handlebars_value_dtor(struct handlebars_value * value)
 
     // Initialize to null
     value->type = HANDLEBARS_VALUE_TYPE_NULL;
+    value->inline_len = 0;
     memset(&value->v, 0, sizeof(value->v));
 
 #ifdef HANDLEBARS_HAVE_VALGRIND
@@ -190,12 +193,32 @@ struct handlebars_stack * handlebars_value_get_stack(struct handlebars_value * v
 struct handlebars_string * handlebars_value_get_string(struct handlebars_value * value)
 {
     if (value->type == HANDLEBARS_VALUE_TYPE_STRING) {
+        // Only children of maps and arrays are inline, and they are moved into a string before they are handed out
+        assert(!value->inline_len);
         return value->v.string;
     } else {
         return NULL;
     }
 }
 
+struct handlebars_string * handlebars_value_get_string_ex(
+    struct handlebars_context * context,
+    struct handlebars_value * value
+) {
+    if (value->type != HANDLEBARS_VALUE_TYPE_STRING) {
+        return NULL;
+    }
+
+    if (value->inline_len) {
+        struct handlebars_string * string = handlebars_string_ctor(context, value->v.strval, value->inline_len - 1);
+        handlebars_string_addref(string);
+        value->inline_len = 0;
+        value->v.string = string;
+    }
+
+    return value->v.string;
+}
+
 struct handlebars_user * handlebars_value_get_user(struct handlebars_value * value)
 {
     if (value->type == HANDLEBARS_VALUE_TYPE_USER) {
@@ -217,7 +240,7 @@ struct handlebars_closure * handlebars_value_get_closure(struct handlebars_value
 const char * handlebars_value_get_strval(struct handlebars_value * value)
 {
     if( value->type == HANDLEBARS_VALUE_TYPE_STRING ) {
-        return hbs_str_val(value->v.string);
+        return value->inline_len ? value->v.strval : hbs_str_val(value->v.string);
     } else {
         return NULL;
     }
@@ -226,7 +249,7 @@ const char * handlebars_value_get_strval(struct handlebars_value * value)
 size_t handlebars_value_get_strlen(struct handlebars_value * value)
 {
 	if( value->type == HANDLEBARS_VALUE_TYPE_STRING ) {
-		return hbs_str_len(value->v.string);
+		return value->inline_len ? value->inline_len - 1u : hbs_str_len(value->v.string);
 	}
 
 	return 0;
@@ -246,7 +269,7 @@ bool handlebars_value_get_boolval(struct handlebars_value * value)
         case HANDLEBARS_VALUE_TYPE_INTEGER:
             return value->v.lval != 0;
         case HANDLEBARS_VALUE_TYPE_STRING:
-            return hbs_str_len(value->v.string) != 0 && strcmp(hbs_str_val(value->v.string), "0") != 0;
+            return handlebars_value_get_strlen(value) != 0 && strcmp(handlebars_value_get_strval(value), "0") != 0;
         case HANDLEBARS_VALUE_TYPE_ARRAY:
             return handlebars_stack_count(value->v.stack) != 0;
         case HANDLEBARS_VALUE_TYPE_MAP:
@@ -286,12 +309,15 @@ struct handlebars_string * handlebars_value_to_string(
 ) {
     switch( value->type ) {
         case HANDLEBARS_VALUE_TYPE_STRING:
+            if (value->inline_len) {
+                return handlebars_string_ctor(context, value->v.strval, value->inline_len - 1);
+            }
             handlebars_string_addref(value->v.string);
             return value->v.string;
         case HANDLEBARS_VALUE_TYPE_INTEGER:
-            return handlebars_string_asprintf(context, "%ld", value->v.lval);
+            return handlebars_string_append_long(context, handlebars_string_init(context, 20), value->v.lval);
         case HANDLEBARS_VALUE_TYPE_FLOAT:
-            return handlebars_string_asprintf(context, "%g", value->v.dval);
+            return handlebars_string_append_double(context, handlebars_string_init(context, 20), value->v.dval);
         case HANDLEBARS_VALUE_TYPE_TRUE:
             return handlebars_string_ctor(context, HBS_STRL("true"));
         case HANDLEBARS_VALUE_TYPE_FALSE:
@@ -342,7 +368,11 @@ bool handlebars_value_eq(
             return value->v.lval == value2->v.lval;
 
         case HANDLEBARS_VALUE_TYPE_STRING:
-            return value->v.string == value2->v.string || handlebars_string_eq(value->v.string, value2->v.string);
+            if (!value->inline_len && !value2->inline_len) {
+                return value->v.string == value2->v.string || handlebars_string_eq(value->v.string, value2->v.string);
+            }
+            return handlebars_value_get_strlen(value) == handlebars_value_get_strlen(value2) &&
+                0 == memcmp(handlebars_value_get_strval(value), handlebars_value_get_strval(value2), handlebars_value_get_strlen(value));
 
         // these only test pointer equality
         case HANDLEBARS_VALUE_TYPE_ARRAY:
@@ -390,15 +420,21 @@ struct handlebars_string * handlebars_value_expression_append(
             break;
 
         case HANDLEBARS_VALUE_TYPE_FLOAT:
-            string = handlebars_string_asprintf_append(context, string, "%g", value->v.dval);
+            string = handlebars_string_append_double(context, string, value->v.dval);
             break;
 
         case HANDLEBARS_VALUE_TYPE_INTEGER:
-            string = handlebars_string_asprintf_append(context, string, "%ld", value->v.lval);
+            string = handlebars_string_append_long(context, string, value->v.lval);
             break;
 
         case HANDLEBARS_VALUE_TYPE_STRING:
-            if( escape && !(value->flags & HANDLEBARS_VALUE_FLAG_SAFE_STRING) ) {
+            if( value->inline_len ) {
+                if( escape && !(value->flags & HANDLEBARS_VALUE_FLAG_SAFE_STRING) ) {
+                    string = handlebars_string_htmlspecialchars_append(context, string, value->v.strval, value->inline_len - 1);
+                } else {
+                    string = handlebars_string_append(context, string, value->v.strval, value->inline_len - 1);
+                }
+            } else if( escape && !(value->flags & HANDLEBARS_VALUE_FLAG_SAFE_STRING) && hbs_str_needs_escape(value->v.string) ) {
                 string = handlebars_string_htmlspecialchars_append(context, string, HBS_STR_STRL(value->v.string));
             } else {
                 string = handlebars_string_append_str(context, string, value->v.string);
@@ -468,6 +504,33 @@ void handlebars_value_str(struct handlebars_value * value, struct handlebars_str
     value->v.string = string;
 }
 
+void handlebars_value_strl(
+    struct handlebars_context * context,
+    struct handlebars_value * value,
+    const char * str,
+    size_t len
+) {
+    handlebars_value_str(value, handlebars_string_ctor(context, str, len));
+}
+
+void handlebars_value_child_strl(
+    struct handlebars_context * context,
+    struct handlebars_value * value,
+    const char * str,
+    size_t len
+) {
+    if( len > HANDLEBARS_VALUE_INLINE_STRLEN ) {
+        handlebars_value_str(value, handlebars_string_ctor(context, str, len));
+        return;
+    }
+
+    handlebars_value_null(value);
+    value->type = HANDLEBARS_VALUE_TYPE_STRING;
+    value->inline_len = len + 1;
+    memcpy(value->v.strval, str, len);
+    value->v.strval[len] = 0;
+}
+
 void handlebars_value_ptr(struct handlebars_value * value, struct handlebars_ptr * ptr)
 {
     handlebars_ptr_addref(ptr);
@@ -527,7 +590,9 @@ void handlebars_value_value(struct handlebars_value * dest, struct handlebars_va
             handlebars_map_addref(dest->v.map);
             break;
         case HANDLEBARS_VALUE_TYPE_STRING:
-            handlebars_string_addref(dest->v.string);
+            if (!dest->inline_len) {
+                handlebars_string_addref(dest->v.string);
+            }
             break;
         case HANDLEBARS_VALUE_TYPE_USER:
             handlebars_user_addref(dest->v.user);
@@ -661,7 +726,7 @@ struct handlebars_value * handlebars_value_map_str_find(struct handlebars_value
 
 	if( value->type == HANDLEBARS_VALUE_TYPE_USER ) {
 		if( handlebars_value_get_type(value) == HANDLEBARS_VALUE_TYPE_MAP ) {
-            struct handlebars_string * str = handlebars_string_ctor(value->v.user->ctx, key, len);
+            struct handlebars_string * str = handlebars_string_intern(value->v.user->ctx, key, len);
             handlebars_string_addref(str);
 			result = handlebars_value_get_handlers(value)->map_find(value, str, rv);
             handlebars_string_delref(str);
@@ -756,7 +821,7 @@ char * handlebars_value_dump(struct handlebars_value * value, struct handlebars_
             buf = handlebars_talloc_asprintf_append_buffer(buf, "integer(%ld)", value->v.lval);
             break;
         case HANDLEBARS_VALUE_TYPE_STRING:
-            buf = handlebars_talloc_asprintf_append_buffer(buf, "string(%.*s)", (int) hbs_str_len(value->v.string), hbs_str_val(value->v.string));
+            buf = handlebars_talloc_asprintf_append_buffer(buf, "string(%.*s)", (int) handlebars_value_get_strlen(value), handlebars_value_get_strval(value));
             break;
         case HANDLEBARS_VALUE_TYPE_ARRAY:
             buf = handlebars_talloc_asprintf_append_buffer(buf, "[%s", handlebars_value_count(value) ? "\n" : "");
@@ -239,6 +239,18 @@ struct handlebars_stack * handlebars_value_get_stack(struct handlebars_value * v
 struct handlebars_string * handlebars_value_get_string(struct handlebars_value * value)
     HBS_ATTR_NONNULL_ALL;
 
+/**
+ * @brief Get the string of a string value. A short string stored inline in a child of a map or array that was
+ *        not read through the map or array is first moved into a new string, which the value then holds.
+ * @param[in] context The handlebars context
+ * @param[in] value
+ * @return The string, or NULL for non-string types
+ */
+struct handlebars_string * handlebars_value_get_string_ex(
+    struct handlebars_context * context,
+    struct handlebars_value * value
+) HBS_ATTR_NONNULL_ALL;
+
 struct handlebars_user * handlebars_value_get_user(struct handlebars_value * value)
     HBS_ATTR_NONNULL_ALL;
 
@@ -394,6 +406,21 @@ void handlebars_value_float(struct handlebars_value * value, double dval) HBS_AT
  */
 void handlebars_value_str(struct handlebars_value * value, struct handlebars_string * string) HBS_ATTR_NONNULL_ALL;
 
+/**
+ * @brief Set the string value (buffer variant)
+ * @param[in] context The handlebars context
+ * @param[in] value
+ * @param[in] str
+ * @param[in] len
+ * @return void
+ */
+void handlebars_value_strl(
+    struct handlebars_context * context,
+    struct handlebars_value * value,
+    const char * str,
+    size_t len
+) HBS_ATTR_NONNULL_ALL;
+
 void handlebars_value_ptr(struct handlebars_value * value, struct handlebars_ptr * ptr) HBS_ATTR_NONNULL_ALL;
 
 void handlebars_value_user(struct handlebars_value * value, struct handlebars_user * user) HBS_ATTR_NONNULL_ALL;
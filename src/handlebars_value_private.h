@@ -50,6 +50,8 @@ union handlebars_value_internals
     handlebars_helper_func helper;
     struct handlebars_options * options;
     struct handlebars_closure * closure;
+    //! A short string stored in the value itself, NUL terminated. See #handlebars_value_child_strl
+    char strval[sizeof(double)];
 };
 
 //! Main value struct
@@ -61,6 +63,9 @@ struct handlebars_value
     //! Bitwise value flags from enum #handlebars_value_flags
     unsigned char flags;
 
+    //! The length of a string stored inline in v.strval plus one, or zero if the value is not an inline string
+    unsigned char inline_len;
+
     //! Internal value union
     union handlebars_value_internals v;
 };
@@ -68,6 +73,35 @@ struct handlebars_value
 #define HANDLEBARS_VALUE_SIZE sizeof(struct handlebars_value)
 #define HANDLEBARS_VALUE_INTERNALS_SIZE sizeof(union handlebars_value_internals)
 
+//! The maximum length of a string stored inline in a value
+#define HANDLEBARS_VALUE_INLINE_STRLEN (sizeof(((union handlebars_value_internals *) 0)->strval) - 1)
+
+//! Move a short string stored inline in a child of a map or array into a string allocated from the context of its
+//! container, before the child is handed out. See #handlebars_value_child_strl
+#define HANDLEBARS_VALUE_PROMOTE_CHILD(context, value) \
+    do { \
+        if (handlebars_unlikely((value)->inline_len)) { \
+            (void) handlebars_value_get_string_ex(context, value); \
+        } \
+    } while (0)
+
+/**
+ * @brief Set the string value (buffer variant) of a value that is about to be added to a map or array. Strings of up
+ *        to seven bytes are stored inline in the value and are not allocated. Maps and arrays move them into an
+ *        allocated string when the child is first read, so values outside of a map or array are never inline.
+ * @param[in] context The handlebars context
+ * @param[in] value
+ * @param[in] str
+ * @param[in] len
+ * @return void
+ */
+void handlebars_value_child_strl(
+    struct handlebars_context * context,
+    struct handlebars_value * value,
+    const char * str,
+    size_t len
+) HBS_ATTR_NONNULL_ALL;
+
 HBS_EXTERN_C_END
 
 #endif /* HANDLEBARS_VALUE_PRIVATE_H */
@@ -40,9 +40,11 @@
 #include "handlebars_map.h"
 #include "handlebars_parser.h"
 #include "handlebars_ptr.h"
+#include "handlebars_sink.h"
 #include "handlebars_opcodes.h"
 #include "handlebars_opcode_printer.h"
 #include "handlebars_opcode_serializer.h"
+#include "handlebars_overlay.h"
 #include "handlebars_stack.h"
 #include "handlebars_string.h"
 #include "handlebars_value.h"
@@ -70,7 +72,19 @@
 
 // {{{ Prototypes & Variables
 
-ACCEPT_FUNCTION(push_context);
+static struct handlebars_string * execute_module(
+    struct handlebars_vm * vm,
+    struct handlebars_module * module,
+    struct handlebars_value * context,
+    long program,
+    struct handlebars_value * data,
+    struct handlebars_value * block_params,
+    bool append
+) HBS_ATTR_NONNULL(1, 2, 3);
+
+static void partial_modules_clear(struct handlebars_vm * vm) HBS_ATTR_NONNULL_ALL;
+static struct handlebars_context * render_scope(struct handlebars_vm * vm) HBS_ATTR_NONNULL_ALL;
+static void render_scope_clear(struct handlebars_vm * vm) HBS_ATTR_NONNULL_ALL;
 
 const size_t HANDLEBARS_VM_SIZE = sizeof(struct handlebars_vm);
 
@@ -119,15 +133,19 @@ struct handlebars_vm * handlebars_vm_ctor(struct handlebars_context * ctx)
     handlebars_context_bind(ctx, HBSCTX(vm));
     handlebars_value_map(&vm->helpers, handlebars_map_ctor(ctx, 0));
     handlebars_value_map(&vm->partials, handlebars_map_ctor(ctx, 0));
+    handlebars_value_map(&vm->empty_hash, handlebars_map_ctor(HBSCTX(vm), 0));
+    vm->arena_size = HANDLEBARS_VM_ARENA_SIZE;
     return vm;
 }
 
 
 void handlebars_vm_dtor(struct handlebars_vm * vm)
 {
+    partial_modules_clear(vm);
     handlebars_value_dtor(&vm->helpers);
     handlebars_value_dtor(&vm->partials);
     handlebars_value_dtor(&vm->data);
+    handlebars_value_dtor(&vm->empty_hash);
     if (vm->delim_open) {
         handlebars_string_delref(vm->delim_open);
     }
@@ -137,6 +155,45 @@ void handlebars_vm_dtor(struct handlebars_vm * vm)
     handlebars_talloc_free(vm);
 }
 
+void handlebars_vm_reset(struct handlebars_vm * vm)
+{
+    // The data may be a replacement made in the arena by a block of the render, if it failed
+    if (vm->stack != NULL) {
+        vm->data = vm->render_data;
+    }
+
+    // An error thrown past the VM skips the restore at the end of execute_module, leaving it pointing into the
+    // stack frame of the failed render
+    vm->module = NULL;
+    vm->depth = 0;
+    vm->buffer = NULL;
+    vm->sink = NULL;
+    vm->sink_chunk_size = 0;
+    vm->buffer_pins = 0;
+    vm->last_helper = NULL;
+    vm->last_context = NULL;
+    vm->stack = NULL;
+    vm->contextStack = NULL;
+    vm->hashStack = NULL;
+    vm->blockParamStack = NULL;
+    vm->partialBlockStack = NULL;
+
+    if (vm->delim_open) {
+        handlebars_string_delref(vm->delim_open);
+        vm->delim_open = NULL;
+    }
+    if (vm->delim_close) {
+        handlebars_string_delref(vm->delim_close);
+        vm->delim_close = NULL;
+    }
+
+    // Free whatever a failed render left behind
+    render_scope_clear(vm);
+    partial_modules_clear(vm);
+
+    vm->helper_cache_generation++;
+}
+
 // }}} Constructors & Destructors
 
 // {{{ Getters & Setters
@@ -149,11 +206,13 @@ void handlebars_vm_set_flags(struct handlebars_vm * vm, unsigned long flags)
 void handlebars_vm_set_helpers(struct handlebars_vm * vm, struct handlebars_value * helpers)
 {
     handlebars_value_value(&vm->helpers, helpers);
+    vm->helper_cache_generation++;
 }
 
 void handlebars_vm_set_partials(struct handlebars_vm * vm, struct handlebars_value * partials)
 {
     handlebars_value_value(&vm->partials, partials);
+    vm->partial_modules_stale = true;
 }
 
 void handlebars_vm_set_data(struct handlebars_vm * vm, struct handlebars_value * data)
@@ -182,21 +241,110 @@ void * handlebars_vm_get_log_ctx(struct handlebars_vm * vm)
     return vm->log_ctx;
 }
 
+void handlebars_vm_set_arena_size(struct handlebars_vm * vm, size_t size)
+{
+    assert(vm->stack == NULL);
+
+    render_scope_clear(vm);
+    if (vm->arena) {
+        handlebars_talloc_free(vm->arena);
+        vm->arena = NULL;
+    }
+    vm->arena_size = size;
+}
+
+struct handlebars_context * handlebars_vm_get_arena(struct handlebars_vm * vm)
+{
+    // Outside of a render, nothing would free what is allocated in the arena so that it can be reused
+    if (vm->stack == NULL) {
+        return HBSCTX(vm);
+    } else if (vm->arena_size == 0) {
+        return render_scope(vm);
+    }
+
+    if (handlebars_unlikely(vm->arena == NULL)) {
+        vm->arena = talloc_pooled_object(render_scope(vm), struct handlebars_context, 0, vm->arena_size);
+        HANDLEBARS_MEMCHECK(vm->arena, HBSCTX(vm));
+        handlebars_context_bind(HBSCTX(vm), vm->arena);
+    }
+
+    return vm->arena;
+}
+
 // }}} Getters & Setters
 
-HBS_ATTR_NONNULL_ALL
+/**
+ * @brief Find the resolution of a helper name in the helper cache, resolving it if it is not there. Only used while
+ *        the helpers are a plain map, so the found helper can be referenced without copying it.
+ * @return The cache entry, or NULL if the name cannot be cached
+ */
+static inline struct handlebars_vm_helper_cache_entry * helper_cache_find(
+    struct handlebars_vm * vm,
+    struct handlebars_string * string
+) {
+    size_t len = hbs_str_len(string);
+    uint32_t hash;
+    struct handlebars_vm_helper_cache_entry * entry;
+
+    if( len > HANDLEBARS_VM_HELPER_CACHE_NAME_SIZE ) {
+        return NULL;
+    }
+
+    hash = hbs_str_hash(string);
+    entry = &vm->helper_cache[hash & (HANDLEBARS_VM_HELPER_CACHE_SIZE - 1)];
+
+    if( likely(entry->generation == vm->helper_cache_generation && entry->hash == hash && entry->len == len &&
+            0 == memcmp(entry->name, hbs_str_val(string), len)) ) {
+        return entry;
+    }
+
+    entry->generation = vm->helper_cache_generation;
+    entry->hash = hash;
+    entry->len = len;
+    memcpy(entry->name, hbs_str_val(string), len);
+    entry->helper = handlebars_map_find(handlebars_value_get_map(&vm->helpers), string);
+    entry->builtin = entry->helper ? NULL : handlebars_builtins_find(hbs_str_val(string), len);
+
+    return entry;
+}
+
+HBS_ATTR_NONNULL(1, 2, 3)
 static inline struct handlebars_value * lookup_helper(
     struct handlebars_vm * vm,
     struct handlebars_string * string,
-    struct handlebars_value * rv
+    struct handlebars_value * rv,
+    struct handlebars_options * options
 ) {
     HANDLEBARS_VALUE_DECL(rv2);
     struct handlebars_value * helper;
     handlebars_helper_func fn;
-    if( NULL != (helper = handlebars_value_map_find(&vm->helpers, string, rv2)) ) {
+    struct handlebars_vm_helper_cache_entry * entry = NULL;
+
+    if( vm->helpers.type == HANDLEBARS_VALUE_TYPE_MAP ) {
+        entry = helper_cache_find(vm, string);
+    }
+
+    if( entry ) {
+        helper = entry->helper;
+        fn = entry->builtin;
+        if( helper ) {
+            handlebars_value_value(rv, helper);
+        } else if( fn ) {
+            handlebars_value_helper(rv, fn);
+            if (options) {
+                options->direct_output = options->program >= 0 || options->inverse >= 0;
+            }
+        } else {
+            rv = NULL;
+        }
+    } else if( NULL != (helper = handlebars_value_map_find(&vm->helpers, string, rv2)) ) {
         handlebars_value_value(rv, helper);
     } else if( NULL != (fn = handlebars_builtins_find(hbs_str_val(string), hbs_str_len(string))) ) {
         handlebars_value_helper(rv, fn);
+        // Only builtins know how to write into the output buffer, and only block programs are written there
+        if (options) {
+            options->direct_output = options->program >= 0 || options->inverse >= 0;
+        }
     } else {
         rv = NULL;
     }
@@ -211,6 +359,7 @@ struct handlebars_value * handlebars_vm_call_helper_str(const char * name, unsig
     struct handlebars_value * helper;
     handlebars_helper_func fn;
     if( NULL != (helper = handlebars_value_map_str_find(&vm->helpers, name, len, rv2)) ) {
+        options->direct_output = false;
         rv = handlebars_value_call(helper, HANDLEBARS_HELPER_ARGS_PASSTHRU);
     } else if( NULL != (fn = handlebars_builtins_find(name, len)) ) {
         rv = fn(HANDLEBARS_HELPER_ARGS_PASSTHRU);
@@ -267,10 +416,28 @@ static inline void setup_options(struct handlebars_vm * vm, int argc, struct han
     HANDLEBARS_VALUE_ARRAY_UNDECL(argv, argc); \
     handlebars_options_deinit(&options)
 
+HBS_ATTR_NONNULL_ALL
+static void flush_buffer(struct handlebars_vm * vm)
+{
+    if (!handlebars_sink_write(vm->sink, hbs_str_val(vm->buffer), hbs_str_len(vm->buffer))) {
+        handlebars_throw(CONTEXT, HANDLEBARS_ERROR, "Failed to write to the output sink");
+    }
+    vm->buffer = handlebars_string_truncate(vm->buffer, 0, 0);
+}
+
+HBS_ATTR_NONNULL_ALL
+static inline void maybe_flush_buffer(struct handlebars_vm * vm)
+{
+    if (vm->sink && vm->buffer_pins == 0 && hbs_str_len(vm->buffer) >= vm->sink_chunk_size) {
+        flush_buffer(vm);
+    }
+}
+
 HBS_ATTR_NONNULL_ALL
 static inline void append_to_buffer(struct handlebars_vm * vm, struct handlebars_value * result, bool escape)
 {
     vm->buffer = handlebars_value_expression_append(CONTEXT, result, vm->buffer, escape);
+    maybe_flush_buffer(vm);
 }
 
 HBS_ATTR_NONNULL_ALL
@@ -306,105 +473,317 @@ static inline struct handlebars_value * merge_hash(struct handlebars_context * c
 {
     if( handlebars_value_get_type(input) == HANDLEBARS_VALUE_TYPE_MAP && handlebars_value_count(input) > 0 &&
             hash && handlebars_value_get_type(hash) == HANDLEBARS_VALUE_TYPE_MAP && handlebars_value_count(hash) > 0 ) {
-        struct handlebars_map * new_map = handlebars_map_ctor(context, handlebars_value_count(input) + handlebars_value_count(hash));
-        HANDLEBARS_VALUE_FOREACH_KV(input, key, child) {
-            new_map = handlebars_map_update(new_map, key, child);
-        } HANDLEBARS_VALUE_FOREACH_END();
-        HANDLEBARS_VALUE_FOREACH_KV(hash, key, child) {
-            new_map = handlebars_map_update(new_map, key, child);
-        } HANDLEBARS_VALUE_FOREACH_END();
-        handlebars_value_map(input, new_map);
+        handlebars_value_overlay_init(context, hash, input, input);
     } else if( handlebars_value_get_type(input) == HANDLEBARS_VALUE_TYPE_NULL && hash ) {
         handlebars_value_value(input, hash);
     }
     return input;
 }
 
-HBS_ATTR_NONNULL(1, 2)
-static struct handlebars_string * execute_template(
-    struct handlebars_vm * vm,
-    struct handlebars_string * volatile tmpl,
-    struct handlebars_value * input,
-    struct handlebars_string * indent,
-    int escape,
-    bool use_delimiters
-) {
-    struct handlebars_context * context = handlebars_context_ctor_ex(vm);
-    struct handlebars_string * volatile retval = NULL;
-    struct handlebars_module * volatile module = vm->cache ? handlebars_cache_find(vm->cache, tmpl) : NULL;
-    bool const from_cache = module != NULL;
-    long prev_depth = vm->depth;
-    jmp_buf * prev_jmp = HBSCTX(vm)->e->jmp;
-    jmp_buf buf;
+// {{{ Partial modules
+
+static struct handlebars_module * partial_module_find(struct handlebars_vm * vm, struct handlebars_string * tmpl)
+{
+    struct handlebars_vm_partial_module ** bucket = &vm->partial_modules[hbs_str_hash(tmpl) & (HANDLEBARS_VM_PARTIAL_MODULES_SIZE - 1)];
+    struct handlebars_vm_partial_module ** link;
+    struct handlebars_vm_partial_module * entry;
+
+    for( link = bucket; NULL != (entry = *link); link = &entry->next ) {
+        // The module has to have been compiled with the same options
+        if( (entry->tmpl == tmpl || handlebars_string_eq(entry->tmpl, tmpl)) &&
+                (entry->module->flags & handlebars_compiler_flag_all) == (vm->flags & handlebars_compiler_flag_all) ) {
+            // Move it to the front, so that the bucket is in the order of use
+            *link = entry->next;
+            entry->next = *bucket;
+            *bucket = entry;
+            return entry->module;
+        }
+    }
+
+    return NULL;
+}
+
+static void partial_module_add(struct handlebars_vm * vm, struct handlebars_string * tmpl, struct handlebars_module * module)
+{
+    struct handlebars_vm_partial_module ** bucket = &vm->partial_modules[hbs_str_hash(tmpl) & (HANDLEBARS_VM_PARTIAL_MODULES_SIZE - 1)];
+    struct handlebars_vm_partial_module ** link = bucket;
+    struct handlebars_vm_partial_module * entry = handlebars_talloc(vm, struct handlebars_vm_partial_module);
+    size_t count;
+    HANDLEBARS_MEMCHECK(entry, HBSCTX(vm));
+
+    // Drop the least recently used module of a full bucket
+    for( count = 1; *link != NULL && count < HANDLEBARS_VM_PARTIAL_MODULES_BUCKET_SIZE; count++ ) {
+        link = &(*link)->next;
+    }
+    if( *link != NULL ) {
+        (*link)->next = vm->partial_modules_evicted;
+        vm->partial_modules_evicted = *link;
+        *link = NULL;
+    }
 
     handlebars_string_addref(tmpl);
+    entry->tmpl = tmpl;
+    entry->module = talloc_steal(entry, module);
+    entry->next = *bucket;
+    *bucket = entry;
+}
 
-    // Get template
-    if (!hbs_str_len(tmpl)) {
-        goto done;
+static void partial_modules_free(struct handlebars_vm_partial_module ** list)
+{
+    struct handlebars_vm_partial_module * entry;
+
+    while( NULL != (entry = *list) ) {
+        *list = entry->next;
+        handlebars_string_delref(entry->tmpl);
+        handlebars_talloc_free(entry);
     }
+}
 
-    // Save jmp buf
-    if( handlebars_setjmp_ex(vm, &buf) ) {
-        goto done;
+static void partial_modules_clear(struct handlebars_vm * vm)
+{
+    size_t i;
+
+    for( i = 0; i < HANDLEBARS_VM_PARTIAL_MODULES_SIZE; i++ ) {
+        partial_modules_free(&vm->partial_modules[i]);
     }
+    partial_modules_free(&vm->partial_modules_evicted);
 
-    // Check for cached template, if available
-    if( !from_cache ) {
-        // Parse
-        struct handlebars_parser * parser = handlebars_parser_ctor(context);
-        if (vm->flags & handlebars_compiler_flag_compat) {
-            tmpl = handlebars_preprocess_delimiters(
-                HBSCTX(context),
-                tmpl,
-                use_delimiters ? vm->delim_open : NULL,
-                use_delimiters ? vm->delim_close : NULL
-            );
-            if (indent) {
-                tmpl = handlebars_string_indent(CONTEXT, tmpl, indent);
-            }
+    vm->partial_modules_stale = false;
+}
+
+// }}} Partial modules
+
+// {{{ Render scope
+
+static struct handlebars_context * render_scope(struct handlebars_vm * vm)
+{
+    // A render allocates everything that must not outlive it in the scope, including the arena, so that a failed
+    // render can be cleaned up by freeing it
+    if (handlebars_unlikely(vm->scope == NULL)) {
+        vm->scope = handlebars_talloc_zero(vm, struct handlebars_context);
+        HANDLEBARS_MEMCHECK(vm->scope, HBSCTX(vm));
+        handlebars_context_bind(HBSCTX(vm), vm->scope);
+    }
+
+    return vm->scope;
+}
+
+static bool owns_error_message(struct handlebars_vm * vm, const char * msg)
+{
+    const void * parent;
+
+    for (parent = talloc_parent(msg); parent != NULL; parent = talloc_parent(parent)) {
+        if (parent == vm) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void keep_error_message(struct handlebars_vm * vm)
+{
+    struct handlebars_error * e = HBSCTX(vm)->e;
+    char * msg;
+
+    if (e->msg == NULL || e->msg == vm->error_msg) {
+        return;
+    }
+
+    // The message may have been made in the scope, so it is moved out of it before the scope is freed. Only the
+    // message of the last error is kept. If the message could not be made, it may be a string literal, so a copy
+    // of it is kept instead
+    if (e->num == HANDLEBARS_NOMEM) {
+        msg = handlebars_talloc_strdup(vm, e->msg);
+        if (handlebars_unlikely(msg == NULL)) {
+            e->msg = HANDLEBARS_MEMCHECK_MSG;
         }
-        struct handlebars_ast_node * ast = handlebars_parse_ex(parser, tmpl, vm->flags);
+    } else if (owns_error_message(vm, e->msg)) {
+        msg = talloc_steal(vm, (char *) e->msg);
+    } else {
+        return;
+    }
+
+    if (vm->error_msg) {
+        handlebars_talloc_free(vm->error_msg);
+    }
+    vm->error_msg = msg;
+    if (msg) {
+        e->msg = msg;
+    }
+}
+
+static void render_scope_clear(struct handlebars_vm * vm)
+{
+    // An empty arena is kept, to be reused by the next render
+    size_t empty_blocks = vm->arena ? 2 : 1;
+
+    if (vm->scope && talloc_total_blocks(vm->scope) > empty_blocks) {
+        handlebars_talloc_free(vm->scope);
+        vm->scope = NULL;
+        vm->arena = NULL;
+    }
+}
 
-        // Compile
-        struct handlebars_compiler * compiler = handlebars_compiler_ctor(context);
-        handlebars_compiler_set_flags(compiler, vm->flags);
-        struct handlebars_program * program = handlebars_compiler_compile_ex(compiler, ast);
+// }}} Render scope
 
-        // Serialize
-        module = handlebars_program_serialize(context, program);
+HBS_ATTR_NONNULL(1, 2)
+static struct handlebars_module * compile_template(
+    struct handlebars_vm * vm,
+    struct handlebars_context * context,
+    struct handlebars_string * tmpl,
+    struct handlebars_string * indent,
+    bool use_delimiters
+) {
+    struct handlebars_module * module;
 
-        // Save cache entry
-        if( vm->cache ) {
-            handlebars_cache_add(vm->cache, tmpl, module);
+    // Parse
+    struct handlebars_parser * parser = handlebars_parser_ctor(context);
+    handlebars_string_addref(tmpl);
+    if (vm->flags & handlebars_compiler_flag_compat) {
+        tmpl = handlebars_preprocess_delimiters(
+            HBSCTX(context),
+            tmpl,
+            use_delimiters ? vm->delim_open : NULL,
+            use_delimiters ? vm->delim_close : NULL
+        );
+        if (indent) {
+            tmpl = handlebars_string_indent(CONTEXT, tmpl, indent);
         }
+    }
+    struct handlebars_ast_node * ast = handlebars_parse_ex(parser, tmpl, vm->flags);
+
+    // Compile
+    struct handlebars_compiler * compiler = handlebars_compiler_ctor(context);
+    handlebars_compiler_set_flags(compiler, vm->flags);
+    struct handlebars_program * program = handlebars_compiler_compile_ex(compiler, ast);
 
-        // Cleanup parser
-        handlebars_parser_dtor(parser);
+    // Serialize
+    module = handlebars_program_serialize(context, program);
+
+    // Save cache entry
+    if( vm->cache ) {
+        handlebars_cache_add(vm->cache, tmpl, module);
     }
 
+    // Cleanup parser
+    handlebars_parser_dtor(parser);
+    handlebars_string_delref(tmpl);
+
+    return module;
+}
+
+HBS_ATTR_NONNULL(1, 2)
+static struct handlebars_string * execute_template_module(
+    struct handlebars_vm * vm,
+    struct handlebars_module * module,
+    struct handlebars_value * input,
+    struct handlebars_string * indent,
+    bool append
+) {
+    struct handlebars_string * retval = NULL;
+    long const prev_depth = vm->depth;
+
     vm->depth++;
 
-    retval = handlebars_vm_execute(vm, module, input);
-    assert(retval != NULL);
+    if (append) {
+        execute_module(vm, module, input, 0, NULL, NULL, true);
+    } else {
+        retval = handlebars_vm_execute(vm, module, input);
+        assert(retval != NULL);
 
-    if (indent && !(vm->flags & handlebars_compiler_flag_compat)) {
-        retval = handlebars_string_indent(CONTEXT, retval, indent);
+        if (indent && !(vm->flags & handlebars_compiler_flag_compat)) {
+            retval = handlebars_string_indent(CONTEXT, retval, indent);
+        }
     }
 
-done:
-    HBSCTX(vm)->e->jmp = prev_jmp;
     vm->depth = prev_depth;
-    if( from_cache ) {
+
+    return retval;
+}
+
+HBS_ATTR_NONNULL(1, 2, 3)
+static struct handlebars_string * execute_cached_template_module(
+    struct handlebars_vm * vm,
+    struct handlebars_string * tmpl,
+    struct handlebars_module * module,
+    struct handlebars_value * input,
+    struct handlebars_string * indent,
+    bool append
+) {
+    jmp_buf * const prev_jmp = HBSCTX(vm)->e->jmp;
+    jmp_buf buf;
+
+    // The module has to be released even if executing it throws, the error is then passed on
+    if( handlebars_setjmp_ex(vm, &buf) ) {
+        HBSCTX(vm)->e->jmp = prev_jmp;
         handlebars_cache_release(vm->cache, tmpl, module);
+        longjmp(*prev_jmp, handlebars_error_num(HBSCTX(vm)));
     }
-    handlebars_string_delref(tmpl);
-    handlebars_context_dtor(context);
-    if (retval) {
-        return retval;
-    } else {
-        return handlebars_string_ctor(CONTEXT, HBS_STRL(""));
+
+    struct handlebars_string * retval = execute_template_module(vm, module, input, indent, append);
+
+    HBSCTX(vm)->e->jmp = prev_jmp;
+    handlebars_cache_release(vm->cache, tmpl, module);
+
+    return retval;
+}
+
+HBS_ATTR_NONNULL(1, 2)
+static struct handlebars_string * execute_template(
+    struct handlebars_vm * vm,
+    struct handlebars_string * tmpl,
+    struct handlebars_value * input,
+    struct handlebars_string * indent,
+    int escape,
+    bool use_delimiters,
+    bool append,
+    bool memoizable
+) {
+    struct handlebars_context * context;
+    struct handlebars_module * module;
+    struct handlebars_string * retval;
+    // Without a cache, keep the compiled template in the VM, unless it depends on the indentation
+    bool const memoize = memoizable && !vm->cache && !(indent && (vm->flags & handlebars_compiler_flag_compat));
+
+    // Errors are not caught here, they propagate to the jump buffer installed when the render was started
+    assert(HBSCTX(vm)->e->jmp != NULL);
+
+    // Get template
+    if (!hbs_str_len(tmpl)) {
+        return append ? NULL : handlebars_string_ctor(CONTEXT, HBS_STRL(""));
     }
+
+    // Check for cached template, if available
+    if( vm->cache ) {
+        module = handlebars_cache_find(vm->cache, tmpl);
+        if( module ) {
+            return execute_cached_template_module(vm, tmpl, module, input, indent, append);
+        }
+    } else if( memoize ) {
+        module = partial_module_find(vm, tmpl);
+        if( module ) {
+            return execute_template_module(vm, module, input, indent, append);
+        }
+    }
+
+    // The parser and compiler report their errors to the VM. If one is thrown, the context is freed with the scope of
+    // the render
+    context = handlebars_talloc_zero(render_scope(vm), struct handlebars_context);
+    HANDLEBARS_MEMCHECK(context, HBSCTX(vm));
+    handlebars_context_bind(HBSCTX(vm), context);
+
+    module = compile_template(vm, context, tmpl, indent, use_delimiters);
+
+    if( memoize ) {
+        partial_module_add(vm, tmpl, module);
+    }
+
+    retval = execute_template_module(vm, module, input, indent, append);
+
+    handlebars_talloc_free(context);
+
+    return retval;
 }
 
 HANDLEBARS_CLOSURE_ATTRS
@@ -428,13 +807,21 @@ static struct handlebars_value * invoke_partial_block_closure(HANDLEBARS_CLOSURE
 
     struct handlebars_value * input = argc > 0 ? &argv[0] : TOP(vm->contextStack);
     struct handlebars_string * buffer;
-    if (vm->module == module) {
-        buffer = handlebars_vm_execute_program_ex(vm, program, input, NULL, TOP(vm->blockParamStack));
+    if (options->direct_output) {
+        if (vm->module == module) {
+            handlebars_vm_execute_program_append(vm, program, input, NULL, TOP(vm->blockParamStack));
+        } else {
+            execute_module(vm, module, input, program, NULL, TOP(vm->blockParamStack), true);
+        }
     } else {
-        buffer = handlebars_vm_execute_ex(vm, module, input, program, NULL, TOP(vm->blockParamStack));
-    }
-    if (buffer) {
-        handlebars_value_str(rv, buffer);
+        if (vm->module == module) {
+            buffer = handlebars_vm_execute_program_ex(vm, program, input, NULL, TOP(vm->blockParamStack));
+        } else {
+            buffer = handlebars_vm_execute_ex(vm, module, input, program, NULL, TOP(vm->blockParamStack));
+        }
+        if (buffer) {
+            handlebars_value_str(rv, buffer);
+        }
     }
 
     // Pop partial block
@@ -458,15 +845,17 @@ static struct handlebars_value * invoke_partial_string_closure(HANDLEBARS_CLOSUR
     assert(HANDLEBARS_LOCAL_AT(0)->type == HANDLEBARS_VALUE_TYPE_STRING);
     assert(HANDLEBARS_LOCAL_AT(1)->type == HANDLEBARS_VALUE_TYPE_STRING || HANDLEBARS_LOCAL_AT(1)->type == HANDLEBARS_VALUE_TYPE_NULL);
 
-    struct handlebars_string * tmpl = handlebars_value_get_string(HANDLEBARS_LOCAL_AT(0));
-    struct handlebars_string * indent = HANDLEBARS_LOCAL_AT(1)->type == HANDLEBARS_VALUE_TYPE_STRING ? handlebars_value_get_string(HANDLEBARS_LOCAL_AT(1)) : NULL;
+    struct handlebars_string * tmpl = handlebars_value_get_string_ex(CONTEXT, HANDLEBARS_LOCAL_AT(0));
+    struct handlebars_string * indent = HANDLEBARS_LOCAL_AT(1)->type == HANDLEBARS_VALUE_TYPE_STRING ? handlebars_value_get_string_ex(CONTEXT, HANDLEBARS_LOCAL_AT(1)) : NULL;
     struct handlebars_string * buffer = execute_template(
         vm,
         tmpl,
         &argv[0],
         indent,
         0,
-        0
+        0,
+        options->direct_output && !(indent && !(vm->flags & handlebars_compiler_flag_compat)),
+        true
     );
     if (buffer) {
         handlebars_value_str(rv, buffer);
@@ -486,7 +875,7 @@ static struct handlebars_value * invoke_mustache_style_lambda_closure(HANDLEBARS
     HANDLEBARS_VALUE_DECL(lambda_result);
     HANDLEBARS_VALUE_ARRAY_DECL(lambda_argv, 1);
     struct handlebars_value *callable = HANDLEBARS_LOCAL_AT(0);
-    struct handlebars_string *lambda_tmpl = handlebars_value_get_string(HANDLEBARS_LOCAL_AT(1));
+    struct handlebars_string *lambda_tmpl = handlebars_value_get_string_ex(CONTEXT, HANDLEBARS_LOCAL_AT(1));
     bool use_delimiters = handlebars_value_get_boolval(HANDLEBARS_LOCAL_AT(2));
 
     handlebars_value_str(&lambda_argv[0], lambda_tmpl);
@@ -495,7 +884,7 @@ static struct handlebars_value * invoke_mustache_style_lambda_closure(HANDLEBARS
 
     if (!handlebars_value_is_empty(lambda_result)) {
         struct handlebars_string * tmpl = handlebars_value_to_string(lambda_result, CONTEXT);
-        struct handlebars_string * rv_str = execute_template(vm, tmpl, callable, NULL, 0, use_delimiters);
+        struct handlebars_string * rv_str = execute_template(vm, tmpl, callable, NULL, 0, use_delimiters, false, false);
         handlebars_value_str(rv, rv_str);
     }
 
@@ -516,6 +905,7 @@ ACCEPT_FUNCTION(ambiguous_block_value)
 
     if( vm->last_helper == NULL ) {
         VM_SETUP_OPTIONS(1);
+        options.direct_output = true;
         struct handlebars_value * result = handlebars_vm_call_helper_str(HBS_STRL("blockHelperMissing"), 1, argv, &options, vm, rv);
         assert(result != NULL);
         PUSH(vm->stack, result);
@@ -561,6 +951,7 @@ ACCEPT_FUNCTION(append_content)
     assert(opcode->op1.type == handlebars_operand_type_string);
 
     vm->buffer = handlebars_string_append(CONTEXT, vm->buffer, HBS_STR_STRL(opcode->op1.data.string.string));
+    maybe_flush_buffer(vm);
 }
 
 ACCEPT_FUNCTION(assign_to_hash)
@@ -576,9 +967,8 @@ ACCEPT_FUNCTION(assign_to_hash)
     assert(opcode->op1.type == handlebars_operand_type_string);
     assert(handlebars_value_get_type(hash) == HANDLEBARS_VALUE_TYPE_MAP);
 
-    struct handlebars_map * map = handlebars_value_get_map(hash);
-    map = handlebars_map_update(map, opcode->op1.data.string.string, value);
-    handlebars_value_map(hash, map);
+    // The first argument copies the shared empty hash pushed by push_hash
+    handlebars_value_map_update(hash, opcode->op1.data.string.string, value);
 
     PUSH(vm->hashStack, hash);
 
@@ -595,6 +985,7 @@ ACCEPT_FUNCTION(block_value)
 
     VM_SETUP_OPTIONS(argc);
     options.name = opcode->op1.data.string.string;
+    options.direct_output = true;
 
     struct handlebars_value * result = handlebars_vm_call_helper_str(HBS_STRL("blockHelperMissing"), argc, argv, &options, vm, rv);
     if (likely(result != NULL)) {
@@ -607,20 +998,12 @@ ACCEPT_FUNCTION(block_value)
 
 ACCEPT_FUNCTION(empty_hash)
 {
-    HANDLEBARS_VALUE_DECL(value);
-
-    handlebars_value_map(value, handlebars_map_ctor(CONTEXT, 0));
-    PUSH(vm->stack, value);
-
-    HANDLEBARS_VALUE_UNDECL(value);
+    PUSH(vm->stack, &vm->empty_hash);
 }
 
-ACCEPT_FUNCTION(get_context)
+HBS_ATTR_NONNULL_ALL
+static inline void set_last_context(struct handlebars_vm * vm, size_t depth)
 {
-    assert(opcode->type == handlebars_opcode_type_get_context);
-    assert(opcode->op1.type == handlebars_operand_type_long);
-
-    size_t depth = (size_t) opcode->op1.data.longval;
     size_t length = LEN(vm->contextStack);
 
     if( depth >= length ) {
@@ -632,6 +1015,14 @@ ACCEPT_FUNCTION(get_context)
     }
 }
 
+ACCEPT_FUNCTION(get_context)
+{
+    assert(opcode->type == handlebars_opcode_type_get_context);
+    assert(opcode->op1.type == handlebars_operand_type_long);
+
+    set_last_context(vm, (size_t) opcode->op1.data.longval);
+}
+
 ACCEPT_FUNCTION(invoke_ambiguous)
 {
     HANDLEBARS_VALUE_DECL(rv);
@@ -669,25 +1060,22 @@ ACCEPT_FUNCTION(invoke_ambiguous)
         handlebars_value_closure(value, closure);
         fn = value;
 
-        last_helper = handlebars_string_ctor(CONTEXT, HBS_STRL("lambda")); // hackey but it works
-        handlebars_string_addref(last_helper);
+        last_helper = HBS_INTERNED_STR(LAMBDA); // hackey but it works
 
         HANDLEBARS_VALUE_ARRAY_UNDECL(closure_localv, closure_localc);
-    } else if( NULL != (fn = lookup_helper(vm, options.name, fnv)) ) {
+    } else if( NULL != (fn = lookup_helper(vm, options.name, fnv, &options)) ) {
         last_helper = options.name;
         handlebars_string_addref(last_helper);
     } else if (value && is_callable) {
         fn = value;
     } else {
-        struct handlebars_string * tmp_str = handlebars_string_ctor(CONTEXT, HBS_STRL("helperMissing"));
-        fn = lookup_helper(vm, tmp_str, fnv);
-        handlebars_string_delref(tmp_str);
+        fn = lookup_helper(vm, HBS_INTERNED_STR(HELPER_MISSING), fnv, NULL);
     }
 
     result = handlebars_value_call(fn, argc, argv, &options, vm, rv);
 
     // Before, the null case was only done for helperMissing
-    if (result->type != HANDLEBARS_VALUE_TYPE_NULL) {
+    if (result->type != HANDLEBARS_VALUE_TYPE_NULL || options.direct_output) {
         PUSH(vm->stack, result);
     } else {
         PUSH(vm->stack, value);
@@ -718,14 +1106,12 @@ ACCEPT_FUNCTION(invoke_helper)
     VM_SETUP_OPTIONS(argc);
     options.name = opcode->op2.data.string.string;
 
-    if (opcode->op3.data.boolval && NULL != (fn = lookup_helper(vm, options.name, fnv))) { // isSimple
+    if (opcode->op3.data.boolval && NULL != (fn = lookup_helper(vm, options.name, fnv, &options))) { // isSimple
         // fallthrough
     } else if (value && handlebars_value_is_callable(value)) {
         fn = value;
     } else {
-        struct handlebars_string * tmp_str = handlebars_string_ctor(CONTEXT, HBS_STRL("helperMissing"));
-        fn = lookup_helper(vm, tmp_str, fnv);
-        handlebars_string_delref(tmp_str);
+        fn = lookup_helper(vm, HBS_INTERNED_STR(HELPER_MISSING), fnv, NULL);
     }
 
     PUSH(vm->stack, handlebars_value_call(fn, argc, argv, &options, vm, rv));
@@ -748,7 +1134,7 @@ ACCEPT_FUNCTION(invoke_known_helper)
     VM_SETUP_OPTIONS(argc);
     options.name = opcode->op2.data.string.string;
 
-    struct handlebars_value * fn = lookup_helper(vm, options.name, fnv);
+    struct handlebars_value * fn = lookup_helper(vm, options.name, fnv, &options);
 
     if (unlikely(fn == NULL)) {
         handlebars_throw_ex(
@@ -778,7 +1164,11 @@ ACCEPT_FUNCTION(invoke_partial)
     HANDLEBARS_VALUE_DECL(rv);
     HANDLEBARS_VALUE_DECL(partial_block);
     struct handlebars_string * buffer = NULL;
+    struct handlebars_string * indent = opcode->op3.data.string.string;
     bool pushed_partial_block = false;
+    bool direct_output = false;
+    // The partial was bundled into the module by handlebars_program_serialize_bundle, op4 is its program number
+    bool bundled = opcode->op4.type == handlebars_operand_type_long;
 
     assert(opcode->op1.type == handlebars_operand_type_boolean);
     assert(opcode->op2.type == handlebars_operand_type_string || opcode->op2.type == handlebars_operand_type_null || opcode->op2.type == handlebars_operand_type_long);
@@ -789,33 +1179,34 @@ ACCEPT_FUNCTION(invoke_partial)
     if( opcode->op1.data.boolval ) {
         // Dynamic partial
         HBS_ASSERT(POP(vm->stack, tmp));
-        name = handlebars_value_get_string(tmp);
+        name = handlebars_value_get_string_ex(CONTEXT, tmp);
         options.name = NULL; // fear
     } else {
         if( opcode->op2.type == handlebars_operand_type_long ) {
             char tmp_str[32];
             size_t tmp_str_len = snprintf(tmp_str, 32, "%ld", opcode->op2.data.longval);
-            name = handlebars_string_ctor(HBSCTX(vm), tmp_str, tmp_str_len);
+            name = handlebars_string_ctor(handlebars_vm_get_arena(vm), tmp_str, tmp_str_len);
             //name = MC(handlebars_talloc_asprintf(vm, "%ld", opcode->op2.data.longval));
         } else if( opcode->op2.type == handlebars_operand_type_string ) {
             name = opcode->op2.data.string.string;
         }
     }
 
-    if (name) {
+    if (name && !bundled) {
         partial = handlebars_value_map_find(&vm->partials, name, partial_rv);
     }
 
     // Try to look up partial block
     if (!partial && name && hbs_str_eq_strl(name, HBS_STRL("@partial-block")) && LEN(vm->partialBlockStack) > 0) {
         partial = TOP(vm->partialBlockStack);
+        direct_output = true;
     }
 
     // Push partial block
     if (options.program > 0) {
         const int closure_localc = 3;
         HANDLEBARS_VALUE_ARRAY_DECL(closure_localv, closure_localc);
-        handlebars_value_ptr(&closure_localv[0], handlebars_ptr_ctor(CONTEXT, struct handlebars_module, vm->module, true));
+        handlebars_value_ptr(&closure_localv[0], handlebars_ptr_ctor(handlebars_vm_get_arena(vm), struct handlebars_module, vm->module, true));
         handlebars_value_integer(&closure_localv[1], options.program);
         handlebars_value_integer(&closure_localv[2], LEN(vm->partialBlockStack));
         handlebars_value_closure(partial_block, handlebars_closure_ctor(vm, invoke_partial_block_closure, closure_localc, closure_localv));
@@ -827,9 +1218,27 @@ ACCEPT_FUNCTION(invoke_partial)
     // Merge hashes
     merge_hash(HBSCTX(vm), &argv[0], options.hash);
 
+    // Bundled partials are a program of the current module, and are executed without a lookup or closure
+    if (bundled) {
+        long prev_depth = vm->depth++;
+
+        if (!(vm->flags & handlebars_compiler_flag_compat) && hbs_str_len(indent) > 0) {
+            size_t mark = handlebars_vm_buffer_mark(vm);
+            handlebars_vm_execute_program_append(vm, opcode->op4.data.longval, &argv[0], NULL, NULL);
+            handlebars_vm_buffer_indent(vm, mark, indent);
+        } else {
+            handlebars_vm_execute_program_append(vm, opcode->op4.data.longval, &argv[0], NULL, NULL);
+        }
+
+        vm->depth = prev_depth;
+        maybe_flush_buffer(vm);
+        goto done;
+    }
+
     if (!partial) {
         if (options.program >= 0) {
             partial = partial_block;
+            direct_output = true;
         } else if (vm->flags & handlebars_compiler_flag_compat) {
             goto done;
         } else {
@@ -849,13 +1258,14 @@ ACCEPT_FUNCTION(invoke_partial)
     if (partial->type == HANDLEBARS_VALUE_TYPE_STRING) {
         const int closure_localc = 2;
         HANDLEBARS_VALUE_ARRAY_DECL(closure_localv, closure_localc);
-        handlebars_value_str(&closure_localv[0], handlebars_value_get_string(partial));
+        handlebars_value_value(&closure_localv[0], partial);
         if (vm->flags & handlebars_compiler_flag_compat) {
-            handlebars_value_str(&closure_localv[1], opcode->op3.data.string.string);
+            handlebars_value_str(&closure_localv[1], indent);
         }
         struct handlebars_closure * closure = handlebars_closure_ctor(vm, invoke_partial_string_closure, closure_localc, closure_localv);
         handlebars_value_closure(partial, closure);
         HANDLEBARS_VALUE_ARRAY_UNDECL(closure_localv, closure_localc);
+        direct_output = true;
     }
 
     // Throw if the partial is not callable
@@ -869,8 +1279,18 @@ ACCEPT_FUNCTION(invoke_partial)
         );
     }
 
-    // Finally, call the partial
-    do {
+    // Finally, call the partial. Our own closures write straight into the output buffer, where it is indented in place
+    if (direct_output && !(vm->flags & handlebars_compiler_flag_compat) && hbs_str_len(indent) > 0) {
+        size_t mark = handlebars_vm_buffer_mark(vm);
+
+        options.direct_output = true;
+        (void) handlebars_value_call(partial, argc, argv, &options, vm, rv);
+
+        handlebars_vm_buffer_indent(vm, mark, indent);
+    } else if (direct_output) {
+        options.direct_output = true;
+        (void) handlebars_value_call(partial, argc, argv, &options, vm, rv);
+    } else {
         buffer = handlebars_value_expression(
             CONTEXT,
             handlebars_value_call(partial, argc, argv, &options, vm, rv),
@@ -880,9 +1300,11 @@ ACCEPT_FUNCTION(invoke_partial)
         if (vm->flags & handlebars_compiler_flag_compat) {
             vm->buffer = handlebars_string_append_str(CONTEXT, vm->buffer, buffer);
         } else {
-            vm->buffer = handlebars_string_indent_append(HBSCTX(vm), vm->buffer, buffer, opcode->op3.data.string.string);
+            vm->buffer = handlebars_string_indent_append(HBSCTX(vm), vm->buffer, buffer, indent);
         }
-    } while (0);
+    }
+
+    maybe_flush_buffer(vm);
 
 done:
     // Pop partial block
@@ -901,8 +1323,8 @@ done:
 
 ACCEPT_FUNCTION(lookup_block_param)
 {
-    long blockParam1 = -1;
-    long blockParam2 = -1;
+    long blockParam1;
+    long blockParam2;
     struct handlebars_value * v1 = NULL;
     size_t arr_len;
     struct handlebars_operand_string * arr;
@@ -916,10 +1338,10 @@ ACCEPT_FUNCTION(lookup_block_param)
     assert(opcode->op1.type == handlebars_operand_type_array);
     assert(opcode->op2.type == handlebars_operand_type_array);
 
-    sscanf(hbs_str_val(opcode->op1.data.array.array[0].string), "%ld", &blockParam1);
-    sscanf(hbs_str_val(opcode->op1.data.array.array[1].string), "%ld", &blockParam2);
+    blockParam1 = opcode->op1.data.array.array[0].index;
+    blockParam2 = opcode->op1.data.array.array[1].index;
 
-    if( blockParam1 >= (long) LEN(vm->blockParamStack) ) goto done;
+    if( blockParam1 < 0 || blockParam1 >= (long) LEN(vm->blockParamStack) ) goto done;
 
     v1 = GET(vm->blockParamStack, blockParam1);
     if( !v1 || handlebars_value_get_type(v1) != HANDLEBARS_VALUE_TYPE_ARRAY ) goto done;
@@ -981,7 +1403,7 @@ ACCEPT_FUNCTION(lookup_data)
 
     if( depth && data ) {
         while( data && depth-- ) {
-            tmp = handlebars_value_map_str_find(data, HBS_STRL("_parent"), rv);
+            tmp = handlebars_value_map_find(data, HBS_INTERNED_STR(PARENT), rv);
             if (tmp != NULL) {
                 handlebars_value_value(data, tmp);
             }
@@ -1031,7 +1453,26 @@ ACCEPT_FUNCTION(lookup_data)
     HANDLEBARS_VALUE_UNDECL(rv);
 }
 
-ACCEPT_FUNCTION(lookup_on_context)
+HBS_ATTR_NONNULL_ALL
+static inline void resolve_possible_lambda(struct handlebars_vm * vm, struct handlebars_value * value)
+{
+    if( handlebars_value_is_callable(value) ) {
+        HANDLEBARS_VALUE_DECL(rv);
+        // This should really use the same options object as invoke*
+        struct handlebars_options options = {0};
+        const int argc = 1;
+        HANDLEBARS_VALUE_ARRAY_DECL(argv, argc);
+        handlebars_value_value(&argv[0], TOP(vm->contextStack));
+        options.scope = &argv[0];
+        handlebars_value_value(value, handlebars_value_call(value, argc, argv, &options, vm, rv));
+        HANDLEBARS_VALUE_ARRAY_UNDECL(argv, argc);
+        handlebars_options_deinit(&options);
+        HANDLEBARS_VALUE_UNDECL(rv);
+    }
+}
+
+HBS_ATTR_NONNULL_ALL
+static inline void lookup_on_context(struct handlebars_vm * vm, struct handlebars_opcode * opcode, struct handlebars_value * result)
 {
     HANDLEBARS_VALUE_DECL(empty_value);
     HANDLEBARS_VALUE_DECL(rv);
@@ -1039,32 +1480,29 @@ ACCEPT_FUNCTION(lookup_on_context)
     struct handlebars_value * value;
 
     assert(opcode->op1.type == handlebars_operand_type_array);
-    assert(opcode->op2.type == handlebars_operand_type_boolean || opcode->op2.type == handlebars_operand_type_null);
     assert(opcode->op3.type == handlebars_operand_type_boolean || opcode->op3.type == handlebars_operand_type_null);
     assert(opcode->op4.type == handlebars_operand_type_boolean || opcode->op4.type == handlebars_operand_type_null);
 
     size_t arr_len = opcode->op1.data.array.count;
     struct handlebars_operand_string * arr = opcode->op1.data.array.array;
     struct handlebars_operand_string * arr_end = arr + arr_len;
-    long index = -1;
     bool is_strict = (vm->flags & handlebars_compiler_flag_strict) || (vm->flags & handlebars_compiler_flag_assume_objects);
     bool require_terminal = (vm->flags & handlebars_compiler_flag_strict) && opcode->op3.data.boolval;
 
     if( !opcode->op4.data.boolval && (vm->flags & handlebars_compiler_flag_compat) ) {
         depthed_lookup(vm, arr->string);
+        value = HBS_ASSERT(POP(vm->stack, rv));
     } else {
-        ACCEPT_FN(push_context)(vm, opcode);
+        value = vm->last_context;
     }
 
-    value = HBS_ASSERT(POP(vm->stack, rv));
-
     do {
         bool is_last = arr == arr_end - 1;
         if( handlebars_value_get_type(value) == HANDLEBARS_VALUE_TYPE_MAP ) {
             value = handlebars_value_map_find(value, arr->string, rv2);
         } else if( handlebars_value_get_type(value) == HANDLEBARS_VALUE_TYPE_ARRAY ) {
-            if (sscanf(hbs_str_val(arr->string), "%ld", &index)) {
-                value = handlebars_value_array_find(value, index, rv2);
+            if (arr->index >= 0) {
+                value = handlebars_value_array_find(value, arr->index, rv2);
             } else {
                 value = NULL;
             }
@@ -1098,13 +1536,56 @@ ACCEPT_FUNCTION(lookup_on_context)
         }
     }
 
-    PUSH(vm->stack, value);
+    handlebars_value_value(result, value);
 
     HANDLEBARS_VALUE_UNDECL(rv2);
     HANDLEBARS_VALUE_UNDECL(rv);
     HANDLEBARS_VALUE_UNDECL(empty_value);
 }
 
+ACCEPT_FUNCTION(lookup_on_context)
+{
+    HANDLEBARS_VALUE_DECL(value);
+
+    assert(opcode->op2.type == handlebars_operand_type_boolean || opcode->op2.type == handlebars_operand_type_null);
+
+    lookup_on_context(vm, opcode, value);
+    PUSH(vm->stack, value);
+
+    HANDLEBARS_VALUE_UNDECL(value);
+}
+
+// {{{ Superinstructions
+
+// getContext, lookupOnContext, resolvePossibleLambda, append(Escaped) without the intermediate stack traffic. The
+// depth for getContext is stored in the otherwise unused second operand of lookupOnContext.
+HBS_ATTR_NONNULL_ALL
+static inline void lookup_on_context_append(struct handlebars_vm * vm, struct handlebars_opcode * opcode, bool escape)
+{
+    HANDLEBARS_VALUE_DECL(value);
+
+    assert(opcode->op2.type == handlebars_operand_type_long);
+
+    set_last_context(vm, (size_t) opcode->op2.data.longval);
+    lookup_on_context(vm, opcode, value);
+    resolve_possible_lambda(vm, value);
+    append_to_buffer(vm, value, escape);
+
+    HANDLEBARS_VALUE_UNDECL(value);
+}
+
+ACCEPT_FUNCTION(lookup_on_context_append)
+{
+    lookup_on_context_append(vm, opcode, false);
+}
+
+ACCEPT_FUNCTION(lookup_on_context_append_escaped)
+{
+    lookup_on_context_append(vm, opcode, true);
+}
+
+// }}} Superinstructions
+
 ACCEPT_FUNCTION(pop_hash)
 {
     HANDLEBARS_VALUE_DECL(hash);
@@ -1122,12 +1603,7 @@ ACCEPT_FUNCTION(push_context)
 
 ACCEPT_FUNCTION(push_hash)
 {
-    HANDLEBARS_VALUE_DECL(hash);
-
-    handlebars_value_map(hash, handlebars_map_ctor(CONTEXT, 4)); // number of items might be available somewhere
-    PUSH(vm->hashStack, hash);
-
-    HANDLEBARS_VALUE_UNDECL(hash);
+    PUSH(vm->hashStack, &vm->empty_hash);
 }
 
 ACCEPT_FUNCTION(push_program)
@@ -1178,6 +1654,39 @@ ACCEPT_FUNCTION(push_literal)
     HANDLEBARS_VALUE_UNDECL(value);
 }
 
+#if HAVE_COMPUTED_GOTOS
+ACCEPT_FUNCTION(push_literal_null)
+{
+    HANDLEBARS_VALUE_DECL(value);
+    PUSH(vm->stack, value);
+    HANDLEBARS_VALUE_UNDECL(value);
+}
+
+ACCEPT_FUNCTION(push_literal_string)
+{
+    HANDLEBARS_VALUE_DECL(value);
+    handlebars_value_str(value, opcode->op1.data.string.string);
+    PUSH(vm->stack, value);
+    HANDLEBARS_VALUE_UNDECL(value);
+}
+
+ACCEPT_FUNCTION(push_literal_boolean)
+{
+    HANDLEBARS_VALUE_DECL(value);
+    handlebars_value_boolean(value, opcode->op1.data.boolval);
+    PUSH(vm->stack, value);
+    HANDLEBARS_VALUE_UNDECL(value);
+}
+
+ACCEPT_FUNCTION(push_literal_long)
+{
+    HANDLEBARS_VALUE_DECL(value);
+    handlebars_value_integer(value, opcode->op1.data.longval);
+    PUSH(vm->stack, value);
+    HANDLEBARS_VALUE_UNDECL(value);
+}
+#endif
+
 ACCEPT_FUNCTION(push_string)
 {
     HANDLEBARS_VALUE_DECL(value);
@@ -1195,28 +1704,91 @@ ACCEPT_FUNCTION(resolve_possible_lambda)
     HANDLEBARS_VALUE_DECL(value);
 
     HBS_ASSERT(POP(vm->stack, value));
+    resolve_possible_lambda(vm, value);
+    PUSH(vm->stack, value);
 
-    if( handlebars_value_is_callable(value) ) {
-        HANDLEBARS_VALUE_DECL(rv);
-        // This should really use the same options object as invoke*
-        struct handlebars_options options = {0};
-        const int argc = 1;
-        HANDLEBARS_VALUE_ARRAY_DECL(argv, argc);
-        handlebars_value_value(&argv[0], TOP(vm->contextStack));
-        options.scope = &argv[0];
-        PUSH(vm->stack, handlebars_value_call(value, argc, argv, &options, vm, rv));
-        HANDLEBARS_VALUE_ARRAY_UNDECL(argv, argc);
-        handlebars_options_deinit(&options);
-        HANDLEBARS_VALUE_UNDECL(rv);
-    } else {
-        PUSH(vm->stack, value);
+    HANDLEBARS_VALUE_UNDECL(value);
+}
+
+// {{{ Linking
+
+#if HAVE_COMPUTED_GOTOS
+
+/**
+ * @brief Handlers that follow the opcode types in the dispatch table. They are only reachable through a linked
+ *        module, which selects them by the operand types so the handler does not have to check them again.
+ */
+enum handlebars_vm_linked_handler {
+    LINKED_HANDLER_push_literal_null = handlebars_opcode_type_lookup_on_context_append_escaped + 1,
+    LINKED_HANDLER_push_literal_string,
+    LINKED_HANDLER_push_literal_boolean,
+    LINKED_HANDLER_push_literal_long,
+    LINKED_HANDLER_invalid
+};
+
+static inline int link_handler(struct handlebars_opcode * opcode)
+{
+    if( opcode->type < 0 || opcode->type > handlebars_opcode_type_lookup_on_context_append_escaped ) {
+        return LINKED_HANDLER_invalid;
     }
 
-    HANDLEBARS_VALUE_UNDECL(value);
+    if( opcode->type != handlebars_opcode_type_push_literal ) {
+        return opcode->type;
+    }
+
+    switch( opcode->op1.type ) {
+        case handlebars_operand_type_string:
+            if (hbs_str_eq_strl(opcode->op1.data.string.string, HBS_STRL("undefined")) ||
+                    hbs_str_eq_strl(opcode->op1.data.string.string, HBS_STRL("null"))) {
+                return LINKED_HANDLER_push_literal_null;
+            }
+            return LINKED_HANDLER_push_literal_string;
+        case handlebars_operand_type_boolean:
+            return LINKED_HANDLER_push_literal_boolean;
+        case handlebars_operand_type_long:
+            return LINKED_HANDLER_push_literal_long;
+        case handlebars_operand_type_null:
+            return LINKED_HANDLER_push_literal_null;
+        default:
+            return LINKED_HANDLER_invalid;
+    }
 }
 
-static void handlebars_vm_accept(struct handlebars_vm * vm, struct handlebars_module_table_entry * entry)
+/**
+ * @brief Resolve the handler of every opcode in the module once, so that executing it jumps straight from one
+ *        handler to the next. A module is linked again if it was linked against another dispatch table, e.g. after
+ *        being loaded from a persistent cache.
+ * @param[in] module The module
+ * @param[in] dispatch_table The dispatch table of #handlebars_vm_accept
+ * @return void
+ */
+static void link_module(struct handlebars_module * module, void * const * dispatch_table)
 {
+    size_t i;
+
+    for( i = 0; i < module->opcode_count; i++ ) {
+        module->opcodes[i].handler = dispatch_table[link_handler(&module->opcodes[i])];
+    }
+
+    module->linked = dispatch_table;
+}
+
+#endif
+
+// }}} Linking
+
+/**
+ * @brief Execute a program of the module. The module is linked first if it has not been yet.
+ * @param[in] vm The VM, may only be NULL if entry is NULL
+ * @param[in] module The module
+ * @param[in] entry The program to execute, or NULL to only link the module
+ * @return void
+ */
+static void handlebars_vm_accept(
+    struct handlebars_vm * vm,
+    struct handlebars_module * module,
+    struct handlebars_module_table_entry * entry
+) {
 #if 0
 #define ACCEPT_DEBUG() \
     do { \
@@ -1229,30 +1801,43 @@ static void handlebars_vm_accept(struct handlebars_vm * vm, struct handlebars_mo
 #endif
 #define ACCEPT_ERROR handlebars_throw(CONTEXT, HANDLEBARS_ERROR, "Unhandled opcode: %s\n", handlebars_opcode_readable_type(opcode->type));
 #if HAVE_COMPUTED_GOTOS
-#define DISPATCH() goto *dispatch_table[opcode->type]
+#define DISPATCH() goto *opcode->handler
 #define ACCEPT_LABEL(name) do_ ## name
 #define ACCEPT_CASE(name) ACCEPT_LABEL(name):
 #define ACCEPT(name) ACCEPT_LABEL(name): ACCEPT_DEBUG(); ACCEPT_FN(name)(vm, opcode); opcode++; DISPATCH();
-    static void * dispatch_table[] = {
+#define ACCEPT_LINKED(name) ACCEPT(name)
+    static void * const dispatch_table[] = {
             &&do_nil, &&do_ambiguous_block_value, &&do_append, &&do_append_escaped, &&do_empty_hash,
             &&do_pop_hash, &&do_push_context, &&do_push_hash, &&do_resolve_possible_lambda, &&do_get_context,
             &&do_push_program, &&do_append_content, &&do_assign_to_hash, &&do_block_value, &&do_push,
             &&do_push_literal, &&do_push_string, &&do_invoke_partial, &&do_push_id, &&do_push_string_param,
             &&do_invoke_ambiguous, &&do_invoke_known_helper, &&do_invoke_helper, &&do_lookup_on_context, &&do_lookup_data,
-            &&do_lookup_block_param, &&do_register_decorator, &&do_return
+            &&do_lookup_block_param, &&do_register_decorator, &&do_return, &&do_lookup_on_context_append,
+            &&do_lookup_on_context_append_escaped,
+            // Linked handlers
+            &&do_push_literal_null, &&do_push_literal_string, &&do_push_literal_boolean, &&do_push_literal_long,
+            &&do_invalid
     };
+    if( unlikely(module->linked != (const void *) dispatch_table) ) {
+        link_module(module, dispatch_table);
+    }
 #define ACCEPT_DEFAULT
 #define START_ACCEPT DISPATCH();
 #define END_ACCEPT
 #else
 #define ACCEPT_CASE(name) case OPCODE_NAME(name):
 #define ACCEPT(name) case OPCODE_NAME(name) : ACCEPT_FN(name)(vm, opcode); opcode++; break;
+#define ACCEPT_LINKED(name)
 #define ACCEPT_DEFAULT default: ACCEPT_ERROR
 #define START_ACCEPT start: switch( opcode->type ) {
 #define END_ACCEPT } goto start;
 #endif
 
-    struct handlebars_opcode * opcode = &vm->module->opcodes[entry->opcode_offset];
+    if( !entry ) {
+        return;
+    }
+
+    struct handlebars_opcode * opcode = &module->opcodes[entry->opcode_offset];
     START_ACCEPT
         ACCEPT(ambiguous_block_value)
         ACCEPT(append)
@@ -1269,6 +1854,8 @@ static void handlebars_vm_accept(struct handlebars_vm * vm, struct handlebars_mo
         ACCEPT(lookup_block_param)
         ACCEPT(lookup_data)
         ACCEPT(lookup_on_context)
+        ACCEPT(lookup_on_context_append)
+        ACCEPT(lookup_on_context_append_escaped)
         ACCEPT(pop_hash)
         ACCEPT(push_context)
         ACCEPT(push_hash)
@@ -1277,6 +1864,12 @@ static void handlebars_vm_accept(struct handlebars_vm * vm, struct handlebars_mo
         ACCEPT(push_string)
         ACCEPT(resolve_possible_lambda)
 
+        // Linked handlers
+        ACCEPT_LINKED(push_literal_null)
+        ACCEPT_LINKED(push_literal_string)
+        ACCEPT_LINKED(push_literal_boolean)
+        ACCEPT_LINKED(push_literal_long)
+
         // Special return opcode
         ACCEPT_CASE(return) return;
 
@@ -1286,12 +1879,18 @@ static void handlebars_vm_accept(struct handlebars_vm * vm, struct handlebars_mo
         ACCEPT_CASE(push_id)
         ACCEPT_CASE(push_string_param)
         ACCEPT_CASE(register_decorator)
+        ACCEPT_CASE(invalid)
         ACCEPT_DEFAULT
             ACCEPT_ERROR
     END_ACCEPT
 }
 
-struct handlebars_string * handlebars_vm_execute_program_ex(
+void handlebars_vm_link(struct handlebars_module * module)
+{
+    handlebars_vm_accept(NULL, module, NULL);
+}
+
+void handlebars_vm_execute_program_append(
     struct handlebars_vm * vm,
     long program_num,
     struct handlebars_value * context,
@@ -1299,7 +1898,7 @@ struct handlebars_string * handlebars_vm_execute_program_ex(
     struct handlebars_value * block_params
 ) {
     if( program_num < 0 ) {
-        return handlebars_string_init(CONTEXT, 0);
+        return;
     } else if( program_num >= (long) vm->module->program_count ) {
         handlebars_throw(CONTEXT, HANDLEBARS_ERROR, "Invalid program: %ld", program_num);
     }
@@ -1307,11 +1906,8 @@ struct handlebars_string * handlebars_vm_execute_program_ex(
     // Get program
 	struct handlebars_module_table_entry * entry = &vm->module->programs[program_num];
 
-    // Save and set buffer
-    struct handlebars_string * prev_buffer = vm->buffer;
-    vm->buffer = handlebars_string_init(CONTEXT, HANDLEBARS_VM_BUFFER_INIT_SIZE);
-
     // Check stacks
+    assert(vm->buffer != NULL);
     assert(vm->stack != NULL);
     assert(vm->contextStack != NULL);
     assert(vm->hashStack != NULL);
@@ -1344,7 +1940,7 @@ struct handlebars_string * handlebars_vm_execute_program_ex(
     }
 
     // Execute the program
-	handlebars_vm_accept(vm, entry);
+    handlebars_vm_accept(vm, vm->module, entry);
 
     // Restore stacks
     handlebars_stack_restore(vm->stack, st);
@@ -1363,12 +1959,37 @@ struct handlebars_string * handlebars_vm_execute_program_ex(
         handlebars_value_value(&vm->data, prev_data);
     }
     HANDLEBARS_VALUE_UNDECL(prev_data);
+}
+
+struct handlebars_string * handlebars_vm_execute_program_ex(
+    struct handlebars_vm * vm,
+    long program_num,
+    struct handlebars_value * context,
+    struct handlebars_value * data,
+    struct handlebars_value * block_params
+) {
+    if( program_num < 0 ) {
+        return handlebars_string_init(CONTEXT, 0);
+    }
+
+    // Save and set buffer. The output of a nested program is appended to the enclosing one and freed, but the output
+    // of the render itself is returned, so it is only moved out of the scope of the render once it is complete
+    struct handlebars_string * prev_buffer = vm->buffer;
+    vm->buffer = handlebars_string_init(prev_buffer ? handlebars_vm_get_arena(vm) : render_scope(vm), HANDLEBARS_VM_BUFFER_INIT_SIZE);
+    vm->buffer_pins++;
+
+    handlebars_vm_execute_program_append(vm, program_num, context, data, block_params);
 
     // Restore buffer
     struct handlebars_string * buffer = vm->buffer;
     vm->buffer = prev_buffer;
+    vm->buffer_pins--;
 
-    return buffer;
+    if (!prev_buffer) {
+        buffer = talloc_steal(CONTEXT, buffer);
+    }
+
+    return handlebars_string_compact(buffer);
 }
 
 struct handlebars_string * handlebars_vm_execute_program(struct handlebars_vm * vm, long program, struct handlebars_value * context)
@@ -1376,13 +1997,58 @@ struct handlebars_string * handlebars_vm_execute_program(struct handlebars_vm *
     return handlebars_vm_execute_program_ex(vm, program, context, NULL, NULL);
 }
 
-struct handlebars_string * handlebars_vm_execute_ex(
+size_t handlebars_vm_buffer_mark(struct handlebars_vm * vm)
+{
+    vm->buffer_pins++;
+    return vm->buffer ? hbs_str_len(vm->buffer) : 0;
+}
+
+void handlebars_vm_buffer_rollback(struct handlebars_vm * vm, size_t mark)
+{
+    assert(vm->buffer_pins > 0);
+    vm->buffer_pins--;
+
+    if (vm->buffer && mark < hbs_str_len(vm->buffer)) {
+        vm->buffer = handlebars_string_truncate(vm->buffer, 0, mark);
+    }
+}
+
+struct handlebars_string * handlebars_vm_buffer_capture(struct handlebars_vm * vm, size_t mark)
+{
+    struct handlebars_string * str;
+
+    if (!vm->buffer || mark >= hbs_str_len(vm->buffer)) {
+        str = handlebars_string_init(handlebars_vm_get_arena(vm), 0);
+    } else {
+        str = handlebars_string_ctor(
+            handlebars_vm_get_arena(vm),
+            hbs_str_val(vm->buffer) + mark,
+            hbs_str_len(vm->buffer) - mark
+        );
+    }
+
+    handlebars_vm_buffer_rollback(vm, mark);
+    return str;
+}
+
+void handlebars_vm_buffer_indent(struct handlebars_vm * vm, size_t mark, struct handlebars_string * indent)
+{
+    assert(vm->buffer_pins > 0);
+    vm->buffer_pins--;
+
+    if (vm->buffer && mark < hbs_str_len(vm->buffer)) {
+        vm->buffer = handlebars_string_indent_from(CONTEXT, vm->buffer, mark, indent);
+    }
+}
+
+static struct handlebars_string * execute_module(
     struct handlebars_vm * vm,
     struct handlebars_module * module,
     struct handlebars_value * context,
     long program,
     struct handlebars_value * data,
-    struct handlebars_value * block_params
+    struct handlebars_value * block_params,
+    bool append
 ) {
     jmp_buf * prev = HBSCTX(vm)->e->jmp;
     struct handlebars_module * prev_module = vm->module;
@@ -1390,14 +2056,20 @@ struct handlebars_string * handlebars_vm_execute_ex(
     struct handlebars_value * prev_last_context = vm->last_context;
     struct handlebars_string * prev_delim_open = vm->delim_open;
     struct handlebars_string * prev_delim_close = vm->delim_close;
+    struct handlebars_string * prev_buffer = vm->buffer;
+    long prev_depth = vm->depth;
+    size_t prev_pins = vm->buffer_pins;
 
-    struct handlebars_string * buffer = NULL;
+    struct handlebars_string * volatile buffer = NULL;
     bool volatile setup_stacks = false;
+    bool failed = false;
     jmp_buf buf;
 
-    // Save jump buffer
-    if( !prev ) {
+    // Save jump buffer. The outermost render catches errors even if there is a jump buffer, to free what the render
+    // leaves behind before passing them on
+    if( !prev || vm->stack == NULL ) {
         if( handlebars_setjmp_ex(vm, &buf) ) {
+            failed = true;
             goto done;
         }
     }
@@ -1410,6 +2082,12 @@ struct handlebars_string * handlebars_vm_execute_ex(
         vm->blockParamStack = handlebars_stack_alloca(HBSCTX(vm), HANDLEBARS_VM_STACK_SIZE);
         vm->partialBlockStack = handlebars_stack_alloca(HBSCTX(vm), HANDLEBARS_VM_STACK_SIZE);
         setup_stacks = true;
+        vm->render_data = vm->data;
+        // The helpers may have been modified since the last render
+        vm->helper_cache_generation++;
+        if (vm->partial_modules_stale) {
+            partial_modules_clear(vm);
+        }
     }
 
     if (vm->last_context == NULL) {
@@ -1421,13 +2099,24 @@ struct handlebars_string * handlebars_vm_execute_ex(
     vm->flags |= module->flags;
 
     // Execute
-    buffer = handlebars_vm_execute_program_ex(vm, program, context, data, block_params);
+    if (append) {
+        handlebars_vm_execute_program_append(vm, program, context, data, block_params);
+        buffer = vm->buffer;
+    } else {
+        buffer = handlebars_vm_execute_program_ex(vm, program, context, data, block_params);
+    }
 
 done:
     HBSCTX(vm)->e->jmp = prev;
 
     // Reset stacks
     if (setup_stacks) {
+        if (failed) {
+            vm->data = vm->render_data;
+            keep_error_message(vm);
+            render_scope_clear(vm);
+        }
+        partial_modules_free(&vm->partial_modules_evicted);
         vm->stack = NULL;
         vm->contextStack = NULL;
         vm->hashStack = NULL;
@@ -1436,15 +2125,36 @@ done:
     }
 
     // Reset
+    if (!append) {
+        vm->buffer = prev_buffer;
+    }
     vm->delim_open = prev_delim_open;
     vm->delim_close = prev_delim_close;
     vm->last_context = prev_last_context;
     vm->module = prev_module;
     vm->flags = prev_flags;
+    // Errors in nested templates unwind straight to here, past their own cleanup
+    vm->depth = prev_depth;
+    vm->buffer_pins = prev_pins;
+
+    if (failed && prev) {
+        longjmp(*prev, handlebars_error_num(HBSCTX(vm)));
+    }
 
     return buffer;
 }
 
+struct handlebars_string * handlebars_vm_execute_ex(
+    struct handlebars_vm * vm,
+    struct handlebars_module * module,
+    struct handlebars_value * context,
+    long program,
+    struct handlebars_value * data,
+    struct handlebars_value * block_params
+) {
+    return execute_module(vm, module, context, program, data, block_params, false);
+}
+
 struct handlebars_string * handlebars_vm_execute(
     struct handlebars_vm * vm,
     struct handlebars_module * module,
@@ -1452,3 +2162,60 @@ struct handlebars_string * handlebars_vm_execute(
 ) {
     return handlebars_vm_execute_ex(vm, module, context, 0, NULL, NULL);
 }
+
+void handlebars_vm_execute_sink(
+    struct handlebars_vm * vm,
+    struct handlebars_module * module,
+    struct handlebars_value * context,
+    struct handlebars_sink * sink
+) {
+    jmp_buf * prev = HBSCTX(vm)->e->jmp;
+    struct handlebars_sink * prev_sink = vm->sink;
+    size_t prev_chunk_size = vm->sink_chunk_size;
+    size_t prev_pins = vm->buffer_pins;
+    struct handlebars_string * prev_buffer = vm->buffer;
+    struct handlebars_string * buffer;
+    bool written = true;
+
+    vm->sink = sink;
+    vm->sink_chunk_size = handlebars_sink_get_chunk_size(sink);
+    vm->buffer_pins = 0;
+    if (vm->sink_buffer) {
+        vm->buffer = vm->sink_buffer;
+        vm->sink_buffer = NULL;
+    } else {
+        vm->buffer = handlebars_string_init(CONTEXT, HANDLEBARS_VM_BUFFER_INIT_SIZE);
+    }
+
+    // If the render fails, the buffer is freed with its scope
+    vm->buffer = talloc_steal(render_scope(vm), vm->buffer);
+
+    // Let execute_module catch errors so the VM can be restored before they are passed on
+    HBSCTX(vm)->e->jmp = NULL;
+    buffer = execute_module(vm, module, context, 0, NULL, NULL, true);
+    HBSCTX(vm)->e->jmp = prev;
+
+    if (buffer) {
+        written = handlebars_sink_write(sink, hbs_str_val(buffer), hbs_str_len(buffer));
+        // Keep the buffer for the next render, unless a nested render already left one
+        if (vm->sink_buffer == NULL) {
+            vm->sink_buffer = handlebars_string_truncate(talloc_steal(CONTEXT, buffer), 0, 0);
+        } else {
+            handlebars_talloc_free(buffer);
+        }
+    }
+
+    // Restore
+    vm->buffer = prev_buffer;
+    vm->buffer_pins = prev_pins;
+    vm->sink = prev_sink;
+    vm->sink_chunk_size = prev_chunk_size;
+
+    if (!buffer) {
+        if (prev) {
+            longjmp(*prev, HBSCTX(vm)->e->num);
+        }
+    } else if (!written) {
+        handlebars_throw(CONTEXT, HANDLEBARS_ERROR, "Failed to write to the output sink");
+    }
+}
@@ -28,6 +28,7 @@ struct handlebars_context;
 struct handlebars_map;
 struct handlebars_module;
 struct handlebars_options;
+struct handlebars_sink;
 struct handlebars_vm;
 
 #ifndef HANDLEBARS_VM_STACK_SIZE
@@ -38,6 +39,28 @@ struct handlebars_vm;
 #define HANDLEBARS_VM_BUFFER_INIT_SIZE 128
 #endif
 
+//! Number of helper names the VM remembers the resolution of during a render, must be a power of two
+#ifndef HANDLEBARS_VM_HELPER_CACHE_SIZE
+#define HANDLEBARS_VM_HELPER_CACHE_SIZE 32
+#endif
+
+//! Number of buckets of the table of string partials compiled by the VM, must be a power of two
+#ifndef HANDLEBARS_VM_PARTIAL_MODULES_SIZE
+#define HANDLEBARS_VM_PARTIAL_MODULES_SIZE 16
+#endif
+
+//! Number of string partials compiled by the VM that each bucket keeps. When a bucket is full, adding a partial to it
+//! releases the one used least recently
+#ifndef HANDLEBARS_VM_PARTIAL_MODULES_BUCKET_SIZE
+#define HANDLEBARS_VM_PARTIAL_MODULES_BUCKET_SIZE 4
+#endif
+
+//! Default size in bytes, including talloc's chunk headers, of the memory pool the VM makes the allocations that do
+//! not outlive a render in, see #handlebars_vm_get_arena
+#ifndef HANDLEBARS_VM_ARENA_SIZE
+#define HANDLEBARS_VM_ARENA_SIZE 65536
+#endif
+
 extern const size_t HANDLEBARS_VM_SIZE;
 
 /**
@@ -58,6 +81,29 @@ void handlebars_vm_dtor(
     struct handlebars_vm * vm
 ) HBS_ATTR_NONNULL_ALL;
 
+/**
+ * @brief Reset a VM so that it can be used for another render. Clears the state of the previous render, including
+ *        any left behind by an error, and releases the partials compiled by the VM, but keeps the helpers,
+ *        partials, data, flags, cache and logger, as well as the output buffer of #handlebars_vm_execute_sink. This
+ *        is cheaper than constructing a new VM for every render.
+ * @param[in] vm The VM to reset
+ * @return void
+ */
+void handlebars_vm_reset(
+    struct handlebars_vm * vm
+) HBS_ATTR_NONNULL_ALL;
+
+/**
+ * @brief Link a module, resolving the VM handler of each opcode so that executing it does not have to look them up.
+ *        Modules are linked on first execution, or when they are added to a cache. The handlers are only valid in
+ *        the current process, and are reset by #handlebars_module_normalize_pointers.
+ * @param[in] module The module
+ * @return void
+ */
+void handlebars_vm_link(
+    struct handlebars_module * module
+) HBS_ATTR_NONNULL_ALL;
+
 struct handlebars_string * handlebars_vm_execute(
     struct handlebars_vm * vm,
     struct handlebars_module * module,
@@ -73,6 +119,23 @@ struct handlebars_string * handlebars_vm_execute_ex(
     struct handlebars_value * block_params
 ) HBS_ATTR_NONNULL(1, 2, 3) HBS_ATTR_RETURNS_NONNULL HBS_ATTR_NOINLINE;
 
+/**
+ * @brief Execute a module, writing the output into a sink as it is produced instead of returning it as a string.
+ *        The output is passed to the sink in chunks of roughly the sink's chunk size. Output that may still have
+ *        to be rolled back or indented, e.g. of a partial, is held back until it is final.
+ * @param[in] vm The VM
+ * @param[in] module The module
+ * @param[in] context The context
+ * @param[in] sink The sink
+ * @return void
+ */
+void handlebars_vm_execute_sink(
+    struct handlebars_vm * vm,
+    struct handlebars_module * module,
+    struct handlebars_value * context,
+    struct handlebars_sink * sink
+) HBS_ATTR_NONNULL_ALL HBS_ATTR_NOINLINE;
+
 struct handlebars_string * handlebars_vm_execute_program(
     struct handlebars_vm * vm,
     long program,
@@ -87,6 +150,70 @@ struct handlebars_string * handlebars_vm_execute_program_ex(
     struct handlebars_value * block_params
 ) HBS_ATTR_NONNULL(1, 3) HBS_ATTR_RETURNS_NONNULL HBS_ATTR_WARN_UNUSED_RESULT;
 
+/**
+ * @brief Execute a program, appending its output to the output buffer of the program currently being executed
+ *        instead of returning a new string. May only be called during execution, e.g. from a helper.
+ * @param[in] vm The VM
+ * @param[in] program The program number
+ * @param[in] context The context
+ * @param[in] data The data, may be NULL
+ * @param[in] block_params The block params, may be NULL
+ * @return void
+ */
+void handlebars_vm_execute_program_append(
+    struct handlebars_vm * vm,
+    long program,
+    struct handlebars_value * context,
+    struct handlebars_value * data,
+    struct handlebars_value * block_params
+) HBS_ATTR_NONNULL(1, 3);
+
+/**
+ * @brief Get the current length of the output buffer, for use with #handlebars_vm_buffer_rollback,
+ *        #handlebars_vm_buffer_capture and #handlebars_vm_buffer_indent. The output buffer is not flushed to a sink
+ *        until the mark is released by exactly one call to any of them.
+ * @param[in] vm The VM
+ * @return The mark
+ */
+size_t handlebars_vm_buffer_mark(
+    struct handlebars_vm * vm
+) HBS_ATTR_NONNULL_ALL HBS_ATTR_WARN_UNUSED_RESULT;
+
+/**
+ * @brief Discard all output appended to the output buffer since the given mark
+ * @param[in] vm The VM
+ * @param[in] mark The mark
+ * @return void
+ */
+void handlebars_vm_buffer_rollback(
+    struct handlebars_vm * vm,
+    size_t mark
+) HBS_ATTR_NONNULL_ALL;
+
+/**
+ * @brief Move all output appended to the output buffer since the given mark into a new string
+ * @param[in] vm The VM
+ * @param[in] mark The mark
+ * @return The output since the mark
+ */
+struct handlebars_string * handlebars_vm_buffer_capture(
+    struct handlebars_vm * vm,
+    size_t mark
+) HBS_ATTR_NONNULL_ALL HBS_ATTR_RETURNS_NONNULL HBS_ATTR_WARN_UNUSED_RESULT;
+
+/**
+ * @brief Indent all output appended to the output buffer since the given mark, in place
+ * @param[in] vm The VM
+ * @param[in] mark The mark
+ * @param[in] indent The indent
+ * @return void
+ */
+void handlebars_vm_buffer_indent(
+    struct handlebars_vm * vm,
+    size_t mark,
+    struct handlebars_string * indent
+) HBS_ATTR_NONNULL_ALL;
+
 struct handlebars_value * handlebars_vm_call_helper_str(
     const char * name,
     unsigned int len,
@@ -107,6 +234,31 @@ void handlebars_vm_set_logger(struct handlebars_vm * vm, handlebars_func log_fun
 handlebars_func handlebars_vm_get_log_func(struct handlebars_vm * vm);
 void * handlebars_vm_get_log_ctx(struct handlebars_vm * vm);
 
+/**
+ * @brief Set the size of the arena of the VM, see #handlebars_vm_get_arena. Must not be called during a render.
+ * @param[in] vm The VM
+ * @param[in] size The size in bytes, 0 to disable the arena
+ * @return void
+ */
+void handlebars_vm_set_arena_size(
+    struct handlebars_vm * vm,
+    size_t size
+) HBS_ATTR_NONNULL_ALL;
+
+/**
+ * @brief Get the context to make allocations in that do not outlive the current render, e.g. the output of a block
+ *        or the data of a loop. During a render, this is a talloc pooled object: allocating in it just bumps a
+ *        pointer, and its memory is reused by the next render once everything allocated in it was freed. Nothing
+ *        allocated in it may escape the render: whatever is left in it by a failed render is freed before the error
+ *        is passed on. If the arena is disabled, this is a plain context freed the same way. Outside of a render,
+ *        this is the VM itself.
+ * @param[in] vm The VM
+ * @return The context
+ */
+struct handlebars_context * handlebars_vm_get_arena(
+    struct handlebars_vm * vm
+) HBS_ATTR_NONNULL_ALL HBS_ATTR_RETURNS_NONNULL;
+
 HBS_EXTERN_C_END
 
 #endif /* HANDLEBARS_VM_H */
@@ -21,14 +21,43 @@
 #include "handlebars.h"
 #include "handlebars_types.h"
 #include "handlebars_value_private.h"
+#include "handlebars_vm.h"
 
 HBS_EXTERN_C_START
 
 struct handlebars_cache;
 struct handlebars_module;
+struct handlebars_sink;
 struct handlebars_string;
 struct handlebars_stack;
 
+//! Helper names longer than this are not cached
+#define HANDLEBARS_VM_HELPER_CACHE_NAME_SIZE 32
+
+/**
+ * @brief The resolution of a helper name, valid for the render it was filled in
+ */
+struct handlebars_vm_helper_cache_entry {
+    //! The handlebars_vm#helper_cache_generation the entry was filled in, or zero if it is empty
+    unsigned long generation;
+    uint32_t hash;
+    size_t len;
+    char name[HANDLEBARS_VM_HELPER_CACHE_NAME_SIZE];
+    //! The helper in handlebars_vm#helpers, or NULL
+    struct handlebars_value * helper;
+    //! The builtin helper, or NULL
+    handlebars_helper_func builtin;
+};
+
+/**
+ * @brief A string partial compiled by the VM
+ */
+struct handlebars_vm_partial_module {
+    struct handlebars_vm_partial_module * next;
+    struct handlebars_string * tmpl;
+    struct handlebars_module * module;
+};
+
 struct handlebars_vm {
     struct handlebars_context ctx;
     struct handlebars_cache * cache;
@@ -40,10 +69,38 @@ struct handlebars_vm {
 
     struct handlebars_string * buffer;
 
+    //! The sink the output buffer is flushed into, if any
+    struct handlebars_sink * sink;
+    size_t sink_chunk_size;
+    //! The output buffer is not flushed while this is non-zero, i.e. while a mark is held or a nested buffer is active
+    size_t buffer_pins;
+    //! The output buffer of the last sink render, truncated and reused by the next one
+    struct handlebars_string * sink_buffer;
+
     struct handlebars_value data;
+    //! A copy of #data from the start of the render, without a reference of its own. Blocks replace the data while
+    //! they run, and the reference to the replaced data is kept by the frame of the block, so an error leaves the
+    //! replacement in place
+    struct handlebars_value render_data;
     struct handlebars_value helpers;
     struct handlebars_value partials;
 
+    //! An empty map shared by all helper calls without hash arguments. It has no capacity, so adding to it always
+    //! copies it
+    struct handlebars_value empty_hash;
+
+    //! Incremented for every render and whenever the helpers change, to invalidate the helper cache
+    unsigned long helper_cache_generation;
+    struct handlebars_vm_helper_cache_entry helper_cache[HANDLEBARS_VM_HELPER_CACHE_SIZE];
+
+    //! String partials compiled while no cache is set, keyed by their content, the most recently used first
+    struct handlebars_vm_partial_module * partial_modules[HANDLEBARS_VM_PARTIAL_MODULES_SIZE];
+    //! Compiled partials dropped from a full bucket during a render. They may still be executing, so they are only
+    //! released once the render is done
+    struct handlebars_vm_partial_module * partial_modules_evicted;
+    //! Set when the partials are replaced, the compiled partials are then released before the next render
+    bool partial_modules_stale;
+
     struct handlebars_string * last_helper;
     struct handlebars_value * last_context;
 
@@ -58,6 +115,18 @@ struct handlebars_vm {
 
     struct handlebars_string * delim_open;
     struct handlebars_string * delim_close;
+
+    //! Parent of the allocations of the current render that must not outlive it, including the arena and the
+    //! templates it compiles, created on first use. They are freed as the render goes, so whatever is left in it was
+    //! left by a failed render
+    struct handlebars_context * scope;
+
+    //! The message of the last error of a render, moved out of #scope
+    char * error_msg;
+
+    //! The pooled context returned by #handlebars_vm_get_arena, created in #scope on first use
+    struct handlebars_context * arena;
+    size_t arena_size;
 };
 
 HBS_EXTERN_C_END
@@ -24,6 +24,7 @@
 #include "handlebars.h"
 #include "handlebars_private.h"
 #include "handlebars_memory.h"
+#include "handlebars_value_private.h"
 #include "handlebars_map.h"
 #include "handlebars_stack.h"
 #include "handlebars_string.h"
@@ -44,7 +45,8 @@ static int _yaml_ctx_dtor(struct _yaml_ctx * holder)
     return 0;
 }
 
-void handlebars_value_init_yaml_node(struct handlebars_context *ctx, struct handlebars_value * value, struct yaml_document_s * document, struct yaml_node_s * node)
+//! Children of mappings and sequences may store short strings inline, since the map or array promotes them
+static void init_yaml_node(struct handlebars_context *ctx, struct handlebars_value * value, struct yaml_document_s * document, struct yaml_node_s * node, bool child)
 {
     HANDLEBARS_VALUE_DECL(tmp);
     yaml_node_pair_t * pair;
@@ -58,7 +60,7 @@ void handlebars_value_init_yaml_node(struct handlebars_context *ctx, struct hand
                 yaml_node_t * keyNode = yaml_document_get_node(document, pair->key);
                 yaml_node_t * valueNode = yaml_document_get_node(document, pair->value);
                 assert(keyNode->type == YAML_SCALAR_NODE);
-                handlebars_value_init_yaml_node(ctx, tmp, document, valueNode);
+                init_yaml_node(ctx, tmp, document, valueNode, true);
                 map = handlebars_map_str_update(map, (const char *) keyNode->data.scalar.value, keyNode->data.scalar.length, tmp);
             }
             handlebars_value_map(value, map);
@@ -68,7 +70,7 @@ void handlebars_value_init_yaml_node(struct handlebars_context *ctx, struct hand
             struct handlebars_stack * stack = handlebars_stack_ctor(ctx, node->data.sequence.items.top - node->data.sequence.items.start);
             for( item = node->data.sequence.items.start; item < node->data.sequence.items.top; item++) {
                 yaml_node_t * valueNode = yaml_document_get_node(document, *item);
-                handlebars_value_init_yaml_node(ctx, tmp, document, valueNode);
+                init_yaml_node(ctx, tmp, document, valueNode, true);
                 stack = handlebars_stack_push(stack, tmp);
             }
             handlebars_value_array(value, stack);
@@ -95,7 +97,11 @@ void handlebars_value_init_yaml_node(struct handlebars_context *ctx, struct hand
                     goto done;
                 }
                 // String
-                handlebars_value_str(value, handlebars_string_ctor(ctx, (const char *) node->data.scalar.value, node->data.scalar.length));
+                if( child ) {
+                    handlebars_value_child_strl(ctx, value, (const char *) node->data.scalar.value, node->data.scalar.length);
+                } else {
+                    handlebars_value_strl(ctx, value, (const char *) node->data.scalar.value, node->data.scalar.length);
+                }
             }
             break;
         default:
@@ -108,6 +114,11 @@ done:
     HANDLEBARS_VALUE_UNDECL(tmp);
 }
 
+void handlebars_value_init_yaml_node(struct handlebars_context *ctx, struct handlebars_value * value, struct yaml_document_s * document, struct yaml_node_s * node)
+{
+    init_yaml_node(ctx, value, document, node, false);
+}
+
 void handlebars_value_init_yaml_string(struct handlebars_context * ctx, struct handlebars_value * value, const char * yaml)
 {
     struct _yaml_ctx * yctx = handlebars_talloc_zero(ctx, struct _yaml_ctx);
@@ -421,6 +421,20 @@ load "../vendor/bats-assert/assert"
     assert_output "`cat $BENCH_DIR/templates/partial-recursion.expected`"
 }
 
+@test "partial-recursion (bundled)" {
+    skip_if_no_json
+    run $HANDLEBARSC --data $BENCH_DIR/templates/partial-recursion.json $PARTIAL_FLAGS --bundle-partials $BENCH_DIR/templates/partial-recursion.handlebars
+    assert_success
+    assert_output "`cat $BENCH_DIR/templates/partial-recursion.expected`"
+}
+
+@test "partial-recursion (reuse vm)" {
+    skip_if_no_json
+    run $HANDLEBARSC --data $BENCH_DIR/templates/partial-recursion.json $PARTIAL_FLAGS --run-count 3 --reuse-vm $BENCH_DIR/templates/partial-recursion.handlebars
+    assert_success
+    assert_output "`cat $BENCH_DIR/templates/partial-recursion.expected`"
+}
+
 @test "paths" {
     skip_if_no_json
     run $HANDLEBARSC --data $BENCH_DIR/templates/paths.json $BENCH_DIR/templates/paths.handlebars
@@ -341,6 +341,223 @@ START_TEST(test_map_remove_nonexist)
 }
 END_TEST
 
+START_TEST(test_map_remove_compact)
+{
+    struct handlebars_map * map = handlebars_map_ctor(context, 64);
+    struct handlebars_string * keys[40];
+    size_t i;
+    HANDLEBARS_VALUE_DECL(value);
+
+    for (i = 0; i < 40; i++) {
+        char tmp[32];
+        snprintf(tmp, sizeof(tmp), "%zu", i);
+        keys[i] = handlebars_string_ctor(context, tmp, strlen(tmp));
+        handlebars_string_addref(keys[i]);
+        handlebars_value_integer(value, i);
+        map = handlebars_map_add(map, keys[i], value);
+    }
+
+    // Remove the first key and every third one, then add them back a few times. This should neither grow the map
+    // nor lose any keys
+    struct handlebars_map * prev_map = map;
+    for (i = 0; i < 40; i += 3) {
+        map = handlebars_map_remove(map, keys[i]);
+        ck_assert_ptr_eq(handlebars_map_find(map, keys[i]), NULL);
+    }
+    ck_assert_uint_eq(handlebars_map_count(map), 26);
+    ck_assert(handlebars_map_is_sparse(map));
+
+    handlebars_map_sparse_array_compact(map);
+    ck_assert(!handlebars_map_is_sparse(map));
+    ck_assert_ptr_eq(handlebars_map_get_key_at_index(map, 0), keys[1]);
+    ck_assert_ptr_eq(handlebars_map_get_key_at_index(map, 25), keys[38]);
+
+    for (i = 0; i < 40; i++) {
+        struct handlebars_value * found = handlebars_map_find(map, keys[i]);
+        if (i % 3 == 0) {
+            ck_assert_ptr_eq(found, NULL);
+        } else {
+            ck_assert_ptr_ne(found, NULL);
+            ck_assert_int_eq(handlebars_value_get_intval(found), i);
+        }
+    }
+    ck_assert_ptr_eq(map, prev_map);
+
+    for (i = 0; i < 40; i += 3) {
+        handlebars_value_integer(value, i);
+        map = handlebars_map_add(map, keys[i], value);
+    }
+    ck_assert_uint_eq(handlebars_map_count(map), 40);
+    for (i = 0; i < 40; i++) {
+        ck_assert_int_eq(handlebars_value_get_intval(handlebars_map_find(map, keys[i])), i);
+        handlebars_string_delref(keys[i]);
+    }
+
+    handlebars_map_delref(map);
+    HANDLEBARS_VALUE_UNDECL(value);
+    ASSERT_INIT_BLOCKS();
+}
+END_TEST
+
+START_TEST(test_map_small)
+{
+    struct handlebars_map * map = handlebars_map_ctor(context, 0);
+    struct handlebars_string * keys[HANDLEBARS_MAP_SMALL_SIZE * 2];
+    size_t count = sizeof(keys) / sizeof(keys[0]);
+    size_t i;
+    size_t j;
+    HANDLEBARS_VALUE_DECL(value);
+
+    // Keys of the same length that only differ in their last byte, looked up both by a string and by a buffer
+    for (i = 0; i < count; i++) {
+        char tmp[32];
+        snprintf(tmp, sizeof(tmp), "key%02zu", i);
+        keys[i] = handlebars_string_ctor(context, tmp, strlen(tmp));
+        handlebars_string_addref(keys[i]);
+        handlebars_value_integer(value, i);
+        map = handlebars_map_add(map, keys[i], value);
+        ck_assert_uint_eq(handlebars_map_count(map), i + 1);
+        ck_assert_int_le(handlebars_map_load_factor(map), 100);
+
+        for (j = 0; j <= i; j++) {
+            ck_assert_int_eq(handlebars_value_get_intval(handlebars_map_find(map, keys[j])), j);
+            ck_assert_int_eq(handlebars_value_get_intval(handlebars_map_str_find(map, hbs_str_val(keys[j]), hbs_str_len(keys[j]))), j);
+        }
+        ck_assert_ptr_eq(handlebars_map_str_find(map, HBS_STRL("key99")), NULL);
+        ck_assert_ptr_eq(handlebars_map_str_find(map, HBS_STRL("key0")), NULL);
+    }
+
+    // Removing from and compacting a small map keeps the other keys in order
+    struct handlebars_map * small = handlebars_map_ctor(context, 4);
+    for (i = 0; i < 4; i++) {
+        handlebars_value_integer(value, i);
+        small = handlebars_map_add(small, keys[i], value);
+    }
+    small = handlebars_map_str_remove(small, HBS_STRL("key01"));
+    small = handlebars_map_remove(small, keys[3]);
+    ck_assert_uint_eq(handlebars_map_count(small), 2);
+    ck_assert(handlebars_map_is_sparse(small));
+    handlebars_map_sparse_array_compact(small);
+    ck_assert_ptr_eq(handlebars_map_get_key_at_index(small, 0), keys[0]);
+    ck_assert_ptr_eq(handlebars_map_get_key_at_index(small, 1), keys[2]);
+    ck_assert_ptr_eq(handlebars_map_find(small, keys[1]), NULL);
+    ck_assert_int_eq(handlebars_value_get_intval(handlebars_map_find(small, keys[2])), 2);
+    handlebars_value_integer(value, 3);
+    small = handlebars_map_add(small, keys[3], value);
+    ck_assert_int_eq(handlebars_value_get_intval(handlebars_map_find(small, keys[3])), 3);
+    handlebars_map_delref(small);
+
+    // Keys of the same length with the same 32-bit hash are still different keys
+    struct handlebars_string * colliding = handlebars_string_ctor(context, HBS_STRL("k00004a1"));
+    handlebars_string_addref(colliding);
+    ck_assert_uint_eq(hbs_str_hash(colliding), handlebars_string_hash(HBS_STRL("k00ba1cf")));
+    small = handlebars_map_ctor(context, 2);
+    handlebars_value_integer(value, 1);
+    small = handlebars_map_add(small, colliding, value);
+    ck_assert_ptr_eq(handlebars_map_str_find(small, HBS_STRL("k00ba1cf")), NULL);
+    struct handlebars_string * other = handlebars_string_ctor(context, HBS_STRL("k00ba1cf"));
+    ck_assert_ptr_eq(handlebars_map_find(small, other), NULL);
+    handlebars_map_delref(small);
+    handlebars_talloc_free(other);
+    handlebars_string_delref(colliding);
+
+    for (i = 0; i < count; i++) {
+        handlebars_string_delref(keys[i]);
+    }
+
+    handlebars_map_delref(map);
+    HANDLEBARS_VALUE_UNDECL(value);
+    ASSERT_INIT_BLOCKS();
+}
+END_TEST
+
+START_TEST(test_map_colliding_keys)
+{
+    struct handlebars_map * map = handlebars_map_ctor(context, 0);
+    struct handlebars_string * keys[300];
+    size_t count = sizeof(keys) / sizeof(keys[0]);
+    unsigned long counter = 0;
+    size_t i;
+    HANDLEBARS_VALUE_DECL(value);
+
+    // Keys that all start probing in the same group, which should make the map switch to a seeded hash
+    for (i = 0; i < count; i++) {
+        char tmp[32];
+        size_t len;
+        do {
+            len = (size_t) snprintf(tmp, sizeof(tmp), "key%lx", counter++);
+        } while (handlebars_string_hash(tmp, len) & (0xFF << 7));
+        keys[i] = handlebars_string_ctor(context, tmp, len);
+        handlebars_string_addref(keys[i]);
+        handlebars_value_integer(value, i);
+        map = handlebars_map_add(map, keys[i], value);
+        if (i == HANDLEBARS_MAP_SMALL_SIZE) {
+            ck_assert(!handlebars_map_is_seeded(map));
+        }
+    }
+
+    // The probe length passed HANDLEBARS_MAP_MAX_PROBE long before the last key
+    ck_assert(handlebars_map_is_seeded(map));
+    ck_assert_uint_eq(handlebars_map_count(map), count);
+    handlebars_map_foreach(map, index, key, v) {
+        ck_assert_ptr_eq(key, keys[index]);
+        ck_assert_int_eq(handlebars_value_get_intval(v), index);
+    } handlebars_map_foreach_end(map);
+
+    for (i = 0; i < count; i += 2) {
+        map = handlebars_map_str_remove(map, hbs_str_val(keys[i]), hbs_str_len(keys[i]));
+    }
+    ck_assert_uint_eq(handlebars_map_count(map), count / 2);
+    for (i = 0; i < count; i++) {
+        struct handlebars_value * found = handlebars_map_find(map, keys[i]);
+        if (i % 2 == 0) {
+            ck_assert_ptr_eq(found, NULL);
+        } else {
+            ck_assert_int_eq(handlebars_value_get_intval(found), i);
+            found = handlebars_map_str_find(map, hbs_str_val(keys[i]), hbs_str_len(keys[i]));
+            ck_assert_int_eq(handlebars_value_get_intval(found), i);
+        }
+        handlebars_string_delref(keys[i]);
+    }
+
+    handlebars_map_delref(map);
+    HANDLEBARS_VALUE_UNDECL(value);
+    ASSERT_INIT_BLOCKS();
+}
+END_TEST
+
+START_TEST(test_map_colliding_hashes)
+{
+    struct handlebars_map * map = handlebars_map_ctor(context, HANDLEBARS_MAP_SMALL_SIZE * 2);
+    struct handlebars_string * key = handlebars_string_ctor(context, HBS_STRL("k00004a1"));
+    struct handlebars_string * other = handlebars_string_ctor(context, HBS_STRL("k00ba1cf"));
+    HANDLEBARS_VALUE_DECL(value);
+
+    // Keys of the same length with the same 32-bit hash are still different keys in the hash table
+    handlebars_string_addref(key);
+    handlebars_string_addref(other);
+    ck_assert_uint_eq(hbs_str_hash(key), hbs_str_hash(other));
+    handlebars_value_integer(value, 1);
+    map = handlebars_map_add(map, key, value);
+    ck_assert(!handlebars_map_is_seeded(map));
+    ck_assert_ptr_eq(handlebars_map_find(map, other), NULL);
+    ck_assert_ptr_eq(handlebars_map_str_find(map, HBS_STRL("k00ba1cf")), NULL);
+
+    handlebars_value_integer(value, 2);
+    map = handlebars_map_add(map, other, value);
+    ck_assert_uint_eq(handlebars_map_count(map), 2);
+    ck_assert_int_eq(handlebars_value_get_intval(handlebars_map_find(map, key)), 1);
+    ck_assert_int_eq(handlebars_value_get_intval(handlebars_map_find(map, other)), 2);
+    ck_assert_int_eq(handlebars_value_get_intval(handlebars_map_str_find(map, HBS_STRL("k00ba1cf"))), 2);
+
+    handlebars_map_delref(map);
+    handlebars_string_delref(other);
+    handlebars_string_delref(key);
+    HANDLEBARS_VALUE_UNDECL(value);
+    ASSERT_INIT_BLOCKS();
+}
+END_TEST
+
 static Suite * suite(void);
 static Suite * suite(void)
 {
@@ -355,6 +572,10 @@ static Suite * suite(void)
 #endif
     REGISTER_TEST_FIXTURE(s, test_map_sizeof, "Map sizeof");
     REGISTER_TEST_FIXTURE(s, test_map_remove_nonexist, "Map remove noexistent key");
+    REGISTER_TEST_FIXTURE(s, test_map_remove_compact, "Map remove and compact");
+    REGISTER_TEST_FIXTURE(s, test_map_small, "Map without a hash table");
+    REGISTER_TEST_FIXTURE(s, test_map_colliding_keys, "Map with colliding keys");
+    REGISTER_TEST_FIXTURE(s, test_map_colliding_hashes, "Map with colliding hashes");
 
     return s;
 }
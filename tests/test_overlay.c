@@ -0,0 +1,228 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <check.h>
+#include <talloc.h>
+
+#include "handlebars.h"
+#include "handlebars_memory.h"
+
+#include "handlebars_map.h"
+#include "handlebars_overlay.h"
+#include "handlebars_string.h"
+#include "handlebars_value.h"
+#include "handlebars_value_handlers.h"
+
+#include "utils.h"
+
+
+
+static void make_layers(struct handlebars_value * top, struct handlebars_value * parent)
+{
+    HANDLEBARS_VALUE_DECL(tmp);
+    struct handlebars_map * map;
+
+    map = handlebars_map_ctor(context, 3);
+    handlebars_value_integer(tmp, 1);
+    map = handlebars_map_str_add(map, HBS_STRL("a"), tmp);
+    handlebars_value_integer(tmp, 2);
+    map = handlebars_map_str_add(map, HBS_STRL("b"), tmp);
+    handlebars_value_integer(tmp, 3);
+    map = handlebars_map_str_add(map, HBS_STRL("c"), tmp);
+    handlebars_value_map(parent, map);
+
+    map = handlebars_map_ctor(context, 2);
+    handlebars_value_integer(tmp, 4);
+    map = handlebars_map_str_add(map, HBS_STRL("d"), tmp);
+    handlebars_value_integer(tmp, 5);
+    map = handlebars_map_str_add(map, HBS_STRL("b"), tmp);
+    handlebars_value_map(top, map);
+
+    HANDLEBARS_VALUE_UNDECL(tmp);
+}
+
+START_TEST(test_overlay_find)
+{
+    HANDLEBARS_VALUE_DECL(top);
+    HANDLEBARS_VALUE_DECL(parent);
+    HANDLEBARS_VALUE_DECL(overlay);
+    HANDLEBARS_VALUE_DECL(tmp);
+
+    make_layers(top, parent);
+    handlebars_value_overlay_init(context, top, parent, overlay);
+
+    ck_assert_int_eq(HANDLEBARS_VALUE_TYPE_MAP, handlebars_value_get_type(overlay));
+    ck_assert_int_eq(4, handlebars_value_count(overlay));
+    ck_assert_int_eq(1, handlebars_value_get_intval(handlebars_value_map_str_find(overlay, HBS_STRL("a"), tmp)));
+    ck_assert_int_eq(5, handlebars_value_get_intval(handlebars_value_map_str_find(overlay, HBS_STRL("b"), tmp)));
+    ck_assert_int_eq(4, handlebars_value_get_intval(handlebars_value_map_str_find(overlay, HBS_STRL("d"), tmp)));
+    ck_assert_ptr_eq(NULL, handlebars_value_map_str_find(overlay, HBS_STRL("e"), tmp));
+
+    HANDLEBARS_VALUE_UNDECL(tmp);
+    HANDLEBARS_VALUE_UNDECL(overlay);
+    HANDLEBARS_VALUE_UNDECL(parent);
+    HANDLEBARS_VALUE_UNDECL(top);
+}
+END_TEST
+
+START_TEST(test_overlay_iterator)
+{
+    HANDLEBARS_VALUE_DECL(top);
+    HANDLEBARS_VALUE_DECL(parent);
+    HANDLEBARS_VALUE_DECL(overlay);
+    const char * keys[] = {"a", "b", "c", "d"};
+    const long values[] = {1, 5, 3, 4};
+    size_t i = 0;
+
+    make_layers(top, parent);
+    handlebars_value_overlay_init(context, top, parent, overlay);
+
+    // The keys of the parent come first, as if the top layer was merged into a copy of it
+    HANDLEBARS_VALUE_FOREACH_KV(overlay, key, child) {
+        ck_assert_uint_lt(i, 4);
+        ck_assert_hbs_str_eq_cstr(key, keys[i]);
+        ck_assert_int_eq(values[i], handlebars_value_get_intval(child));
+        i++;
+    } HANDLEBARS_VALUE_FOREACH_END();
+    ck_assert_uint_eq(4, i);
+
+    // Iterating again sees the same keys
+    i = 0;
+    HANDLEBARS_VALUE_FOREACH(overlay, child) {
+        ck_assert_int_eq(values[i], handlebars_value_get_intval(child));
+        i++;
+    } HANDLEBARS_VALUE_FOREACH_END();
+    ck_assert_uint_eq(4, i);
+
+    HANDLEBARS_VALUE_UNDECL(overlay);
+    HANDLEBARS_VALUE_UNDECL(parent);
+    HANDLEBARS_VALUE_UNDECL(top);
+}
+END_TEST
+
+START_TEST(test_overlay_iterator_layer_changes)
+{
+    HANDLEBARS_VALUE_DECL(top);
+    HANDLEBARS_VALUE_DECL(parent);
+    HANDLEBARS_VALUE_DECL(overlay);
+    struct handlebars_value * b;
+    long sum = 0;
+
+    make_layers(top, parent);
+    handlebars_value_overlay_init(context, top, parent, overlay);
+
+    HANDLEBARS_VALUE_FOREACH(overlay, child) {
+        sum += handlebars_value_get_intval(child);
+    } HANDLEBARS_VALUE_FOREACH_END();
+    ck_assert_int_eq(13, sum);
+
+    // A value updated in place in a layer, as #each does with its loop metadata, is seen by the next iteration
+    b = handlebars_map_str_find(handlebars_value_get_map(top), HBS_STRL("b"));
+    ck_assert_ptr_ne(NULL, b);
+    handlebars_value_integer(b, 50);
+
+    sum = 0;
+    HANDLEBARS_VALUE_FOREACH(overlay, child) {
+        sum += handlebars_value_get_intval(child);
+    } HANDLEBARS_VALUE_FOREACH_END();
+    ck_assert_int_eq(58, sum);
+
+    HANDLEBARS_VALUE_UNDECL(overlay);
+    HANDLEBARS_VALUE_UNDECL(parent);
+    HANDLEBARS_VALUE_UNDECL(top);
+}
+END_TEST
+
+START_TEST(test_overlay_copy)
+{
+    HANDLEBARS_VALUE_DECL(top);
+    HANDLEBARS_VALUE_DECL(parent);
+    HANDLEBARS_VALUE_DECL(overlay);
+    HANDLEBARS_VALUE_DECL(tmp);
+    struct handlebars_value * copy;
+    size_t i = 0;
+
+    make_layers(top, parent);
+    handlebars_value_overlay_init(context, top, parent, overlay);
+
+    copy = handlebars_value_get_handlers(overlay)->copy(overlay);
+    ck_assert_ptr_ne(NULL, copy);
+    ck_assert_ptr_ne(handlebars_value_get_user(overlay), handlebars_value_get_user(copy));
+    ck_assert_int_eq(HANDLEBARS_VALUE_TYPE_MAP, handlebars_value_get_type(copy));
+    ck_assert_int_eq(4, handlebars_value_count(copy));
+    ck_assert_int_eq(5, handlebars_value_get_intval(handlebars_value_map_str_find(copy, HBS_STRL("b"), tmp)));
+
+    // The copy outlives the original
+    handlebars_value_dtor(overlay);
+    HANDLEBARS_VALUE_FOREACH(copy, child) {
+        (void) child;
+        i++;
+    } HANDLEBARS_VALUE_FOREACH_END();
+    ck_assert_uint_eq(4, i);
+
+    handlebars_value_dtor(copy);
+    handlebars_talloc_free(copy);
+
+    HANDLEBARS_VALUE_UNDECL(tmp);
+    HANDLEBARS_VALUE_UNDECL(overlay);
+    HANDLEBARS_VALUE_UNDECL(parent);
+    HANDLEBARS_VALUE_UNDECL(top);
+}
+END_TEST
+
+START_TEST(test_overlay_convert)
+{
+    HANDLEBARS_VALUE_DECL(top);
+    HANDLEBARS_VALUE_DECL(parent);
+    HANDLEBARS_VALUE_DECL(overlay);
+
+    make_layers(top, parent);
+    handlebars_value_overlay_init(context, top, parent, overlay);
+    handlebars_value_convert(overlay);
+
+    ck_assert_int_eq(HANDLEBARS_VALUE_TYPE_MAP, handlebars_value_get_real_type(overlay));
+    ck_assert_int_eq(4, handlebars_value_count(overlay));
+    ck_assert_hbs_str_eq_cstr(handlebars_map_get_key_at_index(handlebars_value_get_map(overlay), 3), "d");
+
+    HANDLEBARS_VALUE_UNDECL(overlay);
+    HANDLEBARS_VALUE_UNDECL(parent);
+    HANDLEBARS_VALUE_UNDECL(top);
+}
+END_TEST
+
+static Suite * suite(void);
+static Suite * suite(void)
+{
+    Suite * s = suite_create("Overlay");
+
+    REGISTER_TEST_FIXTURE(s, test_overlay_find, "Overlay find");
+    REGISTER_TEST_FIXTURE(s, test_overlay_iterator, "Overlay iterator");
+    REGISTER_TEST_FIXTURE(s, test_overlay_iterator_layer_changes, "Overlay iterator with layer changes");
+    REGISTER_TEST_FIXTURE(s, test_overlay_copy, "Overlay copy");
+    REGISTER_TEST_FIXTURE(s, test_overlay_convert, "Overlay convert");
+
+    return s;
+}
+
+int main(void)
+{
+    return default_main(&suite);
+}
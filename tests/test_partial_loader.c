@@ -24,6 +24,7 @@
 #include <talloc.h>
 
 #include "handlebars.h"
+#include "handlebars_bundle.h"
 #include "handlebars_compiler.h"
 #include "handlebars_helpers.h"
 #include "handlebars_json.h"
@@ -40,7 +41,7 @@
 
 
 
-static struct handlebars_string * execute_template(const char *template)
+static struct handlebars_string * execute_template_ex(const char *template, bool bundle)
 {
     struct handlebars_string *retval = NULL;
     struct handlebars_module * module;
@@ -62,9 +63,6 @@ static struct handlebars_string * execute_template(const char *template)
         return NULL;
     }
 
-    // Serialize
-    module = handlebars_program_serialize(context, program);
-
     // Setup helpers
     HANDLEBARS_VALUE_DECL(helpers);
     handlebars_value_map(helpers, handlebars_map_ctor(HBSCTX(vm), 0));
@@ -79,13 +77,18 @@ static struct handlebars_string * execute_template(const char *template)
         path = handlebars_string_ctor(HBSCTX(vm), HBS_STRL("."));
     }
     HANDLEBARS_VALUE_DECL(partials);
-    handlebars_vm_set_partials(
-        vm,
-        handlebars_value_partial_loader_init(HBSCTX(vm),
-            path,
-            handlebars_string_ctor(HBSCTX(vm), HBS_STRL(".hbs")),
-            partials)
-    );
+    handlebars_value_partial_loader_init(HBSCTX(vm), path, handlebars_string_ctor(HBSCTX(vm), HBS_STRL(".hbs")), partials);
+
+    // Serialize - bundled partials must not need the loader at runtime
+    HANDLEBARS_VALUE_DECL(empty_partials);
+    if (bundle) {
+        module = handlebars_program_bundle(context, program, partials);
+        handlebars_value_map(empty_partials, handlebars_map_ctor(HBSCTX(vm), 0));
+        handlebars_vm_set_partials(vm, empty_partials);
+    } else {
+        module = handlebars_program_serialize(context, program);
+        handlebars_vm_set_partials(vm, partials);
+    }
 
     // setup context
     HANDLEBARS_VALUE_DECL(input);
@@ -106,6 +109,7 @@ static struct handlebars_string * execute_template(const char *template)
 
     retval = talloc_steal(NULL, buffer);
 
+    HANDLEBARS_VALUE_UNDECL(empty_partials);
     HANDLEBARS_VALUE_UNDECL(partials);
     HANDLEBARS_VALUE_UNDECL(input);
     HANDLEBARS_VALUE_UNDECL(helpers);
@@ -113,6 +117,11 @@ static struct handlebars_string * execute_template(const char *template)
     return retval;
 }
 
+static struct handlebars_string * execute_template(const char *template)
+{
+    return execute_template_ex(template, false);
+}
+
 START_TEST(test_partial_loader_1)
 {
     struct handlebars_string *rv = execute_template("{{> fixture1 .}}");
@@ -159,6 +168,39 @@ START_TEST(test_partial_loader_empty_error)
 }
 END_TEST
 
+START_TEST(test_partial_loader_parse_error)
+{
+    jmp_buf buf;
+
+    if( handlebars_setjmp_ex(context, &buf) ) {
+        fprintf(stderr, "Got expected error: %s\n", handlebars_error_message(context));
+        ck_assert(1);
+        return;
+    }
+
+    // Errors in a partial abort the render
+    (void) execute_template("{{> fixture2}}");
+    ck_assert(0);
+}
+END_TEST
+
+START_TEST(test_partial_loader_bundle)
+{
+    struct handlebars_string *rv = execute_template_ex("{{> fixture1 .}}{{#> fixture1 .}}{{/fixture1}}", true);
+    ck_assert_hbs_str_eq_cstr(rv, "|bar||bar|");
+    talloc_free(rv);
+}
+END_TEST
+
+START_TEST(test_partial_loader_bundle_missing)
+{
+    // Partials that cannot be loaded are left to the runtime, and only fail if called
+    struct handlebars_string *rv = execute_template_ex("{{#if foo}}{{> fixture1 .}}{{else}}{{> nonexist .}}{{/if}}", true);
+    ck_assert_hbs_str_eq_cstr(rv, "|bar|");
+    talloc_free(rv);
+}
+END_TEST
+
 static Suite * suite(void);
 static Suite * suite(void)
 {
@@ -168,6 +210,9 @@ static Suite * suite(void)
 	REGISTER_TEST_FIXTURE(s, test_partial_loader_2, "Partial loader 2");
 	REGISTER_TEST_FIXTURE(s, test_partial_loader_error, "Partial loader error");
 	REGISTER_TEST_FIXTURE(s, test_partial_loader_empty_error, "Partial loader empty error");
+	REGISTER_TEST_FIXTURE(s, test_partial_loader_parse_error, "Partial loader parse error");
+	REGISTER_TEST_FIXTURE(s, test_partial_loader_bundle, "Partial loader bundle");
+	REGISTER_TEST_FIXTURE(s, test_partial_loader_bundle_missing, "Partial loader bundle missing");
 
     return s;
 }
@@ -0,0 +1,185 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <check.h>
+#include <stdio.h>
+#include <string.h>
+#include <talloc.h>
+
+#include "handlebars.h"
+#include "handlebars_compiler.h"
+#include "handlebars_map.h"
+#include "handlebars_memory.h"
+#include "handlebars_opcode_serializer.h"
+#include "handlebars_parser.h"
+#include "handlebars_sink.h"
+#include "handlebars_stack.h"
+#include "handlebars_string.h"
+#include "handlebars_value.h"
+#include "handlebars_vm.h"
+#include "utils.h"
+
+
+struct counting_sink {
+    char buf[256];
+    size_t len;
+    size_t calls;
+};
+
+static bool counting_sink_write(void * write_ctx, const char * str, size_t len)
+{
+    struct counting_sink * cs = write_ctx;
+    if (cs->len + len >= sizeof(cs->buf)) {
+        return false;
+    }
+    memcpy(cs->buf + cs->len, str, len);
+    cs->len += len;
+    cs->buf[cs->len] = '\0';
+    cs->calls++;
+    return true;
+}
+
+static struct handlebars_module * compile(const char * tmpl)
+{
+    // Parsers and compilers are single use
+    struct handlebars_parser * tmpl_parser = handlebars_parser_ctor(context);
+    struct handlebars_compiler * tmpl_compiler = handlebars_compiler_ctor(context);
+    struct handlebars_ast_node * ast = handlebars_parse_ex(tmpl_parser, handlebars_string_ctor(context, tmpl, strlen(tmpl)), 0);
+    struct handlebars_program * program = handlebars_compiler_compile_ex(tmpl_compiler, ast);
+    return handlebars_program_serialize(context, program);
+}
+
+static void make_input(struct handlebars_value * input, struct handlebars_value * partials)
+{
+    HANDLEBARS_VALUE_DECL(list);
+    HANDLEBARS_VALUE_DECL(tmp);
+    struct handlebars_map * map;
+    int i;
+
+    handlebars_value_array(list, handlebars_stack_ctor(context, 3));
+    for (i = 1; i <= 3; i++) {
+        handlebars_value_integer(tmp, i);
+        handlebars_value_array_push(list, tmp);
+    }
+
+    map = handlebars_map_ctor(context, 2);
+    map = handlebars_map_str_add(map, HBS_STRL("list"), list);
+    handlebars_value_str(tmp, handlebars_string_ctor(context, HBS_STRL("<b>")));
+    map = handlebars_map_str_add(map, HBS_STRL("name"), tmp);
+    handlebars_value_map(input, map);
+
+    map = handlebars_map_ctor(context, 1);
+    handlebars_value_str(tmp, handlebars_string_ctor(context, HBS_STRL("{{name}}\n{{#each list}}{{.}}\n{{/each}}")));
+    map = handlebars_map_str_add(map, HBS_STRL("p"), tmp);
+    handlebars_value_map(partials, map);
+
+    HANDLEBARS_VALUE_UNDECL(tmp);
+    HANDLEBARS_VALUE_UNDECL(list);
+}
+
+START_TEST(test_sink_buffer)
+{
+    char buf[4];
+    struct handlebars_sink * sink = handlebars_sink_buffer_ctor(context, buf, sizeof(buf));
+
+    ck_assert(handlebars_sink_write(sink, HBS_STRL("ab")));
+    ck_assert_str_eq(buf, "ab");
+    ck_assert(handlebars_sink_write(sink, HBS_STRL("cd")));
+    ck_assert(!handlebars_sink_write(sink, HBS_STRL("e")));
+    ck_assert_int_eq(memcmp(buf, "abcd", 4), 0);
+    ck_assert_uint_eq(handlebars_sink_get_written(sink), 4);
+
+    handlebars_sink_dtor(sink);
+    ASSERT_INIT_BLOCKS();
+}
+END_TEST
+
+START_TEST(test_vm_execute_sink)
+{
+    static const char * tmpl = "{{name}}{{#each list}}<{{.}}>{{/each}}{{#if name}}!{{/if}}\n  {{> p}}{{#> missing}}{{{name}}}{{/missing}}";
+    HANDLEBARS_VALUE_DECL(input);
+    HANDLEBARS_VALUE_DECL(partials);
+    struct counting_sink cs = {0};
+    struct handlebars_module * module = compile(tmpl);
+    struct handlebars_sink * sink = handlebars_sink_ctor(context, counting_sink_write, &cs);
+
+    make_input(input, partials);
+    handlebars_vm_set_partials(vm, partials);
+
+    struct handlebars_string * expected = handlebars_vm_execute(vm, module, input);
+
+    handlebars_sink_set_chunk_size(sink, 0);
+    handlebars_vm_execute_sink(vm, module, input, sink);
+
+    ck_assert_str_eq(cs.buf, hbs_str_val(expected));
+    ck_assert_uint_eq(handlebars_sink_get_written(sink), hbs_str_len(expected));
+    ck_assert_uint_gt(cs.calls, 1);
+
+    HANDLEBARS_VALUE_UNDECL(partials);
+    HANDLEBARS_VALUE_UNDECL(input);
+}
+END_TEST
+
+START_TEST(test_vm_execute_sink_write_failure)
+{
+    char buf[16];
+    jmp_buf jmp;
+    HANDLEBARS_VALUE_DECL(input);
+    HANDLEBARS_VALUE_DECL(partials);
+    struct handlebars_module * module = compile("{{#each list}}{{../name}}{{/each}}");
+    struct handlebars_sink * sink = handlebars_sink_buffer_ctor(context, buf, sizeof(buf));
+
+    make_input(input, partials);
+
+    if (handlebars_setjmp_ex(context, &jmp)) {
+        ck_assert_int_eq(handlebars_error_num(context), HANDLEBARS_ERROR);
+        ck_assert_str_eq(context->e->msg, "Failed to write to the output sink");
+        ck_assert_str_eq(buf, "&lt;b&gt;");
+        goto done;
+    }
+
+    handlebars_sink_set_chunk_size(sink, 0);
+    handlebars_vm_execute_sink(vm, module, input, sink);
+    ck_abort_msg("Expected a write failure");
+
+done:
+    context->e->jmp = NULL;
+    HANDLEBARS_VALUE_UNDECL(partials);
+    HANDLEBARS_VALUE_UNDECL(input);
+}
+END_TEST
+
+static Suite * suite(void);
+static Suite * suite(void)
+{
+    Suite * s = suite_create("Sink");
+
+    REGISTER_TEST_FIXTURE(s, test_sink_buffer, "Fixed buffer sink");
+    REGISTER_TEST_FIXTURE(s, test_vm_execute_sink, "Execute into a sink");
+    REGISTER_TEST_FIXTURE(s, test_vm_execute_sink_write_failure, "Execute into a sink (write failure)");
+
+    return s;
+}
+
+int main(void)
+{
+    return default_main(&suite);
+}
@@ -417,7 +417,7 @@ static bool should_skip(struct generic_test * test)
 #undef MYCCHECK
 }
 
-static inline void run_test(struct generic_test * test, int _i)
+static inline void run_test(struct generic_test * test, int _i, long extra_flags)
 {
     struct handlebars_module * module;
 
@@ -448,7 +448,7 @@ static inline void run_test(struct generic_test * test, int _i)
     }
 
     // Compile
-    handlebars_compiler_set_flags(compiler, test->flags);
+    handlebars_compiler_set_flags(compiler, test->flags | extra_flags);
     if( test->known_helpers ) {
         handlebars_compiler_set_known_helpers(compiler, (const char **) test->known_helpers);
     }
@@ -573,7 +573,18 @@ START_TEST(test_handlebars_spec)
     int i;
 
     for( i = 0; i < runs; i++ ) {
-        run_test(test, _i);
+        run_test(test, _i, 0);
+    }
+}
+END_TEST
+
+START_TEST(test_handlebars_spec_superinstructions)
+{
+    struct generic_test * test = tests[_i];
+    int i;
+
+    for( i = 0; i < runs; i++ ) {
+        run_test(test, _i, handlebars_compiler_flag_superinstructions);
     }
 }
 END_TEST
@@ -621,6 +632,11 @@ static Suite * suite(void)
     tcase_add_loop_test(tc_handlebars_spec, test_handlebars_spec, start, end);
     suite_add_tcase(s, tc_handlebars_spec);
 
+    TCase * tc_handlebars_spec_superinstructions = tcase_create("Handlebars Spec (superinstructions)");
+    tcase_add_checked_fixture(tc_handlebars_spec_superinstructions, default_setup, default_teardown);
+    tcase_add_loop_test(tc_handlebars_spec_superinstructions, test_handlebars_spec_superinstructions, start, end);
+    suite_add_tcase(s, tc_handlebars_spec_superinstructions);
+
     return s;
 }
 
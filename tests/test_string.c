@@ -22,6 +22,7 @@
 #include <check.h>
 #include <talloc.h>
 #include <limits.h>
+#include <locale.h>
 
 #include "handlebars.h"
 #include "handlebars_memory.h"
@@ -342,6 +343,133 @@ START_TEST(test_handlebars_string_htmlspecialchars_6)
 }
 END_TEST
 
+START_TEST(test_handlebars_string_htmlspecialchars_7)
+{
+    // Put a character to escape at every position of inputs of up to 80 bytes, so that it is found in the vector
+    // loops as well as in the tails
+    static const char specials[] = "&\"'<>`";
+    char input[80];
+    char expected[80 * 6 + 1];
+    size_t len;
+    size_t pos;
+    size_t i;
+    char * out;
+    const char * repl;
+
+    for( len = 1; len <= sizeof(input); len++ ) {
+        for( pos = 0; pos < len; pos++ ) {
+            memset(input, 'x', len);
+            input[pos] = specials[(len + pos) % 6];
+
+            out = expected;
+            for( i = 0; i < len; i++ ) {
+                switch( input[i] ) {
+                    case '&': repl = "&amp;"; break;
+                    case '"': repl = "&quot;"; break;
+                    case '\'': repl = "&#x27;"; break;
+                    case '<': repl = "&lt;"; break;
+                    case '>': repl = "&gt;"; break;
+                    case '`': repl = "&#x60;"; break;
+                    default: repl = NULL; break;
+                }
+                if( repl ) {
+                    strcpy(out, repl);
+                    out += strlen(repl);
+                } else {
+                    *out++ = input[i];
+                }
+            }
+            *out = 0;
+
+            struct handlebars_string * actual = handlebars_string_htmlspecialchars(context, input, len);
+            ck_assert_cstr_eq_hbs_str(expected, actual);
+            handlebars_talloc_free(actual);
+        }
+    }
+}
+END_TEST
+
+START_TEST(test_hbs_str_needs_escape)
+{
+    struct handlebars_string * string = handlebars_string_ctor(context, HBS_STRL("a product name"));
+    ck_assert(!hbs_str_needs_escape(string));
+    ck_assert(!hbs_str_needs_escape(string));
+    string = handlebars_string_append(context, string, HBS_STRL(" & more"));
+    ck_assert(hbs_str_needs_escape(string));
+    string = handlebars_string_truncate(string, 0, 14);
+    ck_assert(!hbs_str_needs_escape(string));
+    string = handlebars_string_append(context, string, HBS_STRL("<"));
+    ck_assert(hbs_str_needs_escape(string));
+    string = handlebars_string_rtrim(string, HBS_STRL("<"));
+    ck_assert(!hbs_str_needs_escape(string));
+    handlebars_talloc_free(string);
+}
+END_TEST
+
+START_TEST(test_handlebars_string_append_long)
+{
+    static const long values[] = {0, 7, -7, 10, 99, 100, -12345, 1234567890, LONG_MAX, LONG_MIN};
+    char expected[32];
+    size_t i;
+
+    for( i = 0; i < sizeof(values) / sizeof(values[0]); i++ ) {
+        struct handlebars_string * actual = handlebars_string_append_long(context, handlebars_string_init(context, 0), values[i]);
+        snprintf(expected, sizeof(expected), "%ld", values[i]);
+        ck_assert_cstr_eq_hbs_str(expected, actual);
+        handlebars_talloc_free(actual);
+    }
+}
+END_TEST
+
+START_TEST(test_handlebars_string_append_double)
+{
+    static const double values[] = {
+        0.0, -0.0, 1.0, -1.5, 0.1, 0.1 + 0.2, 2.675, 19.99, 1234.565, 100000.5, 999999.4, 999999.5, 123456789.0,
+        0.0001, 0.00009999995, 0.00001234, 1e-300, 1e300, 3.14159265358979
+    };
+    char expected[32];
+    size_t i;
+
+    for( i = 0; i < sizeof(values) / sizeof(values[0]); i++ ) {
+        struct handlebars_string * actual = handlebars_string_append_double(context, handlebars_string_init(context, 0), values[i]);
+        snprintf(expected, sizeof(expected), "%g", values[i]);
+        ck_assert_cstr_eq_hbs_str(expected, actual);
+        handlebars_talloc_free(actual);
+    }
+}
+END_TEST
+
+START_TEST(test_handlebars_string_append_double_locale)
+{
+    static const char * locales[] = {"de_DE.UTF-8", "fr_FR.UTF-8", "ru_RU.UTF-8", "de_DE", "fr_FR"};
+    struct handlebars_string * actual;
+    size_t i;
+
+    for( i = 0; i < sizeof(locales) / sizeof(locales[0]); i++ ) {
+        if( setlocale(LC_NUMERIC, locales[i]) != NULL ) {
+            break;
+        }
+    }
+    if( i >= sizeof(locales) / sizeof(locales[0]) ) {
+        // No locale with a comma as the decimal separator is installed
+        return;
+    }
+
+    // Both the fixed notation and the snprintf() fallback use a period
+    actual = handlebars_string_append_double(context, handlebars_string_init(context, 0), 1.5);
+    ck_assert_cstr_eq_hbs_str("1.5", actual);
+    handlebars_talloc_free(actual);
+    actual = handlebars_string_append_double(context, handlebars_string_init(context, 0), 1.25e300);
+    ck_assert_cstr_eq_hbs_str("1.25e+300", actual);
+    handlebars_talloc_free(actual);
+    actual = handlebars_string_append_double(context, handlebars_string_init(context, 0), 1.25e-7);
+    ck_assert_cstr_eq_hbs_str("1.25e-07", actual);
+    handlebars_talloc_free(actual);
+
+    setlocale(LC_NUMERIC, "C");
+}
+END_TEST
+
 START_TEST(test_handlebars_string_implode_1)
 {
     struct handlebars_string ** parts = handlebars_talloc_array(context, struct handlebars_string *, 1);
@@ -366,6 +494,38 @@ START_TEST(test_handlebars_string_implode_2)
 }
 END_TEST
 
+START_TEST(test_handlebars_string_indent)
+{
+    static const char * const cases[][2] = {
+        {"", ""},
+        {"a", "  a"},
+        {"\n", "  \n"},
+        {"a\n", "  a\n"},
+        {"a\nb", "  a\n  b"},
+        {"a\n\nb\n", "  a\n  \n  b\n"},
+        {"a\n\n", "  a\n  \n"},
+    };
+    struct handlebars_string * indent = handlebars_string_ctor(context, HBS_STRL("  "));
+    struct handlebars_string * actual;
+    size_t i;
+
+    for( i = 0; i < sizeof(cases) / sizeof(cases[0]); i++ ) {
+        actual = handlebars_string_indent(context, handlebars_string_ctor(context, cases[i][0], strlen(cases[i][0])), indent);
+        ck_assert_hbs_str_eq_cstr(actual, cases[i][1]);
+        handlebars_talloc_free(actual);
+
+        actual = handlebars_string_ctor(context, HBS_STRL("prefix\n"));
+        actual = handlebars_string_append(context, actual, cases[i][0], strlen(cases[i][0]));
+        actual = handlebars_string_indent_from(context, actual, sizeof("prefix\n") - 1, indent);
+        ck_assert_str_eq(hbs_str_val(actual) + sizeof("prefix\n") - 1, cases[i][1]);
+        ck_assert_uint_eq(hbs_str_len(actual), sizeof("prefix\n") - 1 + strlen(cases[i][1]));
+        handlebars_talloc_free(actual);
+    }
+
+    handlebars_talloc_free(indent);
+}
+END_TEST
+
 START_TEST(test_handlebars_string_ltrim_1)
 {
     struct handlebars_string * in = handlebars_string_ctor(context, HBS_STRL(" \n \r test "));
@@ -466,6 +626,86 @@ START_TEST(test_handlebars_string_truncate_4)
 }
 END_TEST
 
+START_TEST(test_handlebars_string_intern)
+{
+    struct handlebars_string * str = handlebars_string_intern(context, HBS_STRL("helperMissing"));
+    ck_assert_ptr_eq(str, HBS_INTERNED_STR(HELPER_MISSING));
+    ck_assert_ptr_eq(handlebars_string_intern_find(HBS_STRL("index")), HBS_INTERNED_STR(INDEX));
+    ck_assert_ptr_eq(handlebars_string_intern_find(HBS_STRL("inde")), NULL);
+    ck_assert_ptr_eq(handlebars_string_intern_find(HBS_STRL("")), NULL);
+
+    // Immortal
+    handlebars_string_addref(str);
+    handlebars_string_delref(str);
+    handlebars_string_delref(str);
+    ck_assert_str_eq(hbs_str_val(str), "helperMissing");
+
+    struct handlebars_string * other = handlebars_string_intern(context, HBS_STRL("notInterned"));
+    ck_assert_str_eq(hbs_str_val(other), "notInterned");
+    ck_assert(handlebars_string_eq(str, str));
+    ck_assert(!handlebars_string_eq(str, other));
+    handlebars_talloc_free(other);
+}
+END_TEST
+
+START_TEST(test_handlebars_string_interned_immutable)
+{
+    struct handlebars_string * str = HBS_INTERNED_STR(EACH);
+    struct handlebars_string * copy;
+    size_t i;
+
+    // The hash and flags are precomputed, as interned strings are shared by all threads
+    for (i = 0; i < HANDLEBARS_INTERNED_COUNT; i++) {
+        struct handlebars_string * interned = HANDLEBARS_INTERNED_STRINGS[i];
+        ck_assert_uint_eq(hbs_str_hash(interned), handlebars_string_hash(HBS_STR_STRL(interned)));
+        ck_assert(!hbs_str_needs_escape(interned));
+    }
+
+    // Modifying one makes a copy, which is not interned
+    copy = handlebars_string_append(context, str, HBS_STRL("<"));
+    ck_assert_ptr_ne(copy, str);
+    ck_assert_str_eq(hbs_str_val(copy), "each<");
+    ck_assert(hbs_str_needs_escape(copy));
+    ck_assert_ptr_eq(handlebars_string_truncate(copy, 0, 1), copy);
+    handlebars_talloc_free(copy);
+
+    copy = handlebars_string_truncate(str, 1, 3);
+    ck_assert_ptr_ne(copy, str);
+    ck_assert_str_eq(hbs_str_val(copy), "ac");
+    handlebars_talloc_free(copy);
+
+    ck_assert_ptr_eq(handlebars_string_compact(str), str);
+    ck_assert_ptr_eq(handlebars_string_extend(context, str, 2), str);
+    ck_assert_str_eq(hbs_str_val(str), "each");
+}
+END_TEST
+
+START_TEST(test_handlebars_string_reserve)
+{
+    struct handlebars_string * str = handlebars_string_init(context, 0);
+    size_t reallocs = 0;
+    size_t capacity = talloc_get_size(str);
+    size_t i;
+
+    for (i = 0; i < 10000; i++) {
+        str = handlebars_string_append(context, str, HBS_STRL("x"));
+        if (talloc_get_size(str) != capacity) {
+            capacity = talloc_get_size(str);
+            reallocs++;
+        }
+    }
+
+    ck_assert_uint_eq(10000, hbs_str_len(str));
+    ck_assert_uint_le(reallocs, 16);
+
+    // Compacting keeps the type of the string
+    str = handlebars_string_compact(str);
+    ck_assert_uint_eq(HBS_STR_SIZE(10000), talloc_get_size(str));
+    ck_assert_ptr_ne(NULL, talloc_get_type(str, struct handlebars_string));
+    handlebars_talloc_free(str);
+}
+END_TEST
+
 static Suite * suite(void);
 static Suite * suite(void)
 {
@@ -505,9 +745,16 @@ static Suite * suite(void)
     REGISTER_TEST_FIXTURE(s, test_handlebars_string_htmlspecialchars_4, "handlebars_string_htmlspecialchars 4");
     REGISTER_TEST_FIXTURE(s, test_handlebars_string_htmlspecialchars_5, "handlebars_string_htmlspecialchars 5");
     REGISTER_TEST_FIXTURE(s, test_handlebars_string_htmlspecialchars_6, "handlebars_string_htmlspecialchars 6");
+    REGISTER_TEST_FIXTURE(s, test_handlebars_string_htmlspecialchars_7, "handlebars_string_htmlspecialchars 7");
+    REGISTER_TEST_FIXTURE(s, test_hbs_str_needs_escape, "hbs_str_needs_escape");
+
+    REGISTER_TEST_FIXTURE(s, test_handlebars_string_append_long, "handlebars_string_append_long");
+    REGISTER_TEST_FIXTURE(s, test_handlebars_string_append_double, "handlebars_string_append_double");
+    REGISTER_TEST_FIXTURE(s, test_handlebars_string_append_double_locale, "handlebars_string_append_double with a locale");
 
     REGISTER_TEST_FIXTURE(s, test_handlebars_string_implode_1, "handlebars_string_implode 1");
     REGISTER_TEST_FIXTURE(s, test_handlebars_string_implode_2, "handlebars_string_implode 2");
+    REGISTER_TEST_FIXTURE(s, test_handlebars_string_indent, "handlebars_string_indent");
     REGISTER_TEST_FIXTURE(s, test_handlebars_string_ltrim_1, "test_handlebars_string_ltrim 1");
     REGISTER_TEST_FIXTURE(s, test_handlebars_string_ltrim_2, "test_handlebars_string_ltrim 2");
     REGISTER_TEST_FIXTURE(s, test_handlebars_string_ltrim_3, "test_handlebars_string_ltrim 3");
@@ -520,6 +767,10 @@ static Suite * suite(void)
     REGISTER_TEST_FIXTURE(s, test_handlebars_string_truncate_3, "handlebars_string_truncate 3");
     REGISTER_TEST_FIXTURE(s, test_handlebars_string_truncate_4, "handlebars_string_truncate 4");
 
+    REGISTER_TEST_FIXTURE(s, test_handlebars_string_intern, "handlebars_string_intern");
+    REGISTER_TEST_FIXTURE(s, test_handlebars_string_interned_immutable, "Interned strings are immutable");
+    REGISTER_TEST_FIXTURE(s, test_handlebars_string_reserve, "handlebars_string_reserve");
+
     return s;
 }
 
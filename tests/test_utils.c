@@ -193,6 +193,75 @@ START_TEST(test_yy_realloc_failed_alloc)
 }
 END_TEST
 
+START_TEST(test_memory_profile)
+{
+#ifdef HANDLEBARS_MEMORY
+    const struct handlebars_memory_profile_entry * entry;
+    const struct handlebars_memory_profile_entry * strdup_entry;
+    void * a;
+    void * b;
+    char * str;
+    size_t i;
+
+    handlebars_memory_profile_enable();
+    ck_assert_int_eq(1, handlebars_memory_profile_get_state());
+    ck_assert_uint_eq(0, handlebars_memory_profile_count());
+
+    a = handlebars_talloc_named_const(root, 64, "profile test");
+    b = handlebars_talloc_named_const(root, 64, "profile test");
+    handlebars_talloc_free(a);
+    str = handlebars_talloc_strdup(b, "abc");
+    ck_assert_ptr_ne(NULL, str);
+
+    entry = handlebars_memory_profile_find("profile test");
+    ck_assert_ptr_ne(NULL, entry);
+    ck_assert_uint_eq(2, entry->calls);
+    ck_assert_uint_eq(128, entry->bytes);
+    ck_assert_uint_eq(64, entry->live_bytes);
+    ck_assert_uint_eq(128, entry->peak_bytes);
+    strdup_entry = handlebars_memory_profile_find("talloc_strdup");
+    ck_assert_ptr_ne(NULL, strdup_entry);
+    ck_assert_uint_eq(1, strdup_entry->calls);
+    ck_assert_uint_eq(4, strdup_entry->live_bytes);
+    ck_assert_uint_eq(68, handlebars_memory_profile_get_live_bytes());
+    ck_assert_uint_eq(128, handlebars_memory_profile_get_peak_bytes());
+
+    // Freeing a parent frees its children
+    handlebars_talloc_free(b);
+    ck_assert_uint_eq(0, entry->live_bytes);
+    ck_assert_uint_eq(0, strdup_entry->live_bytes);
+    ck_assert_uint_eq(0, handlebars_memory_profile_get_live_bytes());
+    ck_assert_uint_eq(2, handlebars_memory_profile_count());
+    ck_assert_ptr_eq(entry, handlebars_memory_profile_get(0));
+    ck_assert_ptr_eq(NULL, handlebars_memory_profile_get(2));
+
+    // Entries found earlier stay valid while more names are added
+    for (i = 0; i < 200; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "profile test %zu", i);
+        handlebars_talloc_free(handlebars_talloc_named_const(root, 8, name));
+    }
+    ck_assert_uint_eq(202, handlebars_memory_profile_count());
+    ck_assert_ptr_eq(entry, handlebars_memory_profile_find("profile test"));
+    ck_assert_ptr_eq(strdup_entry, handlebars_memory_profile_find("talloc_strdup"));
+    ck_assert_uint_eq(2, entry->calls);
+    ck_assert_uint_eq(1, handlebars_memory_profile_find("profile test 199")->calls);
+    ck_assert_uint_eq(0, handlebars_memory_profile_get_live_bytes());
+
+    handlebars_memory_profile_reset();
+    ck_assert_uint_eq(0, entry->calls);
+    ck_assert_uint_eq(0, entry->peak_bytes);
+    ck_assert_uint_eq(0, handlebars_memory_profile_get_peak_bytes());
+
+    handlebars_memory_profile_disable();
+    ck_assert_int_eq(0, handlebars_memory_profile_get_state());
+    ck_assert_uint_eq(202, handlebars_memory_profile_count());
+#else
+    fprintf(stderr, "Skipped, memory testing functions are disabled\n");
+#endif
+}
+END_TEST
+
 static Suite * suite(void);
 static Suite * suite(void)
 {
@@ -206,6 +275,7 @@ static Suite * suite(void)
     REGISTER_TEST_FIXTURE(s, test_yy_realloc, "yy_realloc");
     REGISTER_TEST_FIXTURE(s, test_yy_alloc_failed_alloc, "yy_alloc (failed alloc)");
     REGISTER_TEST_FIXTURE(s, test_yy_realloc_failed_alloc, "yy_realloc (failed alloc)");
+    REGISTER_TEST_FIXTURE(s, test_memory_profile, "Memory profile");
 
     return s;
 }
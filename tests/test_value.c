@@ -25,6 +25,7 @@
 
 #include "handlebars.h"
 #include "handlebars_memory.h"
+#include "handlebars_value_private.h"
 
 #include "handlebars_map.h"
 #include "handlebars_stack.h"
@@ -97,6 +98,64 @@ START_TEST(test_string)
 }
 END_TEST
 
+START_TEST(test_string_inline)
+{
+    HANDLEBARS_VALUE_DECL(value);
+    HANDLEBARS_VALUE_DECL(value2);
+    struct handlebars_map * map = handlebars_map_ctor(context, 2);
+    struct handlebars_stack * stack = handlebars_stack_ctor(context, 1);
+    struct handlebars_value * child;
+    size_t blocks;
+
+    handlebars_map_addref(map);
+    handlebars_stack_addref(stack);
+
+    // Short strings of children of maps and arrays are stored inline
+    blocks = talloc_total_blocks(context);
+    handlebars_value_child_strl(context, value, HBS_STRL("<a>"));
+    ck_assert_uint_eq(talloc_total_blocks(context), blocks);
+    ck_assert_int_eq(handlebars_value_get_type(value), HANDLEBARS_VALUE_TYPE_STRING);
+    ck_assert_str_eq(handlebars_value_get_strval(value), "<a>");
+    ck_assert_uint_eq(handlebars_value_get_strlen(value), 3);
+    ck_assert(handlebars_value_get_boolval(value));
+
+    // Equal to the same string, stored either way
+    handlebars_value_str(value2, handlebars_string_ctor(context, HBS_STRL("<a>")));
+    ck_assert(handlebars_value_eq(value, value2));
+    handlebars_value_str(value2, handlebars_string_ctor(context, HBS_STRL("<b>")));
+    ck_assert(!handlebars_value_eq(value, value2));
+
+    struct handlebars_string * string = handlebars_value_expression(context, value, true);
+    ck_assert_hbs_str_eq_cstr(string, "&lt;a&gt;");
+    handlebars_string_delref(string);
+
+    // Reading a child through its map or array moves the string out of the child
+    map = handlebars_map_str_add(map, HBS_STRL("a"), value);
+    stack = handlebars_stack_push(stack, value);
+    child = handlebars_map_str_find(map, HBS_STRL("a"));
+    ck_assert_ptr_ne(handlebars_value_get_string(child), NULL);
+    ck_assert_hbs_str_eq_cstr(handlebars_value_get_string(child), "<a>");
+    child = handlebars_stack_get(stack, 0);
+    ck_assert_ptr_ne(handlebars_value_get_string(child), NULL);
+    ck_assert_hbs_str_eq_cstr(handlebars_value_get_string(child), "<a>");
+
+    // Other values are always allocated
+    handlebars_value_strl(context, value2, HBS_STRL("<b>"));
+    ck_assert_ptr_ne(handlebars_value_get_string(value2), NULL);
+    ck_assert_str_eq(handlebars_value_get_strval(value2), "<b>");
+
+    string = handlebars_value_get_string_ex(context, value);
+    ck_assert_hbs_str_eq_cstr(string, "<a>");
+    ck_assert_ptr_eq(handlebars_value_get_string(value), string);
+
+    handlebars_stack_delref(stack);
+    handlebars_map_delref(map);
+    HANDLEBARS_VALUE_UNDECL(value2);
+    HANDLEBARS_VALUE_UNDECL(value);
+    ASSERT_INIT_BLOCKS();
+}
+END_TEST
+
 START_TEST(test_array_iterator)
 {
     HANDLEBARS_VALUE_DECL(value);
@@ -466,6 +525,7 @@ static Suite * suite(void)
     REGISTER_TEST_FIXTURE(s, test_int, "Integer");
     REGISTER_TEST_FIXTURE(s, test_float, "Float");
     REGISTER_TEST_FIXTURE(s, test_string, "String");
+    REGISTER_TEST_FIXTURE(s, test_string_inline, "String (inline)");
     REGISTER_TEST_FIXTURE(s, test_array_iterator, "Array iterator");
     REGISTER_TEST_FIXTURE(s, test_map_iterator, "Map iterator");
     REGISTER_TEST_FIXTURE(s, test_map_iterator_sparse, "Map iterator (sparse)");
@@ -0,0 +1,616 @@
+/**
+ * Copyright (c) anno Domini nostri Jesu Christi MMXVI-MMXXIV John Boehr & contributors
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <check.h>
+#include <stdio.h>
+#include <string.h>
+#include <talloc.h>
+
+#define HANDLEBARS_OPCODES_PRIVATE
+#define HANDLEBARS_OPCODE_SERIALIZER_PRIVATE
+
+#include "handlebars.h"
+#include "handlebars_compiler.h"
+#include "handlebars_map.h"
+#include "handlebars_memory.h"
+#include "handlebars_opcodes.h"
+#include "handlebars_opcode_serializer.h"
+#include "handlebars_parser.h"
+#include "handlebars_sink.h"
+#include "handlebars_stack.h"
+#include "handlebars_string.h"
+#include "handlebars_value.h"
+#include "handlebars_vm.h"
+#include "handlebars_vm_private.h"
+#include "utils.h"
+
+
+static struct handlebars_module * compile(const char * tmpl)
+{
+    // Parsers and compilers are single use
+    struct handlebars_parser * tmpl_parser = handlebars_parser_ctor(context);
+    struct handlebars_compiler * tmpl_compiler = handlebars_compiler_ctor(context);
+    struct handlebars_ast_node * ast = handlebars_parse_ex(tmpl_parser, handlebars_string_ctor(context, tmpl, strlen(tmpl)), 0);
+    struct handlebars_program * program = handlebars_compiler_compile_ex(tmpl_compiler, ast);
+    return handlebars_program_serialize(context, program);
+}
+
+static void make_input(struct handlebars_value * input, struct handlebars_value * partials)
+{
+    HANDLEBARS_VALUE_DECL(list);
+    HANDLEBARS_VALUE_DECL(tmp);
+    struct handlebars_map * map;
+    int i;
+
+    handlebars_value_array(list, handlebars_stack_ctor(context, 3));
+    for (i = 1; i <= 3; i++) {
+        handlebars_value_integer(tmp, i);
+        handlebars_value_array_push(list, tmp);
+    }
+
+    map = handlebars_map_ctor(context, 2);
+    map = handlebars_map_str_add(map, HBS_STRL("list"), list);
+    handlebars_value_str(tmp, handlebars_string_ctor(context, HBS_STRL("<b>")));
+    map = handlebars_map_str_add(map, HBS_STRL("name"), tmp);
+    handlebars_value_map(input, map);
+
+    map = handlebars_map_ctor(context, 1);
+    handlebars_value_str(tmp, handlebars_string_ctor(context, HBS_STRL("{{name}}\n{{#each list}}{{.}}\n{{/each}}")));
+    map = handlebars_map_str_add(map, HBS_STRL("p"), tmp);
+    handlebars_value_map(partials, map);
+
+    HANDLEBARS_VALUE_UNDECL(tmp);
+    HANDLEBARS_VALUE_UNDECL(list);
+}
+
+START_TEST(test_vm_arena)
+{
+    jmp_buf jmp;
+    HANDLEBARS_VALUE_DECL(input);
+    HANDLEBARS_VALUE_DECL(partials);
+    struct handlebars_module * module = compile("{{#with .}}{{#each list}}{{.}}{{/each}}{{/with}}|{{> p}}");
+    struct handlebars_module * failing = compile("{{#with .}}{{#each list}}{{.}}{{missing 1}}{{/each}}{{/with}}");
+    struct handlebars_string * result;
+    size_t blocks;
+
+    make_input(input, partials);
+    handlebars_vm_set_partials(vm, partials);
+
+    ck_assert_ptr_eq(handlebars_vm_get_arena(vm), HBSCTX(vm));
+
+    // The output is made outside of the arena, which is left empty for the next render
+    result = handlebars_vm_execute(vm, module, input);
+    ck_assert_ptr_eq(talloc_parent(result), vm);
+    ck_assert_ptr_ne(vm->arena, NULL);
+    ck_assert_uint_eq(talloc_total_blocks(vm->arena), 1);
+    handlebars_talloc_free(result);
+    blocks = talloc_total_blocks(vm);
+
+    handlebars_vm_reset(vm);
+    result = handlebars_vm_execute(vm, module, input);
+    ck_assert_str_eq(hbs_str_val(result), "123|&lt;b&gt;\n1\n2\n3\n");
+    handlebars_talloc_free(result);
+    ck_assert_uint_eq(talloc_total_blocks(vm), blocks);
+
+    // What a failed render left in the arena is freed with it, before the error is passed on
+    if (handlebars_setjmp_ex(context, &jmp)) {
+        goto reset;
+    }
+    (void) handlebars_vm_execute(vm, failing, input);
+    ck_abort_msg("Expected a missing helper error");
+
+reset:
+    context->e->jmp = NULL;
+    ck_assert_ptr_eq(vm->arena, NULL);
+    ck_assert_ptr_eq(vm->scope, NULL);
+    handlebars_vm_reset(vm);
+
+    handlebars_vm_set_arena_size(vm, 0);
+    result = handlebars_vm_execute(vm, module, input);
+    ck_assert_str_eq(hbs_str_val(result), "123|&lt;b&gt;\n1\n2\n3\n");
+    handlebars_talloc_free(result);
+
+    HANDLEBARS_VALUE_UNDECL(partials);
+    HANDLEBARS_VALUE_UNDECL(input);
+}
+END_TEST
+
+START_TEST(test_vm_failed_partial_compile)
+{
+    jmp_buf jmp;
+    HANDLEBARS_VALUE_DECL(input);
+    HANDLEBARS_VALUE_DECL(partials);
+    HANDLEBARS_VALUE_DECL(tmp);
+    struct handlebars_module * module = compile("{{#each list}}{{> bad}}{{/each}}");
+    struct handlebars_map * map;
+    int i;
+
+    make_input(input, partials);
+    map = handlebars_map_ctor(context, 1);
+    handlebars_value_str(tmp, handlebars_string_ctor(context, HBS_STRL("x {{#if}")));
+    map = handlebars_map_str_add(map, HBS_STRL("bad"), tmp);
+    handlebars_value_map(partials, map);
+    handlebars_vm_set_partials(vm, partials);
+
+    // The context the partial was compiled in is freed, but its error message is kept
+    for (i = 0; i < 2; i++) {
+        if (handlebars_setjmp_ex(context, &jmp)) {
+            goto next;
+        }
+        (void) handlebars_vm_execute(vm, module, input);
+        ck_abort_msg("Expected a parse error");
+
+    next:
+        context->e->jmp = NULL;
+        ck_assert_int_eq(handlebars_error_num(context), HANDLEBARS_PARSEERR);
+        ck_assert_ptr_eq(vm->scope, NULL);
+        ck_assert_ptr_ne(strstr(handlebars_error_msg(context), "syntax error"), NULL);
+        handlebars_vm_reset(vm);
+    }
+
+    HANDLEBARS_VALUE_UNDECL(tmp);
+    HANDLEBARS_VALUE_UNDECL(partials);
+    HANDLEBARS_VALUE_UNDECL(input);
+}
+END_TEST
+
+START_TEST(test_vm_reset)
+{
+    jmp_buf jmp;
+    HANDLEBARS_VALUE_DECL(input);
+    HANDLEBARS_VALUE_DECL(partials);
+    struct handlebars_module * failing = compile("{{#each list}}{{> p}}{{missing 1}}{{/each}}");
+    struct handlebars_module * module = compile("{{#each list}}{{.}}{{/each}}");
+    struct handlebars_string * result;
+
+    make_input(input, partials);
+    handlebars_vm_set_partials(vm, partials);
+
+    // The error is thrown past the VM, out of the middle of the render
+    if (handlebars_setjmp_ex(context, &jmp)) {
+        goto reset;
+    }
+    (void) handlebars_vm_execute(vm, failing, input);
+    ck_abort_msg("Expected a missing helper error");
+
+reset:
+    context->e->jmp = NULL;
+    handlebars_vm_reset(vm);
+    result = handlebars_vm_execute(vm, module, input);
+    ck_assert_str_eq(hbs_str_val(result), "123");
+    handlebars_vm_reset(vm);
+    result = handlebars_vm_execute(vm, module, input);
+    ck_assert_str_eq(hbs_str_val(result), "123");
+
+    HANDLEBARS_VALUE_UNDECL(partials);
+    HANDLEBARS_VALUE_UNDECL(input);
+}
+END_TEST
+
+static bool discard_sink_write(void * ctx, const char * str, size_t len)
+{
+    return true;
+}
+
+static void execute(struct handlebars_module * module, struct handlebars_value * input, struct handlebars_sink * sink)
+{
+    if (sink) {
+        handlebars_vm_execute_sink(vm, module, input, sink);
+    } else {
+        (void) handlebars_vm_execute(vm, module, input);
+    }
+}
+
+static void execute_failing(
+    struct handlebars_module * module,
+    struct handlebars_value * input,
+    struct handlebars_sink * sink,
+    bool catch
+) {
+    jmp_buf jmp;
+
+    // Without a jump buffer, the VM catches the error itself
+    if (!catch) {
+        execute(module, input, sink);
+        ck_assert_int_ne(handlebars_error_num(context), HANDLEBARS_SUCCESS);
+        return;
+    }
+
+    if (handlebars_setjmp_ex(context, &jmp)) {
+        context->e->jmp = NULL;
+        handlebars_vm_reset(vm);
+        return;
+    }
+    execute(module, input, sink);
+    ck_abort_msg("Expected an error");
+}
+
+START_TEST(test_vm_failed_renders)
+{
+    HANDLEBARS_VALUE_DECL(input);
+    HANDLEBARS_VALUE_DECL(partials);
+    HANDLEBARS_VALUE_DECL(tmp);
+    const char * tmpls[] = {
+        "{{#with .}}{{#each list}}{{.}}{{missing 1}}{{/each}}{{/with}}",
+        "{{#each list}}{{> p}}{{> missing}}{{/each}}",
+        "{{#each list}}{{> bad}}{{/each}}",
+        "{{#each list}}{{> deep}}{{/each}}",
+    };
+    struct handlebars_sink * sinks[] = {NULL, handlebars_sink_ctor(context, discard_sink_write, NULL)};
+    struct handlebars_map * map;
+    size_t blocks;
+    size_t i;
+    int j;
+    int k;
+    int catch;
+
+    make_input(input, partials);
+    map = handlebars_map_ctor(context, 3);
+    handlebars_value_str(tmp, handlebars_string_ctor(context, HBS_STRL("{{.}}")));
+    map = handlebars_map_str_add(map, HBS_STRL("p"), tmp);
+    handlebars_value_str(tmp, handlebars_string_ctor(context, HBS_STRL("x {{#if}")));
+    map = handlebars_map_str_add(map, HBS_STRL("bad"), tmp);
+    handlebars_value_str(tmp, handlebars_string_ctor(context, HBS_STRL("{{#each ../list}}{{> p}}{{/each}}{{> bad}}")));
+    map = handlebars_map_str_add(map, HBS_STRL("deep"), tmp);
+    handlebars_value_map(partials, map);
+    handlebars_vm_set_partials(vm, partials);
+
+    // A failed render leaves nothing behind in the VM, whether the error is caught by it or by the caller
+    for (i = 0; i < sizeof(tmpls) / sizeof(tmpls[0]); i++) {
+        struct handlebars_module * module = compile(tmpls[i]);
+        for (k = 0; k < 2; k++) {
+            for (catch = 0; catch < 2; catch++) {
+                execute_failing(module, input, sinks[k], catch);
+                blocks = talloc_total_blocks(vm);
+                for (j = 0; j < 5; j++) {
+                    execute_failing(module, input, sinks[k], catch);
+                    ck_assert_uint_eq(talloc_total_blocks(vm), blocks);
+                }
+            }
+        }
+    }
+
+    HANDLEBARS_VALUE_UNDECL(tmp);
+    HANDLEBARS_VALUE_UNDECL(partials);
+    HANDLEBARS_VALUE_UNDECL(input);
+}
+END_TEST
+
+START_TEST(test_vm_numeric_segments)
+{
+    HANDLEBARS_VALUE_DECL(input);
+    HANDLEBARS_VALUE_DECL(partials);
+    struct handlebars_module * module;
+    struct handlebars_string * result;
+    size_t i;
+    struct {
+        const char * tmpl;
+        const char * expected;
+    } cases[] = {
+        {"{{list.[0]}}{{list.[2]}}", "13"},
+        {"{{list.[3]}}{{list.[-1]}}{{list.[x]}}", ""},
+        {"{{#each list as |v i|}}{{i}}={{v}},{{/each}}", "0=1,1=2,2=3,"},
+        {"{{#each list as |v|}}{{#each ../list as |w|}}{{v}}{{w}} {{/each}}{{/each}}", "11 12 13 21 22 23 31 32 33 "},
+    };
+
+    make_input(input, partials);
+
+    // The index of each path segment is decoded once, when the program is serialized
+    module = compile("{{list.[1]}}");
+    ck_assert_int_eq(module->opcodes[1].type, handlebars_opcode_type_lookup_on_context);
+    ck_assert_uint_eq(module->opcodes[1].op1.data.array.count, 2);
+    ck_assert_int_eq(module->opcodes[1].op1.data.array.array[0].index, -1);
+    ck_assert_int_eq(module->opcodes[1].op1.data.array.array[1].index, 1);
+
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        module = compile(cases[i].tmpl);
+        result = handlebars_vm_execute(vm, module, input);
+        ck_assert_str_eq(hbs_str_val(result), cases[i].expected);
+        handlebars_talloc_free(result);
+    }
+
+    HANDLEBARS_VALUE_UNDECL(partials);
+    HANDLEBARS_VALUE_UNDECL(input);
+}
+END_TEST
+
+START_TEST(test_vm_link)
+{
+    jmp_buf jmp;
+    HANDLEBARS_VALUE_DECL(input);
+    HANDLEBARS_VALUE_DECL(partials);
+    struct handlebars_module * module = compile(
+        "{{#if undefined}}a{{/if}}{{#if null}}b{{/if}}{{#if true}}c{{/if}}{{#if false}}d{{/if}}"
+        "{{#if 1}}e{{/if}}{{#if 0}}f{{/if}}{{#if \"s\"}}g{{/if}}{{lookup list 1}}"
+    );
+    struct handlebars_string * result;
+    size_t i;
+
+    make_input(input, partials);
+
+    // Each literal type is linked to a handler of its own
+    ck_assert_ptr_eq(module->linked, NULL);
+    handlebars_vm_link(module);
+#if HAVE_COMPUTED_GOTOS
+    ck_assert_ptr_ne(module->linked, NULL);
+    for (i = 0; i < module->opcode_count; i++) {
+        ck_assert_ptr_ne(module->opcodes[i].handler, NULL);
+    }
+#endif
+
+    for (i = 0; i < 2; i++) {
+        result = handlebars_vm_execute(vm, module, input);
+        ck_assert_str_eq(hbs_str_val(result), "ceg2");
+        handlebars_talloc_free(result);
+    }
+
+    // An unknown opcode is linked to the error handler
+    module->opcodes[0].type = (enum handlebars_opcode_type) 9999;
+    module->linked = NULL;
+    if (handlebars_setjmp_ex(context, &jmp)) {
+        goto error;
+    }
+    (void) handlebars_vm_execute(vm, module, input);
+    ck_abort_msg("Expected an unhandled opcode error");
+
+error:
+    context->e->jmp = NULL;
+    ck_assert_int_eq(handlebars_error_num(context), HANDLEBARS_ERROR);
+    ck_assert_ptr_ne(strstr(handlebars_error_msg(context), "Unhandled opcode"), NULL);
+    handlebars_vm_reset(vm);
+
+    HANDLEBARS_VALUE_UNDECL(partials);
+    HANDLEBARS_VALUE_UNDECL(input);
+}
+END_TEST
+
+static int helper_calls;
+
+static struct handlebars_value * helper_a(HANDLEBARS_HELPER_ARGS)
+{
+    helper_calls++;
+    handlebars_value_str(rv, handlebars_string_ctor(HBSCTX(vm), HBS_STRL("a")));
+    return rv;
+}
+
+static struct handlebars_value * helper_b(HANDLEBARS_HELPER_ARGS)
+{
+    helper_calls++;
+    handlebars_value_str(rv, handlebars_string_ctor(HBSCTX(vm), HBS_STRL("b")));
+    return rv;
+}
+
+static void execute_expect(struct handlebars_module * module, struct handlebars_value * input, const char * expected)
+{
+    struct handlebars_string * result = handlebars_vm_execute(vm, module, input);
+    ck_assert_str_eq(hbs_str_val(result), expected);
+    handlebars_talloc_free(result);
+}
+
+START_TEST(test_vm_helper_cache)
+{
+    HANDLEBARS_VALUE_DECL(input);
+    HANDLEBARS_VALUE_DECL(partials);
+    HANDLEBARS_VALUE_DECL(helpers);
+    HANDLEBARS_VALUE_DECL(tmp);
+    struct handlebars_module * module = compile(
+        "{{#each list}}{{h}}{{lookup ../list 0}}{{a_helper_name_that_is_too_long_to_be_cached}}|{{/each}}"
+    );
+    struct handlebars_map * map;
+
+    make_input(input, partials);
+
+    // Names resolve to nothing, a builtin or a helper, and are resolved again when the helpers are set
+    execute_expect(module, input, "1|1|1|");
+
+    map = handlebars_map_ctor(context, 3);
+    handlebars_value_helper(tmp, helper_a);
+    map = handlebars_map_str_add(map, HBS_STRL("h"), tmp);
+    map = handlebars_map_str_add(map, HBS_STRL("a_helper_name_that_is_too_long_to_be_cached"), tmp);
+    handlebars_value_map(helpers, map);
+    handlebars_vm_set_helpers(vm, helpers);
+    helper_calls = 0;
+    execute_expect(module, input, "a1a|a1a|a1a|");
+    ck_assert_int_eq(helper_calls, 6);
+
+    // Helpers override the builtins
+    map = handlebars_map_ctor(context, 3);
+    map = handlebars_map_str_add(map, HBS_STRL("h"), tmp);
+    map = handlebars_map_str_add(map, HBS_STRL("a_helper_name_that_is_too_long_to_be_cached"), tmp);
+    handlebars_value_helper(tmp, helper_b);
+    map = handlebars_map_str_add(map, HBS_STRL("lookup"), tmp);
+    handlebars_value_map(helpers, map);
+    handlebars_vm_set_helpers(vm, helpers);
+    execute_expect(module, input, "aba|aba|aba|");
+
+    HANDLEBARS_VALUE_UNDECL(tmp);
+    HANDLEBARS_VALUE_UNDECL(helpers);
+    HANDLEBARS_VALUE_UNDECL(partials);
+    HANDLEBARS_VALUE_UNDECL(input);
+}
+END_TEST
+
+static size_t count_partial_modules(void)
+{
+    struct handlebars_vm_partial_module * entry;
+    size_t count = 0;
+    size_t i;
+
+    for (i = 0; i < HANDLEBARS_VM_PARTIAL_MODULES_SIZE; i++) {
+        for (entry = vm->partial_modules[i]; entry != NULL; entry = entry->next) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+static void set_partial(struct handlebars_value * partials, const char * tmpl)
+{
+    HANDLEBARS_VALUE_DECL(tmp);
+    struct handlebars_map * map = handlebars_map_ctor(context, 1);
+
+    handlebars_value_str(tmp, handlebars_string_ctor(context, tmpl, strlen(tmpl)));
+    map = handlebars_map_str_add(map, HBS_STRL("p"), tmp);
+    handlebars_value_map(partials, map);
+    handlebars_vm_set_partials(vm, partials);
+
+    HANDLEBARS_VALUE_UNDECL(tmp);
+}
+
+START_TEST(test_vm_partial_modules)
+{
+    HANDLEBARS_VALUE_DECL(input);
+    HANDLEBARS_VALUE_DECL(partials);
+    struct handlebars_module * module = compile("{{#each list}}{{> p}}{{/each}}");
+    struct handlebars_module * partial_module;
+    size_t i;
+
+    make_input(input, partials);
+    set_partial(partials, "{{.}}-");
+
+    // A string partial is compiled once and kept for the following renders
+    execute_expect(module, input, "1-2-3-");
+    ck_assert_uint_eq(count_partial_modules(), 1);
+    for (i = 0; i < HANDLEBARS_VM_PARTIAL_MODULES_SIZE && vm->partial_modules[i] == NULL; i++);
+    partial_module = vm->partial_modules[i]->module;
+    execute_expect(module, input, "1-2-3-");
+    ck_assert_uint_eq(count_partial_modules(), 1);
+    ck_assert_ptr_eq(vm->partial_modules[i]->module, partial_module);
+
+    // It is compiled again for other compiler flags
+    handlebars_vm_set_flags(vm, handlebars_compiler_flag_strict);
+    execute_expect(module, input, "1-2-3-");
+    ck_assert_uint_eq(count_partial_modules(), 2);
+    handlebars_vm_set_flags(vm, 0);
+
+    // Setting the partials releases the modules before the next render
+    set_partial(partials, "{{.}}+");
+    execute_expect(module, input, "1+2+3+");
+    ck_assert_uint_eq(count_partial_modules(), 1);
+
+    HANDLEBARS_VALUE_UNDECL(partials);
+    HANDLEBARS_VALUE_UNDECL(input);
+}
+END_TEST
+
+START_TEST(test_vm_partial_modules_eviction)
+{
+    HANDLEBARS_VALUE_DECL(input);
+    HANDLEBARS_VALUE_DECL(partials);
+    HANDLEBARS_VALUE_DECL(tmp);
+    struct handlebars_module * module = compile("{{> outer}}");
+    struct handlebars_map * map;
+    struct handlebars_vm_partial_module * entry;
+    size_t n = HANDLEBARS_VM_PARTIAL_MODULES_SIZE * HANDLEBARS_VM_PARTIAL_MODULES_BUCKET_SIZE * 2;
+    char outer[4096] = "";
+    char expected[1024] = "";
+    char buf[32];
+    size_t count;
+    size_t i;
+
+    make_input(input, partials);
+    map = handlebars_map_ctor(context, n + 1);
+    for (i = 0; i < n; i++) {
+        snprintf(buf, sizeof(buf), "%zu,", i);
+        strcat(expected, buf);
+        handlebars_value_str(tmp, handlebars_string_ctor(context, buf, strlen(buf)));
+        snprintf(buf, sizeof(buf), "{{> p%zu}}", i);
+        strcat(outer, buf);
+        snprintf(buf, sizeof(buf), "p%zu", i);
+        map = handlebars_map_str_add(map, buf, strlen(buf), tmp);
+    }
+    handlebars_value_str(tmp, handlebars_string_ctor(context, outer, strlen(outer)));
+    map = handlebars_map_str_add(map, HBS_STRL("outer"), tmp);
+    handlebars_value_map(partials, map);
+    handlebars_vm_set_partials(vm, partials);
+
+    // The partial that calls the others may be dropped from its bucket while it is executing
+    execute_expect(module, input, expected);
+    ck_assert_ptr_eq(vm->partial_modules_evicted, NULL);
+    for (i = 0; i < HANDLEBARS_VM_PARTIAL_MODULES_SIZE; i++) {
+        count = 0;
+        for (entry = vm->partial_modules[i]; entry != NULL; entry = entry->next) {
+            count++;
+        }
+        ck_assert_uint_le(count, HANDLEBARS_VM_PARTIAL_MODULES_BUCKET_SIZE);
+    }
+    ck_assert_uint_gt(count_partial_modules(), 0);
+
+    // Resetting the VM releases them
+    handlebars_vm_reset(vm);
+    ck_assert_uint_eq(count_partial_modules(), 0);
+    execute_expect(module, input, expected);
+
+    HANDLEBARS_VALUE_UNDECL(tmp);
+    HANDLEBARS_VALUE_UNDECL(partials);
+    HANDLEBARS_VALUE_UNDECL(input);
+}
+END_TEST
+
+START_TEST(test_vm_hash_arguments)
+{
+    HANDLEBARS_VALUE_DECL(input);
+    HANDLEBARS_VALUE_DECL(partials);
+    HANDLEBARS_VALUE_DECL(tmp);
+    struct handlebars_module * module = compile("{{> q a=1 b=2 c=3 d=4 e=5 f=6}}|{{> q}}|{{> q a=7}}");
+    struct handlebars_map * map;
+
+    make_input(input, partials);
+    map = handlebars_map_ctor(context, 1);
+    handlebars_value_str(tmp, handlebars_string_ctor(context, HBS_STRL("{{a}}{{f}}{{name}}")));
+    map = handlebars_map_str_add(map, HBS_STRL("q"), tmp);
+    handlebars_value_map(partials, map);
+    handlebars_vm_set_partials(vm, partials);
+
+    // Hash arguments must not leak into the shared empty hash of the calls without any
+    struct handlebars_string * result = handlebars_vm_execute(vm, module, input);
+    ck_assert_str_eq(hbs_str_val(result), "16&lt;b&gt;|&lt;b&gt;|7&lt;b&gt;");
+
+    HANDLEBARS_VALUE_UNDECL(tmp);
+    HANDLEBARS_VALUE_UNDECL(partials);
+    HANDLEBARS_VALUE_UNDECL(input);
+}
+END_TEST
+
+static Suite * suite(void);
+static Suite * suite(void)
+{
+    Suite * s = suite_create("VM");
+
+    REGISTER_TEST_FIXTURE(s, test_vm_arena, "Arena");
+    REGISTER_TEST_FIXTURE(s, test_vm_failed_partial_compile, "Failed partial compile");
+    REGISTER_TEST_FIXTURE(s, test_vm_reset, "Reset after a failed render");
+    REGISTER_TEST_FIXTURE(s, test_vm_failed_renders, "Failed renders");
+    REGISTER_TEST_FIXTURE(s, test_vm_numeric_segments, "Numeric path segments");
+    REGISTER_TEST_FIXTURE(s, test_vm_link, "Link");
+    REGISTER_TEST_FIXTURE(s, test_vm_helper_cache, "Helper cache");
+    REGISTER_TEST_FIXTURE(s, test_vm_partial_modules, "Partial modules");
+    REGISTER_TEST_FIXTURE(s, test_vm_partial_modules_eviction, "Partial module eviction");
+    REGISTER_TEST_FIXTURE(s, test_vm_hash_arguments, "Hash arguments");
+
+    return s;
+}
+
+int main(void)
+{
+    return default_main(&suite);
+}